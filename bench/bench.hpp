@@ -0,0 +1,23 @@
+#pragma once
+
+#include <wrappy/wrappy.h>
+
+#include <functional>
+#include <string>
+
+// Minimal harness for the wrappy benchmarks, see main.cpp
+namespace bench {
+
+// Registers a benchmark. `body` is one operation; `cost` is a rough
+// estimate of its price relative to a plain call, and divides the number
+// of iterations so expensive operations don't dominate the run time.
+void add(const std::string& name, std::function<void()> body, size_t cost = 1);
+
+// Registration functions of the individual suites
+void addCallBenchmarks();
+void addConvertBenchmarks();
+void addLookupBenchmarks();
+void addIterateBenchmarks();
+void addCallbackBenchmarks();
+
+} // end namespace bench
@@ -0,0 +1,36 @@
+// Calls from python into C++ through the trampolines. Python maps the
+// callback over 1000 items, so one operation is 1000 callbacks.
+#include "bench.hpp"
+
+namespace bench {
+
+namespace {
+
+wrappy::PythonObject identity(const std::vector<wrappy::PythonObject>& args,
+    const std::map<const char*, wrappy::PythonObject>&)
+{
+    return args[0];
+}
+
+void addMap(const std::string& name, wrappy::PythonObject callback, wrappy::PythonObject list)
+{
+    wrappy::Function<wrappy::PythonObject(wrappy::PythonObject, wrappy::PythonObject)>
+        consume(wrappy::eval("lambda f, items: [f(x) for x in items]"));
+    add("callback/" + name, [=]() {
+        consume(callback, list);
+    }, 1000 / 10);
+}
+
+} // end unnamed namespace
+
+void addCallbackBenchmarks()
+{
+    wrappy::PythonObject list = wrappy::call("list", wrappy::call("range", 1000));
+
+    addMap("python lambda", wrappy::eval("lambda x: x"), list);
+    addMap("Lambda", wrappy::construct(identity), list);
+    addMap("typed long(long)", wrappy::construct([](long x) { return x; }), list);
+    addMap("typed void(PythonObject)", wrappy::construct([](wrappy::PythonObject) { }), list);
+}
+
+} // end namespace bench
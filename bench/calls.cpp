@@ -0,0 +1,60 @@
+// Round trips of calls from C++ into python
+#include "bench.hpp"
+
+namespace bench {
+
+void addCallBenchmarks()
+{
+    using namespace wrappy::literals;
+
+    auto list = wrappy::call("list");
+    std::vector<wrappy::PythonObject> args {list};
+    wrappy::PythonObject noop = wrappy::eval("lambda: None");
+
+    add("call/name/empty", []() {
+        wrappy::call("time.time");
+    });
+    add("call/name/double", []() {
+        wrappy::call("math.sqrt", 4.0);
+    });
+    add("call/name/kwargs", []() {
+        wrappy::call("datetime.timedelta", 1, std::make_pair("hours", 1));
+    });
+    add("call/name/kwargs Name", []() {
+        wrappy::call("datetime.timedelta", 1, std::make_pair("hours"_name, 1));
+    });
+    add("call/object/method", [=]() {
+        wrappy::call(list, "__len__");
+    });
+    add("call/object/method Name", [=]() {
+        wrappy::call(list, "__len__"_name);
+    });
+    add("call/object/function", [=]() {
+        noop();
+    });
+    add("attr/string", [=]() {
+        list.attr("append");
+    });
+    add("attr/Name", [=]() {
+        list.attr("append"_name);
+    });
+    add("callWithArgs/name/vector", [=]() {
+        wrappy::callWithArgs("len", args);
+    });
+
+    wrappy::Function<double(double)> sqrt("math.sqrt");
+    add("Function/double(double)", [=]() {
+        sqrt(4.0);
+    });
+
+    // A batch of 1000 calls, compare with call/name/double
+    std::vector<double> batch(1000, 4.0);
+    add("callMany/Loop", [=]() {
+        wrappy::callMany<double>("math.sqrt", batch);
+    }, batch.size());
+    add("callMany/Map", [=]() {
+        wrappy::callMany<double>("math.sqrt", batch, wrappy::Batch::Map);
+    }, batch.size());
+}
+
+} // end namespace bench
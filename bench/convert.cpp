@@ -0,0 +1,82 @@
+// Conversions between C++ values and python objects
+#include "bench.hpp"
+
+#include <map>
+#include <memory>
+#include <tuple>
+
+namespace bench {
+
+namespace {
+
+template<typename T>
+void addConstruct(const std::string& name, T value, size_t cost = 1)
+{
+    add("construct/" + name, [=]() {
+        wrappy::construct(value);
+    }, cost);
+}
+
+template<typename T>
+void addAs(const std::string& name, const T& value, size_t cost = 1)
+{
+    wrappy::PythonObject object = wrappy::construct(value);
+    add("as/" + name, [=]() {
+        object.as<T>();
+    }, cost);
+}
+
+} // end unnamed namespace
+
+void addConvertBenchmarks()
+{
+    const size_t large = 100000;
+    std::vector<double> doubles(large, 1.5);
+    std::vector<long> longs(large, 42);
+    std::vector<std::string> strings(1000, "wrappy");
+    std::map<std::string, int> map;
+    for (int i = 0; i < 100; ++i) {
+        map[std::to_string(i)] = i;
+    }
+
+    addConstruct("bool", true);
+    addConstruct("int", 42);
+    addConstruct("long long", 1ll << 40);
+    addConstruct("double", 1.5);
+    addConstruct("const char*", "wrappy");
+    addConstruct("string", std::string("wrappy"));
+    addConstruct("pair", std::make_pair(1, 2.0));
+    addConstruct("tuple", std::make_tuple(1, 2.0, std::string("three")));
+    addConstruct("vector<double>/100000", doubles, large / 10);
+    addConstruct("vector<long>/100000", longs, large / 10);
+    addConstruct("vector<string>/1000", strings, 1000 / 10);
+    addConstruct("map<string,int>/100", map, 100 / 10);
+
+    addAs("long", 42l);
+    addAs("double", 1.5);
+    addAs("string", std::string("wrappy"));
+    addAs("vector<double>/100000", doubles, large / 10);
+    addAs("vector<long>/100000", longs, large / 10);
+    addAs("map<string,int>/100", map, 100 / 10);
+
+    // Zero-copy in both directions, the vector outlives the benchmarks
+    auto shared = std::make_shared<std::vector<double>>(doubles);
+    add("construct/buffer(vector<double>)/100000", [=]() {
+        wrappy::construct(wrappy::buffer(*shared));
+    }, 10);
+    wrappy::PythonObject exported = wrappy::construct(wrappy::buffer(*shared));
+    add("ArrayView<double>/100000", [=]() {
+        wrappy::ArrayView<double> view(exported);
+    }, 10);
+
+    // Consumed by python's sum(), materialized first or streamed
+    auto values = std::make_shared<std::vector<long>>(longs);
+    add("sum(construct(vector<long>))/100000", [=]() {
+        wrappy::call("sum", *values);
+    }, large / 10);
+    add("sum(constructIter(vector<long>))/100000", [=]() {
+        wrappy::call("sum", wrappy::constructIter(values->begin(), values->end()));
+    }, large / 10);
+}
+
+} // end namespace bench
@@ -0,0 +1,40 @@
+// Iteration over python lists and generators, 1000 items per operation
+#include "bench.hpp"
+
+namespace bench {
+
+void addIterateBenchmarks()
+{
+    const long size = 1000;
+    wrappy::PythonObject list = wrappy::call("list", wrappy::call("range", size));
+    wrappy::Function<wrappy::PythonObject(long)> generator(
+        wrappy::eval("lambda n: (i for i in range(n))"));
+
+    add("iterate/list/PythonIterator", [=]() {
+        for (wrappy::PythonObject item : list) {
+            (void)item;
+        }
+    }, size / 10);
+    add("iterate/list/range<long>", [=]() {
+        for (long item : wrappy::range<long>(list)) {
+            (void)item;
+        }
+    }, size / 10);
+    add("iterate/list/chunks", [=]() {
+        for (const auto& chunk : wrappy::chunks(list, 256)) {
+            (void)chunk;
+        }
+    }, size / 10);
+    add("iterate/generator/PythonIterator", [=]() {
+        for (wrappy::PythonObject item : generator(size)) {
+            (void)item;
+        }
+    }, size / 10);
+    add("iterate/generator/range<long>", [=]() {
+        for (long item : wrappy::range<long>(generator(size))) {
+            (void)item;
+        }
+    }, size / 10);
+}
+
+} // end namespace bench
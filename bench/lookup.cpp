@@ -0,0 +1,45 @@
+// Name resolution by load(), and compiled code of eval()
+#include "bench.hpp"
+
+namespace bench {
+
+void addLookupBenchmarks()
+{
+    add("load/cached/builtin", []() {
+        wrappy::load("len");
+    });
+    add("load/cached/email.mime.text.MIMEText", []() {
+        wrappy::load("email.mime.text.MIMEText");
+    });
+    add("load/uncached/os.path.join", []() {
+        wrappy::invalidateCache("os.path.join");
+        wrappy::load("os.path.join");
+    }, 10);
+    add("load/uncached/email.mime.text.MIMEText", []() {
+        wrappy::invalidateCache("email.mime.text.MIMEText");
+        wrappy::load("email.mime.text.MIMEText");
+    }, 10);
+    add("load/missing/negative cache", []() {
+        try {
+            wrappy::load("wrappy_bench_missing.function");
+        } catch (const wrappy::WrappyError&) { }
+    });
+    add("load/missing/uncached", []() {
+        wrappy::invalidateCache("wrappy_bench_missing.function");
+        try {
+            wrappy::load("wrappy_bench_missing.function");
+        } catch (const wrappy::WrappyError&) { }
+    }, 100);
+
+    auto amount = wrappy::construct(10);
+    add("eval/cached", [=]() {
+        wrappy::eval("amount > 5 and amount % 2 == 0", {{"amount", amount}});
+    });
+    add("eval/builtin eval", [=]() {
+        auto locals = wrappy::call("dict");
+        wrappy::call(locals, "__setitem__", "amount", amount);
+        wrappy::call("eval", "amount > 5 and amount % 2 == 0", locals);
+    }, 10);
+}
+
+} // end namespace bench
@@ -0,0 +1,130 @@
+// Microbenchmarks of the call, conversion, lookup and iteration paths.
+// Run with the python backends to compare, e.g.
+//
+//     ./wrappy_bench [--json] [--iterations N] [--repeat N] [filter]
+//
+// Every benchmark is run `repeat` times; the median and the fastest run
+// are reported in nanoseconds per operation. With --json, the results are
+// printed as a JSON document, so runs can be stored and compared.
+
+#include "bench.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace {
+
+struct Benchmark {
+    std::string name;
+    std::function<void()> body;
+    size_t cost;
+};
+
+struct Result {
+    std::string name;
+    size_t iterations;
+    double medianNs;
+    double minNs;
+};
+
+std::vector<Benchmark>& benchmarks()
+{
+    static std::vector<Benchmark> all;
+    return all;
+}
+
+Result run(const Benchmark& benchmark, size_t iterations, size_t repeat)
+{
+    iterations = std::max<size_t>(iterations / benchmark.cost, 1);
+    benchmark.body(); // warm up the caches
+
+    std::vector<double> runs;
+    for (size_t r = 0; r < repeat; ++r) {
+        auto start = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < iterations; ++i) {
+            benchmark.body();
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        runs.push_back(std::chrono::duration<double, std::nano>(elapsed).count() / iterations);
+    }
+
+    std::sort(runs.begin(), runs.end());
+    return Result {benchmark.name, iterations, runs[runs.size() / 2], runs.front()};
+}
+
+} // end unnamed namespace
+
+namespace bench {
+
+void add(const std::string& name, std::function<void()> body, size_t cost)
+{
+    benchmarks().push_back(Benchmark {name, std::move(body), std::max<size_t>(cost, 1)});
+}
+
+} // end namespace bench
+
+int main(int argc, char** argv)
+{
+    bool json = false;
+    size_t iterations = 200000;
+    size_t repeat = 5;
+    std::string filter;
+
+    for (int i = 1; i < argc; ++i) {
+        if (!std::strcmp(argv[i], "--json")) {
+            json = true;
+        } else if (!std::strcmp(argv[i], "--iterations") && i + 1 < argc) {
+            iterations = std::strtoul(argv[++i], nullptr, 10);
+        } else if (!std::strcmp(argv[i], "--repeat") && i + 1 < argc) {
+            repeat = std::max<size_t>(std::strtoul(argv[++i], nullptr, 10), 1);
+        } else if (argv[i][0] != '-') {
+            filter = argv[i];
+        } else {
+            std::fprintf(stderr,
+                "usage: %s [--json] [--iterations N] [--repeat N] [filter]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    bench::addCallBenchmarks();
+    bench::addConvertBenchmarks();
+    bench::addLookupBenchmarks();
+    bench::addIterateBenchmarks();
+    bench::addCallbackBenchmarks();
+
+    std::string version = wrappy::call("platform.python_version").as<std::string>();
+    bool vectorcall = wrappy::debug::vectorcallEnabled();
+    if (json) {
+        std::printf("{\"python\": \"%s\", \"vectorcall\": %s, \"repeat\": %zu, \"results\": [",
+            version.c_str(), vectorcall ? "true" : "false", repeat);
+    } else {
+        std::printf("python %s, vectorcall %s\n", version.c_str(), vectorcall ? "on" : "off");
+        std::printf("%-44s %12s %12s %10s\n", "benchmark", "median ns", "min ns", "iterations");
+    }
+
+    bool first = true;
+    for (const Benchmark& benchmark : benchmarks()) {
+        if (benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        Result result = run(benchmark, iterations, repeat);
+        if (json) {
+            std::printf("%s\n  {\"name\": \"%s\", \"median_ns\": %.1f, \"min_ns\": %.1f, \"iterations\": %zu}",
+                first ? "" : ",", result.name.c_str(), result.medianNs, result.minNs,
+                result.iterations);
+        } else {
+            std::printf("%-44s %12.1f %12.1f %10zu\n", result.name.c_str(),
+                result.medianNs, result.minNs, result.iterations);
+        }
+        first = false;
+    }
+    if (json) {
+        std::printf("\n]}\n");
+    }
+
+    return 0;
+}
@@ -0,0 +1,347 @@
+// Python header must be included first since they insist on
+// unconditionally defining some system macros
+// (http://bugs.python.org/issue1045893, still broken in python3.4)
+#include <Python.h>
+#include "python_compat.h"
+
+#include <wrappy/wrappy.h>
+
+#include <cstring>
+
+namespace wrappy {
+namespace detail {
+
+#ifdef WRAPPY_HEAP_TYPES
+PyTypeObject* interpreterType(PyType_Spec* spec);
+#endif
+
+} // end namespace detail
+} // end namespace wrappy
+
+namespace {
+
+using namespace wrappy;
+
+// A python object exporting a Buffer through the buffer protocol.
+// Memoryviews and numpy arrays created from it keep it alive, and with it
+// the owner of the memory.
+struct BufferExporter {
+    PyObject_HEAD
+    Buffer* buffer;
+    std::vector<Py_ssize_t>* shape;
+    std::vector<Py_ssize_t>* strides;
+};
+
+bool isCContiguous(const Buffer& buffer)
+{
+    ptrdiff_t expected = buffer.itemsize;
+    for (size_t i = buffer.shape.size(); i > 0; --i) {
+        if (buffer.shape[i-1] > 1 && buffer.strides[i-1] != expected) {
+            return false;
+        }
+        expected *= buffer.shape[i-1];
+    }
+    return true;
+}
+
+bool isFContiguous(const Buffer& buffer)
+{
+    ptrdiff_t expected = buffer.itemsize;
+    for (size_t i = 0; i < buffer.shape.size(); ++i) {
+        if (buffer.shape[i] > 1 && buffer.strides[i] != expected) {
+            return false;
+        }
+        expected *= buffer.shape[i];
+    }
+    return true;
+}
+
+size_t elementCount(const Buffer& buffer)
+{
+    size_t count = 1;
+    for (ptrdiff_t extent : buffer.shape) {
+        count *= extent;
+    }
+    return count;
+}
+
+int exporterGetBuffer(PyObject* self, Py_buffer* view, int flags)
+{
+    auto exporter = reinterpret_cast<BufferExporter*>(self);
+    const Buffer& buffer = *exporter->buffer;
+
+    if ((flags & PyBUF_WRITABLE) == PyBUF_WRITABLE && buffer.readonly) {
+        PyErr_SetString(PyExc_BufferError, "Wrappy: Buffer is read-only.");
+        return -1;
+    }
+
+    // Without strides, the consumer assumes the C layout
+    bool cContiguous = isCContiguous(buffer);
+    bool fContiguous = isFContiguous(buffer);
+    bool ok = true;
+    if ((flags & PyBUF_C_CONTIGUOUS) == PyBUF_C_CONTIGUOUS
+            || (flags & PyBUF_STRIDES) != PyBUF_STRIDES) {
+        ok = cContiguous;
+    } else if ((flags & PyBUF_F_CONTIGUOUS) == PyBUF_F_CONTIGUOUS) {
+        ok = fContiguous;
+    } else if ((flags & PyBUF_ANY_CONTIGUOUS) == PyBUF_ANY_CONTIGUOUS) {
+        ok = cContiguous || fContiguous;
+    }
+    if (!ok) {
+        PyErr_SetString(PyExc_BufferError, "Wrappy: Buffer doesn't have the requested layout.");
+        return -1;
+    }
+
+    view->obj = self;
+    Py_INCREF(self);
+    view->buf = buffer.data;
+    view->len = elementCount(buffer) * buffer.itemsize;
+    view->readonly = buffer.readonly;
+    view->itemsize = buffer.itemsize;
+    view->format = (flags & PyBUF_FORMAT) ? const_cast<char*>(buffer.format) : nullptr;
+    view->ndim = buffer.shape.size();
+    view->shape = (flags & PyBUF_ND) == PyBUF_ND ? exporter->shape->data() : nullptr;
+    view->strides = (flags & PyBUF_STRIDES) == PyBUF_STRIDES ? exporter->strides->data() : nullptr;
+    view->suboffsets = nullptr;
+    view->internal = nullptr;
+
+    return 0;
+}
+
+void exporterDealloc(PyObject* self)
+{
+    auto exporter = reinterpret_cast<BufferExporter*>(self);
+    delete exporter->buffer;
+    delete exporter->shape;
+    delete exporter->strides;
+    PyTypeObject* type = Py_TYPE(self);
+    PyObject_Del(self);
+#ifdef WRAPPY_HEAP_TYPES
+    Py_DECREF(type); // instances of heap types own a reference
+#else
+    (void)type;
+#endif
+}
+
+#ifdef WRAPPY_HEAP_TYPES
+PyType_Slot s_ExporterSlots[] = {
+    {Py_bf_getbuffer, reinterpret_cast<void*>(exporterGetBuffer)},
+    {Py_tp_dealloc, reinterpret_cast<void*>(exporterDealloc)},
+    {0, nullptr},
+};
+
+PyType_Spec s_ExporterSpec = {"wrappy.Buffer", sizeof(BufferExporter), 0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION, s_ExporterSlots};
+
+PyTypeObject* exporterType()
+{
+    return detail::interpreterType(&s_ExporterSpec);
+}
+#else
+PyBufferProcs s_ExporterBufferProcs;
+PyTypeObject s_ExporterType = compat::staticType();
+
+PyTypeObject* exporterType()
+{
+    if (!(s_ExporterType.tp_flags & Py_TPFLAGS_READY)) {
+        s_ExporterBufferProcs.bf_getbuffer = exporterGetBuffer;
+        s_ExporterType.tp_name = "wrappy.Buffer";
+        s_ExporterType.tp_basicsize = sizeof(BufferExporter);
+        s_ExporterType.tp_dealloc = exporterDealloc;
+        s_ExporterType.tp_as_buffer = &s_ExporterBufferProcs;
+        s_ExporterType.tp_flags = Py_TPFLAGS_DEFAULT;
+#ifdef Py_TPFLAGS_HAVE_NEWBUFFER
+        s_ExporterType.tp_flags |= Py_TPFLAGS_HAVE_NEWBUFFER;
+#endif
+        if (PyType_Ready(&s_ExporterType) < 0) {
+            detail::throwPythonError("Wrappy: Couldn't initialize buffer type.");
+        }
+    }
+    return &s_ExporterType;
+}
+#endif
+
+PythonObject exportBuffer(const Buffer& buffer)
+{
+    if (buffer.shape.size() != buffer.strides.size()) {
+        throw WrappyError("Wrappy: Buffer shape and strides don't match.");
+    }
+
+    PythonObject exporter(PythonObject::owning {},
+        reinterpret_cast<PyObject*>(PyObject_New(BufferExporter, exporterType())));
+    if (!exporter) {
+        detail::throwPythonError("Wrappy: Couldn't create buffer object.");
+    }
+
+    // PyObject_New doesn't initialize the fields, and the dealloc deletes
+    // them if one of the allocations throws
+    auto raw = reinterpret_cast<BufferExporter*>(exporter.get());
+    raw->buffer = nullptr;
+    raw->shape = nullptr;
+    raw->strides = nullptr;
+    raw->buffer = new Buffer(buffer);
+    raw->shape = new std::vector<Py_ssize_t>(buffer.shape.begin(), buffer.shape.end());
+    raw->strides = new std::vector<Py_ssize_t>(buffer.strides.begin(), buffer.strides.end());
+
+    return exporter;
+}
+
+// Copies the element at the given index, and all following dimensions
+void gather(const Buffer& buffer, size_t dim, const char* src, char*& dst)
+{
+    if (dim == buffer.shape.size()) {
+        std::memcpy(dst, src, buffer.itemsize);
+        dst += buffer.itemsize;
+        return;
+    }
+    for (ptrdiff_t i = 0; i < buffer.shape[dim]; ++i) {
+        gather(buffer, dim+1, src + i*buffer.strides[dim], dst);
+    }
+}
+
+// Classifies a struct module format, e.g. 'l' and 'q' are the same kind
+// of element if they have the same itemsize.
+char formatKind(const char* format)
+{
+    if (!format) {
+        return 'u'; // unsigned bytes
+    }
+
+    // Native byte order and alignment is all we can deal with anyways
+    if (*format == '@' || *format == '=') {
+        ++format;
+    }
+    if (format[0] == '\0' || format[1] != '\0') {
+        return '\0'; // structs, sub-arrays, unknown byte order, ...
+    }
+
+    switch (*format) {
+    case 'b': case 'h': case 'i': case 'l': case 'q': case 'n':
+        return 'i';
+    case 'B': case 'H': case 'I': case 'L': case 'Q': case 'N':
+        return 'u';
+    case 'e': case 'f': case 'd':
+        return 'f';
+    case '?':
+        return 'b';
+    case 'c':
+        return 'c';
+    default:
+        return '\0';
+    }
+}
+
+} // end unnamed namespace
+
+namespace wrappy {
+namespace detail {
+
+void readyBufferType()
+{
+    exporterType();
+}
+
+BufferHandle acquireBuffer(PyObject* obj, const char* format, size_t itemsize,
+    bool writable, bool contiguous)
+{
+    AutoGil gil;
+    if (!obj || !PyObject_CheckBuffer(obj)) {
+        throw WrappyError("Wrappy: Object does not support the buffer protocol.");
+    }
+
+    int flags = PyBUF_FORMAT
+        | (contiguous ? PyBUF_C_CONTIGUOUS : PyBUF_STRIDES)
+        | (writable ? PyBUF_WRITABLE : 0);
+
+    std::unique_ptr<Py_buffer> acquired(new Py_buffer);
+    if (PyObject_GetBuffer(obj, acquired.get(), flags) < 0) {
+        PyErr_Clear();
+        throw WrappyError(std::string("Wrappy: Couldn't get ")
+            + (writable ? "a writable " : "a ")
+            + (contiguous ? "contiguous " : "") + "buffer from object.");
+    }
+
+    std::shared_ptr<Py_buffer> view(acquired.release(), [](Py_buffer* view) {
+        AutoGil gil;
+        PyBuffer_Release(view);
+        delete view;
+    });
+
+    char kind = formatKind(view->format);
+    if (!kind || kind != formatKind(format) || size_t(view->itemsize) != itemsize) {
+        throw WrappyError(std::string("Wrappy: Buffer has format '")
+            + (view->format ? view->format : "B") + "', expected '" + format + "'.");
+    }
+
+    BufferHandle handle;
+    handle.data = view->buf;
+    handle.size = view->len / view->itemsize;
+    if (view->shape) {
+        handle.shape.assign(view->shape, view->shape + view->ndim);
+    } else {
+        handle.shape.push_back(handle.size);
+    }
+    if (view->strides) {
+        handle.strides.assign(view->strides, view->strides + view->ndim);
+    } else {
+        handle.strides.resize(handle.shape.size());
+        ptrdiff_t stride = itemsize;
+        for (size_t i = handle.shape.size(); i > 0; --i) {
+            handle.strides[i-1] = stride;
+            stride *= handle.shape[i-1];
+        }
+    }
+    handle.lock = view;
+
+    return handle;
+}
+
+} // end namespace detail
+
+Buffer Buffer::copy() const
+{
+    size_t bytes = elementCount(*this) * itemsize;
+    auto storage = std::make_shared<std::vector<char>>(bytes);
+
+    if (isCContiguous(*this)) {
+        std::memcpy(storage->data(), data, bytes);
+    } else {
+        char* dst = storage->data();
+        gather(*this, 0, static_cast<const char*>(data), dst);
+    }
+
+    Buffer res(*this);
+    res.data = storage->data();
+    res.readonly = false;
+    res.owner = storage;
+
+    // C-contiguous strides
+    ptrdiff_t stride = itemsize;
+    for (size_t i = shape.size(); i > 0; --i) {
+        res.strides[i-1] = stride;
+        stride *= shape[i-1];
+    }
+
+    return res;
+}
+
+PythonObject construct(const Buffer& buffer)
+{
+    detail::AutoGil gil;
+    PythonObject exporter = exportBuffer(buffer);
+    PythonObject view(PythonObject::owning {}, PyMemoryView_FromObject(exporter.get()));
+    if (!view) {
+        detail::throwPythonError("Wrappy: Couldn't create memoryview.");
+    }
+    return view;
+}
+
+PythonObject numpyArray(const Buffer& buffer)
+{
+    detail::AutoGil gil;
+    // numpy understands the buffer protocol, and keeps the exporter alive
+    // as the base of the returned array
+    return call("numpy.asarray", exportBuffer(buffer));
+}
+
+} // end namespace wrappy
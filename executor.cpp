@@ -0,0 +1,93 @@
+// Python header must be included first since they insist on
+// unconditionally defining some system macros
+// (http://bugs.python.org/issue1045893, still broken in python3.4)
+#include <Python.h>
+
+#include <wrappy/executor.h>
+#include <wrappy/detail/task_queue.hpp>
+
+#include <atomic>
+#include <thread>
+
+namespace wrappy {
+
+struct Executor::Impl {
+    explicit Impl(size_t capacity)
+      : queue(capacity)
+      , batches(0)
+    { }
+
+    detail::TaskQueue queue;
+    std::atomic<unsigned long long> batches;
+    std::thread thread;
+};
+
+Executor::Executor(size_t capacity)
+  : impl_(new Impl(capacity))
+{
+    if (!threadsEnabled()) {
+        throw WrappyError("Wrappy: Executor requires enableThreads().");
+    }
+    impl_->thread = std::thread([this]() { main(); });
+}
+
+Executor::~Executor()
+{
+    impl_->queue.close();
+    impl_->thread.join();
+}
+
+void Executor::post(std::function<void()> task)
+{
+    if (!impl_->queue.push(std::move(task))) {
+        throw WrappyError("Wrappy: Executor is shutting down.");
+    }
+}
+
+void Executor::main()
+{
+    // Keeps the thread state of this thread alive between batches
+    GilAcquire gil;
+
+    detail::TaskQueue::Batch batch;
+    for (;;) {
+        bool more;
+        {
+            GilRelease idle;
+            more = impl_->queue.pop(batch);
+        }
+        if (!more) {
+            break;
+        }
+
+        for (auto& task : batch) {
+            task(); // packaged tasks, exceptions end up in the future
+            task = nullptr; // captured objects die with the GIL held
+        }
+        batch.clear();
+        ++impl_->batches;
+    }
+}
+
+size_t Executor::queued() const
+{
+    return impl_->queue.size();
+}
+
+size_t Executor::capacity() const
+{
+    return impl_->queue.capacity();
+}
+
+unsigned long long Executor::batches() const
+{
+    return impl_->batches;
+}
+
+Executor& defaultExecutor()
+{
+    static Executor executor;
+    return executor;
+}
+
+} // end namespace wrappy
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <iterator>
+
+// Implementation of callMany()
+namespace wrappy {
+namespace detail {
+
+// The arguments of one call made by callMany(), tuples are unpacked.
+// item() is what Batch::Map passes to map() or itertools.starmap().
+template<typename T>
+struct BatchArguments {
+    static const size_t size = 1;
+    static const bool unpack = false;
+
+    static void set(PythonObject& tuple, const T& value)
+    {
+        setArgument(tuple, 0, construct(value));
+    }
+
+    static PythonObject item(const T& value) { return construct(value); }
+};
+
+template<typename... Ts>
+struct BatchArguments<std::tuple<Ts...>> {
+    static const size_t size = sizeof...(Ts);
+    static const bool unpack = true;
+
+    static void set(PythonObject& tuple, const std::tuple<Ts...>& value)
+    {
+        set(tuple, value, typename MakeIndexSequence<sizeof...(Ts)>::type());
+    }
+
+    static PythonObject item(const std::tuple<Ts...>& value)
+    {
+        PythonObject tuple;
+        prepareArgumentTuple(tuple, size);
+        set(tuple, value);
+        return tuple;
+    }
+
+    template<size_t... Is>
+    static void set(PythonObject& tuple, const std::tuple<Ts...>& value, IndexSequence<Is...>)
+    {
+        int expand[] = {0, (setArgument(tuple, Is, construct(std::get<Is>(value))), 0)...};
+        (void)expand;
+        (void)tuple;
+    }
+};
+
+template<typename R>
+struct BatchResult {
+    template<typename OutputIt>
+    static void put(OutputIt& out, PyObject* result)
+    {
+        *out = FromPython<R>::convert(result);
+        ++out;
+    }
+};
+
+template<>
+struct BatchResult<void> {
+    template<typename OutputIt>
+    static void put(OutputIt&, PyObject*) { }
+};
+
+// Returns list(map(function, arguments)), or with unpack the same for
+// itertools.starmap() over argument tuples. Empties arguments.
+PythonObject map(const PythonObject& function, std::vector<PythonObject>& arguments, bool unpack);
+
+} // end namespace detail
+
+template<typename R, typename Range, typename OutputIt>
+OutputIt callMany(const PythonObject& function, const Range& arguments,
+    OutputIt out, Batch batch)
+{
+    typedef typename std::decay<decltype(*std::begin(arguments))>::type Element;
+    typedef detail::BatchArguments<Element> Arguments;
+
+    detail::AutoGil gil;
+    if (batch == Batch::Map) {
+        std::vector<PythonObject> items;
+        for (const auto& element : arguments) {
+            items.push_back(Arguments::item(element));
+        }
+
+        detail::ItemSource results(detail::map(function, items, Arguments::unpack));
+        while (PyObject* result = results.next()) {
+            detail::BatchResult<R>::put(out, result);
+        }
+        return out;
+    }
+
+    PythonObject tuple;
+    for (const auto& element : arguments) {
+        unsigned long long start = detail::metricsClock();
+        detail::prepareArgumentTuple(tuple, Arguments::size);
+        Arguments::set(tuple, element);
+        PythonObject result = detail::callWithArgumentTuple(function, tuple, start);
+        detail::BatchResult<R>::put(out, result.get());
+    }
+    return out;
+}
+
+template<typename R, typename Range, typename OutputIt>
+OutputIt callMany(const std::string& function, const Range& arguments,
+    OutputIt out, Batch batch)
+{
+    return callMany<R>(load(function), arguments, out, batch);
+}
+
+template<typename R, typename Range>
+std::vector<R> callMany(const PythonObject& function, const Range& arguments, Batch batch)
+{
+    std::vector<R> results;
+    results.reserve(std::distance(std::begin(arguments), std::end(arguments)));
+    callMany<R>(function, arguments, std::back_inserter(results), batch);
+    return results;
+}
+
+template<typename R, typename Range>
+std::vector<R> callMany(const std::string& function, const Range& arguments, Batch batch)
+{
+    return callMany<R>(load(function), arguments, batch);
+}
+
+} // end namespace wrappy
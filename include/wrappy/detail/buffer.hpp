@@ -0,0 +1,209 @@
+#pragma once
+
+#include <type_traits>
+
+// Implementation of buffer()
+namespace wrappy {
+namespace detail {
+
+// Format characters of the struct module for arithmetic types
+template<typename T>
+struct BufferFormat {
+    static_assert(std::is_arithmetic<T>::value,
+        "Only arithmetic types can be exported as buffers");
+};
+
+#define WRAPPY_BUFFER_FORMAT(type, fmt) \
+    template<> struct BufferFormat<type> { \
+        static const char* format() { return fmt; } \
+    };
+
+WRAPPY_BUFFER_FORMAT(bool, "?")
+WRAPPY_BUFFER_FORMAT(char, "c")
+WRAPPY_BUFFER_FORMAT(signed char, "b")
+WRAPPY_BUFFER_FORMAT(unsigned char, "B")
+WRAPPY_BUFFER_FORMAT(short, "h")
+WRAPPY_BUFFER_FORMAT(unsigned short, "H")
+WRAPPY_BUFFER_FORMAT(int, "i")
+WRAPPY_BUFFER_FORMAT(unsigned int, "I")
+WRAPPY_BUFFER_FORMAT(long, "l")
+WRAPPY_BUFFER_FORMAT(unsigned long, "L")
+WRAPPY_BUFFER_FORMAT(long long, "q")
+WRAPPY_BUFFER_FORMAT(unsigned long long, "Q")
+WRAPPY_BUFFER_FORMAT(float, "f")
+WRAPPY_BUFFER_FORMAT(double, "d")
+
+#undef WRAPPY_BUFFER_FORMAT
+
+} // end namespace detail
+
+template<typename T>
+Buffer buffer(T* data, std::vector<ptrdiff_t> shape, std::vector<ptrdiff_t> strides)
+{
+    typedef typename std::remove_const<T>::type value_type;
+
+    Buffer res;
+    res.data = const_cast<value_type*>(data);
+    res.format = detail::BufferFormat<value_type>::format();
+    res.itemsize = sizeof(T);
+    res.readonly = std::is_const<T>::value;
+    res.shape = std::move(shape);
+    res.strides = std::move(strides);
+    return res;
+}
+
+template<typename T>
+Buffer buffer(T* data, size_t size)
+{
+    return buffer(data,
+        std::vector<ptrdiff_t> {static_cast<ptrdiff_t>(size)},
+        std::vector<ptrdiff_t> {sizeof(T)});
+}
+
+template<typename T>
+Buffer buffer(T* data, size_t rows, size_t cols)
+{
+    return buffer(data,
+        std::vector<ptrdiff_t> {static_cast<ptrdiff_t>(rows), static_cast<ptrdiff_t>(cols)},
+        std::vector<ptrdiff_t> {static_cast<ptrdiff_t>(cols * sizeof(T)), sizeof(T)});
+}
+
+template<typename T>
+Buffer buffer(std::vector<T>& v)
+{
+    return buffer(v.data(), v.size());
+}
+
+template<typename T>
+Buffer buffer(const std::vector<T>& v)
+{
+    return buffer(v.data(), v.size());
+}
+
+template<typename T>
+Buffer buffer(std::vector<T>&& v)
+{
+    // Moving the vector into the owner keeps the data pointer valid
+    auto owner = std::make_shared<std::vector<T>>(std::move(v));
+    Buffer res = buffer(owner->data(), owner->size());
+    res.owner = owner;
+    return res;
+}
+
+template<typename T, size_t N>
+Buffer buffer(std::array<T, N>& a)
+{
+    return buffer(a.data(), N);
+}
+
+template<typename T, size_t N>
+Buffer buffer(const std::array<T, N>& a)
+{
+    return buffer(a.data(), N);
+}
+
+} // end namespace wrappy
+
+// Implementation of ArrayView and NDArrayView
+namespace wrappy {
+namespace detail {
+
+// Throws a WrappyError if obj has no buffer with elements of the given
+// format and itemsize.
+BufferHandle acquireBuffer(PyObject* obj, const char* format, size_t itemsize,
+    bool writable, bool contiguous);
+
+template<typename T>
+BufferHandle acquireBuffer(const PythonObject& obj, bool contiguous)
+{
+    typedef typename std::remove_const<T>::type value_type;
+    return acquireBuffer(obj.get(), BufferFormat<value_type>::format(),
+        sizeof(T), !std::is_const<T>::value, contiguous);
+}
+
+inline ptrdiff_t bufferOffset(const ptrdiff_t*)
+{
+    return 0;
+}
+
+template<typename Head, typename... Tail>
+ptrdiff_t bufferOffset(const ptrdiff_t* strides, Head head, Tail... tail)
+{
+    return head * strides[0] + bufferOffset(strides+1, tail...);
+}
+
+} // end namespace detail
+
+template<typename T>
+ArrayView<T>::ArrayView(const PythonObject& obj)
+  : handle_(detail::acquireBuffer<T>(obj, true))
+{ }
+
+template<typename T>
+T* ArrayView<T>::data() const
+{
+    return static_cast<T*>(handle_.data);
+}
+
+template<typename T>
+size_t ArrayView<T>::size() const
+{
+    return handle_.size;
+}
+
+template<typename T>
+T& ArrayView<T>::operator[](size_t i) const
+{
+    return data()[i];
+}
+
+template<typename T>
+T* ArrayView<T>::begin() const
+{
+    return data();
+}
+
+template<typename T>
+T* ArrayView<T>::end() const
+{
+    return data() + size();
+}
+
+template<typename T>
+NDArrayView<T>::NDArrayView(const PythonObject& obj)
+  : handle_(detail::acquireBuffer<T>(obj, false))
+{ }
+
+template<typename T>
+T* NDArrayView<T>::data() const
+{
+    return static_cast<T*>(handle_.data);
+}
+
+template<typename T>
+size_t NDArrayView<T>::ndim() const
+{
+    return handle_.shape.size();
+}
+
+template<typename T>
+const std::vector<ptrdiff_t>& NDArrayView<T>::shape() const
+{
+    return handle_.shape;
+}
+
+template<typename T>
+const std::vector<ptrdiff_t>& NDArrayView<T>::strides() const
+{
+    return handle_.strides;
+}
+
+template<typename T>
+template<typename... Indices>
+T& NDArrayView<T>::operator()(Indices... indices) const
+{
+    auto offset = detail::bufferOffset(handle_.strides.data(), indices...);
+    return *reinterpret_cast<T*>(static_cast<char*>(handle_.data) + offset);
+}
+
+} // end namespace wrappy
@@ -1,81 +1,146 @@
 #pragma once
 
+#include <array>
+#include <utility>
+#include <type_traits>
+
 // Implementation of call()
 namespace wrappy {
 namespace detail {
 
-typedef std::vector<PythonObject> PositionalArgs;
-typedef std::vector<std::pair<std::string, PythonObject>> KeywordArgs;
+// A single converted argument of call(). Arguments without keyword
+// are positional. The keyword points into the caller's pair and is only
+// valid until the end of the full expression containing the call.
+// Keywords given as Name also come with their interned python string.
+struct Argument {
+    const char* keyword;
+    PyObject* name; // borrowed
+    PythonObject value;
+};
 
-template<typename... Args>
-void appendArgs(PositionalArgs& pargs, KeywordArgs& kwargs, Args... args);
+// The interned string of name in the current interpreter, borrowed.
+// Must be called with the GIL held.
+PyObject* internedName(const Name& name);
 
-// Base case
-template<>
-inline void appendArgs(PositionalArgs&, KeywordArgs&)
-{}
+// Calls function with the given arguments. The values may be moved into
+// the argument tuple, so argument objects must not be used afterwards.
+// convertStart is the metricsClock() before the arguments were converted.
+PythonObject callWithArguments(
+    const PythonObject& function, Argument* args, size_t size,
+    unsigned long long convertStart = 0);
+PythonObject callWithArguments(
+    const std::string& function, Argument* args, size_t size,
+    unsigned long long convertStart = 0);
+PythonObject callWithArguments(
+    const PythonObject& from, const std::string& function,
+    Argument* args, size_t size, unsigned long long convertStart = 0);
+PythonObject callWithArguments(
+    const PythonObject& from, const Name& method,
+    Argument* args, size_t size, unsigned long long convertStart = 0);
 
 // Positional argument
-template<typename Head, typename... Tail>
-void appendArgs(
-    PositionalArgs& pargs,
-    KeywordArgs& kwargs,
-    Head head,
-    Tail... tail)
-{
-    pargs.push_back(construct(head));    
-    appendArgs(pargs, kwargs, tail...);
-}
+template<typename T>
+struct ArgumentPacker {
+    template<typename U>
+    static void pack(Argument& arg, U&& value)
+    {
+        arg.keyword = nullptr;
+        arg.name = nullptr;
+        arg.value = construct(std::forward<U>(value));
+    }
+};
 
 // Keyword argument from string
-template<typename Head, typename... Tail>
-void appendArgs(
-    PositionalArgs& pargs,
-    KeywordArgs& kwargs,
-    std::pair<std::string, Head> head,
-    Tail... tail)
-{
-    kwargs.emplace_back(head.first, construct(head.second));
-    appendArgs(pargs, kwargs, tail...);
-}
+template<typename T>
+struct ArgumentPacker<std::pair<std::string, T>> {
+    template<typename U>
+    static void pack(Argument& arg, U&& kv)
+    {
+        arg.keyword = kv.first.c_str();
+        arg.name = nullptr;
+        arg.value = construct(std::forward<U>(kv).second);
+    }
+};
 
 // Keyword argument from const char*
-template<typename Head, typename... Tail>
-void appendArgs(
-    PositionalArgs& pargs,
-    KeywordArgs& kwargs,
-    std::pair<const char*, Head> head,
-    Tail... tail)
+template<typename T>
+struct ArgumentPacker<std::pair<const char*, T>> {
+    template<typename U>
+    static void pack(Argument& arg, U&& kv)
+    {
+        arg.keyword = kv.first;
+        arg.name = nullptr;
+        arg.value = construct(std::forward<U>(kv).second);
+    }
+};
+
+// Keyword argument from an interned Name
+template<typename T>
+struct ArgumentPacker<std::pair<Name, T>> {
+    template<typename U>
+    static void pack(Argument& arg, U&& kv)
+    {
+        arg.keyword = kv.first.c_str();
+        arg.name = internedName(kv.first);
+        arg.value = construct(std::forward<U>(kv).second);
+    }
+};
+
+template<typename... Args>
+void packArguments(Argument* args, Args&&... values)
 {
-    kwargs.emplace_back(std::string(head.first), construct(head.second));
-    appendArgs(pargs, kwargs, tail...);
+    int expand[] = {0, (ArgumentPacker<typename std::decay<Args>::type>::pack(
+        *args++, std::forward<Args>(values)), 0)...};
+    (void)expand;
+    (void)args;
 }
 
+// Arguments live on the stack of the calling function
+template<size_t N>
+using ArgumentArray = std::array<Argument, N>;
+
 } // end namespace detail
 
 template<typename... Args>
-PythonObject call(const std::string& f, Args... args)
+PythonObject call(const std::string& f, Args&&... args)
 {
-    auto pargs = std::vector<PythonObject>();
-    auto kwargs = std::vector<std::pair<std::string, PythonObject>>();
-    detail::appendArgs(pargs, kwargs, args...);
-    return callWithArgs(f, pargs, kwargs);
+    detail::AutoGil gil;
+    unsigned long long start = detail::metricsClock();
+    detail::ArgumentArray<sizeof...(Args)> arguments;
+    detail::packArguments(arguments.data(), std::forward<Args>(args)...);
+    return detail::callWithArguments(f, arguments.data(), arguments.size(), start);
 }
 
 template<typename... Args>
-PythonObject call(PythonObject from, const std::string& f, Args... args)
+PythonObject call(const PythonObject& from, const std::string& f, Args&&... args)
 {
-    auto pargs = std::vector<PythonObject>();
-    auto kwargs = std::vector<std::pair<std::string, PythonObject>>();
-    detail::appendArgs(pargs, kwargs, args...);
-    return callWithArgs(from, f, pargs, kwargs);
+    detail::AutoGil gil;
+    unsigned long long start = detail::metricsClock();
+    detail::ArgumentArray<sizeof...(Args)> arguments;
+    detail::packArguments(arguments.data(), std::forward<Args>(args)...);
+    return detail::callWithArguments(from, f, arguments.data(), arguments.size(), start);
 }
 
 template<typename... Args>
-PythonObject PythonObject::call(const std::string& f, Args... args)
+PythonObject call(const PythonObject& from, const Name& f, Args&&... args)
 {
-    return wrappy::call(*this, f, args...);
+    detail::AutoGil gil;
+    unsigned long long start = detail::metricsClock();
+    detail::ArgumentArray<sizeof...(Args)> arguments;
+    detail::packArguments(arguments.data(), std::forward<Args>(args)...);
+    return detail::callWithArguments(from, f, arguments.data(), arguments.size(), start);
 }
 
-} // end namespace wrappy
+template<typename... Args>
+PythonObject PythonObject::call(const std::string& f, Args&&... args)
+{
+    return wrappy::call(*this, f, std::forward<Args>(args)...);
+}
 
+template<typename... Args>
+PythonObject PythonObject::call(const Name& f, Args&&... args)
+{
+    return wrappy::call(*this, f, std::forward<Args>(args)...);
+}
+
+} // end namespace wrappy
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+
+// Implementation of construct(F callable)
+namespace wrappy {
+namespace detail {
+
+// Type-erased callable, owned by the python function object wrapping it
+class CallbackBase {
+public:
+    CallbackBase(size_t arity, const std::type_info& type) : arity(arity), type(type) { }
+    virtual ~CallbackBase() { }
+
+    // Called with the GIL held and borrowed references to exactly `arity`
+    // positional arguments. Returns a new reference.
+    virtual PyObject* call(PyObject* const* args) = 0;
+
+    const size_t arity;
+
+    // Of the callable, which names the call site in metrics, memory and
+    // traces. The name is built on first use, with the GIL held.
+    const std::type_info& type;
+    std::string site;
+};
+
+// Creates the python function object, which takes ownership of callback
+PythonObject newCallback(std::unique_ptr<CallbackBase> callback);
+
+template<typename R>
+struct CallbackResult {
+    template<typename F, typename... Args>
+    static PyObject* invoke(F& f, Args&&... args) {
+        return construct(f(std::forward<Args>(args)...)).release();
+    }
+};
+
+template<>
+struct CallbackResult<void> {
+    template<typename F, typename... Args>
+    static PyObject* invoke(F& f, Args&&... args) {
+        f(std::forward<Args>(args)...);
+        return PythonObject(None).release();
+    }
+};
+
+template<typename F, typename R, typename Arguments>
+class Callback;
+
+template<typename F, typename R, typename... Args>
+class Callback<F, R, std::tuple<Args...>> : public CallbackBase {
+public:
+    explicit Callback(F f)
+      : CallbackBase(sizeof...(Args), typeid(F))
+      , f_(std::move(f))
+    { }
+
+    PyObject* call(PyObject* const* args) override
+    {
+        return call(args, typename MakeIndexSequence<sizeof...(Args)>::type());
+    }
+
+private:
+    template<size_t... Is>
+    PyObject* call(PyObject* const* args, IndexSequence<Is...>)
+    {
+        (void)args;
+        return CallbackResult<R>::invoke(f_,
+            FromPython<typename std::decay<Args>::type>::convert(args[Is])...);
+    }
+
+    F f_;
+};
+
+} // end namespace detail
+
+template<typename F, typename>
+PythonObject construct(F callable)
+{
+    typedef detail::CallableTraits<F> Traits;
+    typedef detail::Callback<F, typename Traits::Result, typename Traits::Arguments> Callback;
+
+    std::unique_ptr<detail::CallbackBase> callback(new Callback(std::move(callable)));
+    return detail::newCallback(std::move(callback));
+}
+
+} // end namespace wrappy
@@ -0,0 +1,144 @@
+#pragma once
+
+// Implementation of construct() for standard containers
+namespace wrappy {
+namespace detail {
+
+template<size_t... Is>
+struct IndexSequence {};
+
+template<size_t N, size_t... Is>
+struct MakeIndexSequence : MakeIndexSequence<N-1, N-1, Is...> {};
+
+template<size_t... Is>
+struct MakeIndexSequence<0, Is...> {
+    typedef IndexSequence<Is...> type;
+};
+
+// These throw a WrappyError if python runs out of memory, or if an item
+// is a null object. The setters steal the reference held by item.
+PythonObject newList(size_t size);
+PythonObject newTuple(size_t size);
+PythonObject newDict();
+PythonObject newSet();
+void setListItem(const PythonObject& list, size_t index, PythonObject item);
+void setTupleItem(const PythonObject& tuple, size_t index, PythonObject item);
+void setDictItem(const PythonObject& dict, const PythonObject& key, const PythonObject& value);
+void addSetItem(const PythonObject& set, const PythonObject& item);
+
+template<typename Sequence>
+PythonObject constructList(const Sequence& sequence)
+{
+    AutoGil gil;
+    PythonObject list = newList(sequence.size());
+    size_t index = 0;
+    for (const auto& item : sequence) {
+        setListItem(list, index++, construct(item));
+    }
+    return list;
+}
+
+template<typename Map>
+PythonObject constructDict(const Map& map)
+{
+    AutoGil gil;
+    PythonObject dict = newDict();
+    for (const auto& kv : map) {
+        setDictItem(dict, construct(kv.first), construct(kv.second));
+    }
+    return dict;
+}
+
+template<typename Set>
+PythonObject constructSet(const Set& set)
+{
+    AutoGil gil;
+    PythonObject res = newSet();
+    for (const auto& item : set) {
+        addSetItem(res, construct(item));
+    }
+    return res;
+}
+
+template<typename Tuple, size_t... Is>
+PythonObject constructTuple(const Tuple& tuple, IndexSequence<Is...>)
+{
+    AutoGil gil;
+    PythonObject res = newTuple(sizeof...(Is));
+    int expand[] = {0, (setTupleItem(res, Is, construct(std::get<Is>(tuple))), 0)...};
+    (void)expand;
+    return res;
+}
+
+} // end namespace detail
+
+template<typename T, typename Alloc>
+PythonObject construct(const std::vector<T, Alloc>& v)
+{
+    return detail::constructList(v);
+}
+
+template<typename T, typename Alloc>
+PythonObject construct(const std::list<T, Alloc>& l)
+{
+    return detail::constructList(l);
+}
+
+template<typename T, typename Alloc>
+PythonObject construct(const std::deque<T, Alloc>& d)
+{
+    return detail::constructList(d);
+}
+
+template<typename T, size_t N>
+PythonObject construct(const std::array<T, N>& a)
+{
+    return detail::constructList(a);
+}
+
+template<typename K, typename V, typename Compare, typename Alloc>
+PythonObject construct(const std::map<K, V, Compare, Alloc>& m)
+{
+    return detail::constructDict(m);
+}
+
+template<typename K, typename V, typename Hash, typename Eq, typename Alloc>
+PythonObject construct(const std::unordered_map<K, V, Hash, Eq, Alloc>& m)
+{
+    return detail::constructDict(m);
+}
+
+template<typename T, typename Compare, typename Alloc>
+PythonObject construct(const std::set<T, Compare, Alloc>& s)
+{
+    return detail::constructSet(s);
+}
+
+template<typename T, typename Hash, typename Eq, typename Alloc>
+PythonObject construct(const std::unordered_set<T, Hash, Eq, Alloc>& s)
+{
+    return detail::constructSet(s);
+}
+
+template<typename A, typename B>
+PythonObject construct(const std::pair<A, B>& p)
+{
+    return detail::constructTuple(p, detail::IndexSequence<0, 1>());
+}
+
+template<typename... Ts>
+PythonObject construct(const std::tuple<Ts...>& t)
+{
+    return detail::constructTuple(t,
+        typename detail::MakeIndexSequence<sizeof...(Ts)>::type());
+}
+
+#if __cplusplus >= 201703L
+template<typename T>
+PythonObject construct(const std::optional<T>& o)
+{
+    return o ? construct(*o) : None;
+}
+#endif
+
+} // end namespace wrappy
@@ -0,0 +1,229 @@
+#pragma once
+
+#include <type_traits>
+
+// Conversion of python objects to C++ values
+namespace wrappy {
+namespace detail {
+
+// These throw a WrappyError if obj doesn't have the requested type.
+// All of them take a borrowed reference.
+long long toLongLong(PyObject* obj);
+unsigned long long toUnsignedLongLong(PyObject* obj); // up to 2**64-1
+double toDouble(PyObject* obj);
+bool toBool(PyObject* obj);
+std::string toString(PyObject* obj);
+
+// Sequence access for conversion to containers. Returns an object that
+// keeps `items` valid, and throws if obj is not a sequence.
+PythonObject sequenceItems(PyObject* obj, PyObject**& items, size_t& size);
+
+// Returns obj itself if it is a dict, otherwise dict(obj)
+PythonObject asDict(PyObject* obj);
+size_t dictSize(PyObject* dict);
+// Iterates over borrowed references to the items of a dict
+bool dictNext(PyObject* dict, ptrdiff_t& pos, PyObject*& key, PyObject*& value);
+
+template<typename T>
+struct FromPython;
+
+template<>
+struct FromPython<PythonObject> {
+    static PythonObject convert(PyObject* obj) {
+        return PythonObject(PythonObject::borrowed {}, obj);
+    }
+};
+
+template<>
+struct FromPython<void> {
+    static void convert(PyObject*) {}
+};
+
+template<>
+struct FromPython<bool> {
+    static bool convert(PyObject* obj) { return toBool(obj); }
+};
+
+template<typename T>
+T narrowInteger(long long value)
+{
+    if (static_cast<long long>(static_cast<T>(value)) != value
+        || (std::is_unsigned<T>::value && value < 0)) {
+        throw WrappyError("Wrappy: Integer out of range.");
+    }
+    return static_cast<T>(value);
+}
+
+template<typename T>
+T narrowUnsigned(unsigned long long value)
+{
+    if (static_cast<unsigned long long>(static_cast<T>(value)) != value) {
+        throw WrappyError("Wrappy: Integer out of range.");
+    }
+    return static_cast<T>(value);
+}
+
+template<>
+struct FromPython<int> {
+    static int convert(PyObject* obj) { return narrowInteger<int>(toLongLong(obj)); }
+};
+
+template<>
+struct FromPython<unsigned int> {
+    static unsigned int convert(PyObject* obj) { return narrowInteger<unsigned int>(toLongLong(obj)); }
+};
+
+template<>
+struct FromPython<long> {
+    static long convert(PyObject* obj) { return narrowInteger<long>(toLongLong(obj)); }
+};
+
+template<>
+struct FromPython<unsigned long> {
+    static unsigned long convert(PyObject* obj) { return narrowUnsigned<unsigned long>(toUnsignedLongLong(obj)); }
+};
+
+template<>
+struct FromPython<unsigned long long> {
+    static unsigned long long convert(PyObject* obj) { return toUnsignedLongLong(obj); }
+};
+
+template<>
+struct FromPython<long long> {
+    static long long convert(PyObject* obj) { return toLongLong(obj); }
+};
+
+template<>
+struct FromPython<float> {
+    static float convert(PyObject* obj) { return static_cast<float>(toDouble(obj)); }
+};
+
+template<>
+struct FromPython<double> {
+    static double convert(PyObject* obj) { return toDouble(obj); }
+};
+
+template<>
+struct FromPython<std::string> {
+    static std::string convert(PyObject* obj) { return toString(obj); }
+};
+
+template<typename T, typename Alloc>
+struct FromPython<std::vector<T, Alloc>> {
+    static std::vector<T, Alloc> convert(PyObject* obj) {
+        PyObject** items;
+        size_t size;
+        PythonObject sequence = sequenceItems(obj, items, size);
+
+        std::vector<T, Alloc> res;
+        res.reserve(size);
+        for (size_t i = 0; i < size; ++i) {
+            res.push_back(FromPython<T>::convert(items[i]));
+        }
+        return res;
+    }
+};
+
+template<typename Map>
+void reserve(Map&, size_t)
+{ }
+
+template<typename K, typename V, typename Hash, typename Eq, typename Alloc>
+void reserve(std::unordered_map<K, V, Hash, Eq, Alloc>& map, size_t size)
+{
+    map.reserve(size);
+}
+
+template<typename Map>
+Map convertDict(PyObject* obj)
+{
+    typedef typename Map::key_type K;
+    typedef typename Map::mapped_type V;
+
+    PythonObject dict = asDict(obj);
+    Map res;
+    reserve(res, dictSize(dict.get()));
+    ptrdiff_t pos = 0;
+    PyObject *key, *value;
+    while (dictNext(dict.get(), pos, key, value)) {
+        res.emplace(FromPython<K>::convert(key), FromPython<V>::convert(value));
+    }
+    return res;
+}
+
+template<typename K, typename V, typename Compare, typename Alloc>
+struct FromPython<std::map<K, V, Compare, Alloc>> {
+    static std::map<K, V, Compare, Alloc> convert(PyObject* obj) {
+        return convertDict<std::map<K, V, Compare, Alloc>>(obj);
+    }
+};
+
+template<typename K, typename V, typename Hash, typename Eq, typename Alloc>
+struct FromPython<std::unordered_map<K, V, Hash, Eq, Alloc>> {
+    static std::unordered_map<K, V, Hash, Eq, Alloc> convert(PyObject* obj) {
+        return convertDict<std::unordered_map<K, V, Hash, Eq, Alloc>>(obj);
+    }
+};
+
+// Checks that obj is a sequence of exactly `size` items
+PythonObject fixedSizeItems(PyObject* obj, size_t size, PyObject**& items);
+
+template<typename... Ts>
+struct FromPython<std::tuple<Ts...>> {
+    template<size_t... Is>
+    static std::tuple<Ts...> convert(PyObject** items, IndexSequence<Is...>) {
+        return std::tuple<Ts...>(FromPython<Ts>::convert(items[Is])...);
+    }
+
+    static std::tuple<Ts...> convert(PyObject* obj) {
+        PyObject** items;
+        PythonObject sequence = fixedSizeItems(obj, sizeof...(Ts), items);
+        return convert(items, typename MakeIndexSequence<sizeof...(Ts)>::type());
+    }
+};
+
+template<typename A, typename B>
+struct FromPython<std::pair<A, B>> {
+    static std::pair<A, B> convert(PyObject* obj) {
+        PyObject** items;
+        PythonObject sequence = fixedSizeItems(obj, 2, items);
+        return std::pair<A, B>(
+            FromPython<A>::convert(items[0]),
+            FromPython<B>::convert(items[1]));
+    }
+};
+
+// Views keep the buffer of the object locked, not the object itself
+template<typename T>
+struct FromPython<ArrayView<T>> {
+    static ArrayView<T> convert(PyObject* obj) {
+        return ArrayView<T>(PythonObject(PythonObject::borrowed {}, obj));
+    }
+};
+
+template<typename T>
+struct FromPython<NDArrayView<T>> {
+    static NDArrayView<T> convert(PyObject* obj) {
+        return NDArrayView<T>(PythonObject(PythonObject::borrowed {}, obj));
+    }
+};
+
+} // end namespace detail
+
+template<typename T>
+T PythonObject::as() const
+{
+    if (!obj_) {
+        throw WrappyError("Wrappy: Converting a null object.");
+    }
+    detail::AutoGil gil;
+    return detail::FromPython<T>::convert(obj_);
+}
+
+template<typename T>
+T fromPython(const PythonObject& obj)
+{
+    return obj.as<T>();
+}
+
+} // end namespace wrappy
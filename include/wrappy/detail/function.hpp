@@ -0,0 +1,112 @@
+#pragma once
+
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Implementation of Function<>
+namespace wrappy {
+namespace detail {
+
+// Makes sure that tuple is a tuple of the given size which is not
+// referenced from anywhere else, so its items can be overwritten.
+void prepareArgumentTuple(PythonObject& tuple, size_t size);
+
+// Stores value at tuple[index], dropping the previous item
+void setArgument(PythonObject& tuple, size_t index, PythonObject value);
+
+// convertStart is the metricsClock() before the arguments were converted
+PythonObject callWithArgumentTuple(
+    const PythonObject& function, PythonObject& tuple, unsigned long long convertStart);
+
+// Same, but converts the result with convert(result, out) while the call
+// is still timed, so that the conversion counts as unmarshalling
+typedef void (*ResultConverter)(PyObject* result, void* out);
+void callWithArgumentTuple(
+    const PythonObject& function, PythonObject& tuple, unsigned long long convertStart,
+    ResultConverter convert, void* out);
+
+// The converted result of a Function call, R doesn't have to be default
+// constructible
+template<typename R>
+class FunctionResult {
+public:
+    FunctionResult() : set_(false) { }
+    ~FunctionResult()
+    {
+        if (set_) {
+            get().~R();
+        }
+    }
+
+    FunctionResult(const FunctionResult&) = delete;
+    FunctionResult& operator=(const FunctionResult&) = delete;
+
+    static void convert(PyObject* result, void* out)
+    {
+        auto self = static_cast<FunctionResult*>(out);
+        new (&self->storage_) R(FromPython<R>::convert(result));
+        self->set_ = true;
+    }
+
+    R take() { return std::move(get()); }
+
+private:
+    R& get() { return *reinterpret_cast<R*>(&storage_); }
+
+    typename std::aligned_storage<sizeof(R), alignof(R)>::type storage_;
+    bool set_;
+};
+
+template<>
+class FunctionResult<void> {
+public:
+    static void convert(PyObject*, void*) { }
+    void take() { }
+};
+
+} // end namespace detail
+
+template<typename R, typename... Args>
+Function<R(Args...)>::Function(const std::string& name)
+  : function_(load(name))
+{ }
+
+template<typename R, typename... Args>
+Function<R(Args...)>::Function(PythonObject callable)
+  : function_(std::move(callable))
+{ }
+
+template<typename R, typename... Args>
+R Function<R(Args...)>::operator()(const Args&... args) const
+{
+    if (!function_) {
+        throw WrappyError("Wrappy: Calling an empty Function.");
+    }
+
+    detail::AutoGil gil;
+    unsigned long long start = detail::metricsClock();
+
+    // Take the tuple out while it is in use, so a concurrent call from
+    // another thread can't overwrite the arguments
+    PythonObject tuple = std::move(args_);
+    detail::prepareArgumentTuple(tuple, sizeof...(Args));
+
+    size_t index = 0;
+    int expand[] = {0, (detail::setArgument(tuple, index++, construct(args)), 0)...};
+    (void)expand;
+    (void)index;
+
+    detail::FunctionResult<R> result;
+    detail::callWithArgumentTuple(function_, tuple, start, &detail::FunctionResult<R>::convert, &result);
+    args_ = std::move(tuple);
+    return result.take();
+}
+
+template<typename R, typename... Args>
+const PythonObject& Function<R(Args...)>::object() const
+{
+    return function_;
+}
+
+} // end namespace wrappy
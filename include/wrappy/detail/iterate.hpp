@@ -0,0 +1,132 @@
+#pragma once
+
+#include <iterator>
+
+// Implementation of range() and chunks()
+namespace wrappy {
+
+namespace detail {
+
+// Input iterator over a chunked sequence, which is refilled by
+// Source::fill() whenever the current chunk is used up. An iterator
+// without source is the end.
+template<typename Source>
+class ChunkedIterator {
+public:
+    typedef std::input_iterator_tag iterator_category;
+    typedef typename Source::value_type value_type;
+    typedef typename Source::reference reference;
+    typedef const value_type* pointer;
+    typedef ptrdiff_t difference_type;
+
+    ChunkedIterator() : source_(nullptr) { }
+
+    explicit ChunkedIterator(Source* source)
+      : source_(source)
+    {
+        if (!source_->fill()) {
+            source_ = nullptr;
+        }
+    }
+
+    reference operator*() const { return source_->current(); }
+
+    ChunkedIterator& operator++()
+    {
+        if (!source_->advance() && !source_->fill()) {
+            source_ = nullptr;
+        }
+        return *this;
+    }
+
+    bool operator==(const ChunkedIterator& other) const { return source_ == other.source_; }
+    bool operator!=(const ChunkedIterator& other) const { return source_ != other.source_; }
+
+private:
+    Source* source_;
+};
+
+} // end namespace detail
+
+template<typename T>
+class Range {
+public:
+    typedef T value_type;
+    typedef typename std::vector<T>::const_reference reference;
+    typedef detail::ChunkedIterator<Range> iterator;
+
+    Range(const PythonObject& iterable, size_t chunk)
+      : source_(iterable)
+      , chunk_(chunk ? chunk : 1)
+      , pos_(0)
+    { }
+
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+private:
+    friend iterator;
+
+    reference current() const { return items_[pos_]; }
+    bool advance() { return ++pos_ < items_.size(); }
+
+    bool fill()
+    {
+        items_.clear();
+        pos_ = 0;
+
+        detail::AutoGil gil;
+        while (items_.size() < chunk_) {
+            PyObject* item = source_.next();
+            if (!item) {
+                break;
+            }
+            items_.push_back(detail::FromPython<T>::convert(item));
+        }
+        return !items_.empty();
+    }
+
+    detail::ItemSource source_;
+    std::vector<T> items_;
+    size_t chunk_;
+    size_t pos_;
+};
+
+template<typename T>
+Range<T> range(const PythonObject& iterable, size_t chunk)
+{
+    return Range<T>(iterable, chunk);
+}
+
+class Chunks {
+public:
+    typedef std::vector<PythonObject> value_type;
+    typedef const value_type& reference;
+    typedef detail::ChunkedIterator<Chunks> iterator;
+
+    Chunks(const PythonObject& iterable, size_t size)
+      : source_(iterable)
+      , size_(size ? size : 1)
+    { }
+
+    iterator begin() { return iterator(this); }
+    iterator end() { return iterator(); }
+
+private:
+    friend iterator;
+
+    reference current() const { return items_; }
+    bool advance() { return false; }
+    bool fill() { return source_.fill(items_, size_); }
+
+    detail::ItemSource source_;
+    value_type items_;
+    size_t size_;
+};
+
+inline Chunks chunks(const PythonObject& iterable, size_t size)
+{
+    return Chunks(iterable, size);
+}
+
+} // end namespace wrappy
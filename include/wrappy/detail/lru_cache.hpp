@@ -0,0 +1,106 @@
+#pragma once
+
+#include <list>
+#include <utility>
+#include <unordered_map>
+
+namespace wrappy {
+namespace detail {
+
+// A map holding at most `capacity` entries. Inserting into a full cache
+// evicts the least recently used entry. A capacity of 0 disables the cache,
+// i.e. insert() becomes a no-op.
+template<typename Key, typename Value, typename Hash = std::hash<Key>>
+class LruCache {
+public:
+    explicit LruCache(size_t capacity)
+      : capacity_(capacity)
+    { }
+
+    // Returns nullptr if the key is not in the cache. A successful lookup
+    // marks the entry as most recently used.
+    Value* find(const Key& key)
+    {
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return nullptr;
+        }
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return &it->second->second;
+    }
+
+    void insert(const Key& key, Value value)
+    {
+        if (capacity_ == 0) {
+            return;
+        }
+
+        auto it = index_.find(key);
+        if (it != index_.end()) {
+            it->second->second = std::move(value);
+            entries_.splice(entries_.begin(), entries_, it->second);
+            return;
+        }
+
+        entries_.emplace_front(key, std::move(value));
+        index_.emplace(key, entries_.begin());
+        shrink();
+    }
+
+    bool erase(const Key& key)
+    {
+        auto it = index_.find(key);
+        if (it == index_.end()) {
+            return false;
+        }
+        entries_.erase(it->second);
+        index_.erase(it);
+        return true;
+    }
+
+    // Erase all entries for which pred(key, value) returns true.
+    template<typename Predicate>
+    void eraseIf(Predicate pred)
+    {
+        for (auto it = entries_.begin(); it != entries_.end(); ) {
+            if (pred(it->first, it->second)) {
+                index_.erase(it->first);
+                it = entries_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    void clear()
+    {
+        index_.clear();
+        entries_.clear();
+    }
+
+    size_t size() const { return index_.size(); }
+    size_t capacity() const { return capacity_; }
+
+    void setCapacity(size_t capacity)
+    {
+        capacity_ = capacity;
+        shrink();
+    }
+
+private:
+    void shrink()
+    {
+        while (index_.size() > capacity_) {
+            index_.erase(entries_.back().first);
+            entries_.pop_back();
+        }
+    }
+
+    typedef std::list<std::pair<Key, Value>> List;
+    List entries_; // most recently used first
+    std::unordered_map<Key, typename List::iterator, Hash> index_;
+    size_t capacity_;
+};
+
+} // end namespace detail
+} // end namespace wrappy
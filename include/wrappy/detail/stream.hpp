@@ -0,0 +1,127 @@
+#pragma once
+
+#include <iterator>
+#include <memory>
+#include <utility>
+
+// Implementation of constructIter()
+namespace wrappy {
+namespace detail {
+
+// Produces the elements of a python iterator created by constructIter()
+class StreamBase {
+public:
+    virtual ~StreamBase() { }
+
+    // Called with the GIL held. Returns a new reference to the next
+    // element, or nullptr at the end.
+    virtual PyObject* next() = 0;
+};
+
+// Creates the python iterator, which takes ownership of stream
+PythonObject newStream(std::unique_ptr<StreamBase> stream, size_t chunk);
+
+template<typename Iterator>
+class IteratorStream : public StreamBase {
+public:
+    IteratorStream(Iterator begin, Iterator end)
+      : it_(std::move(begin))
+      , end_(std::move(end))
+    { }
+
+    PyObject* next() override
+    {
+        if (it_ == end_) {
+            return nullptr;
+        }
+        PyObject* res = construct(*it_).release();
+        ++it_;
+        return res;
+    }
+
+private:
+    Iterator it_;
+    Iterator end_;
+};
+
+// Base class of RangeStream, so that the range is constructed first
+template<typename Range>
+struct RangeHolder {
+    explicit RangeHolder(Range&& range) : range(std::move(range)) { }
+    explicit RangeHolder(const Range& range) : range(range) { }
+
+    Range range;
+};
+
+template<typename Range>
+class RangeStream
+  : private RangeHolder<Range>
+  , public IteratorStream<decltype(std::begin(std::declval<Range&>()))> {
+public:
+    template<typename R>
+    explicit RangeStream(R&& range)
+      : RangeHolder<Range>(std::forward<R>(range))
+      , IteratorStream<decltype(std::begin(std::declval<Range&>()))>(
+            std::begin(this->range), std::end(this->range))
+    { }
+};
+
+template<typename F, typename Element>
+class GeneratorStream : public StreamBase {
+public:
+    explicit GeneratorStream(F f) : f_(std::move(f)) { }
+
+    PyObject* next() override
+    {
+        return next(f_);
+    }
+
+private:
+    template<typename G>
+    auto next(G& f) -> decltype(f(std::declval<Element&>()), (PyObject*)nullptr)
+    {
+        Element element;
+        return f(element) ? construct(element).release() : nullptr;
+    }
+
+#if __cplusplus >= 201703L
+    template<typename G>
+    auto next(G& f) -> decltype(f().has_value(), (PyObject*)nullptr)
+    {
+        auto element = f();
+        return element ? construct(*element).release() : nullptr;
+    }
+#endif
+
+    F f_;
+};
+
+} // end namespace detail
+
+template<typename Iterator>
+PythonObject constructIter(Iterator begin, Iterator end, size_t chunk)
+{
+    std::unique_ptr<detail::StreamBase> stream(
+        new detail::IteratorStream<Iterator>(std::move(begin), std::move(end)));
+    return detail::newStream(std::move(stream), chunk);
+}
+
+template<typename Range, typename>
+PythonObject constructIter(Range&& range, size_t chunk)
+{
+    typedef typename std::decay<Range>::type Stored;
+    std::unique_ptr<detail::StreamBase> stream(
+        new detail::RangeStream<Stored>(std::forward<Range>(range)));
+    return detail::newStream(std::move(stream), chunk);
+}
+
+template<typename F, typename>
+PythonObject constructIter(F generator, size_t chunk)
+{
+    typedef typename detail::GeneratorTraits<F>::Element Element;
+    std::unique_ptr<detail::StreamBase> stream(
+        new detail::GeneratorStream<F, Element>(std::move(generator)));
+    return detail::newStream(std::move(stream), chunk);
+}
+
+} // end namespace wrappy
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+
+namespace wrappy {
+namespace detail {
+
+// A queue of tasks for a single consumer thread, which takes all queued
+// tasks at once so it can run them in one batch. With a non-zero capacity,
+// push() blocks while that many tasks are queued.
+class TaskQueue {
+public:
+    typedef std::function<void()> Task;
+    typedef std::deque<Task> Batch;
+
+    explicit TaskQueue(size_t capacity = 0)
+      : capacity_(capacity)
+      , closed_(false)
+    { }
+
+    // Returns false if the queue is closed
+    bool push(Task task)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notFull_.wait(lock, [this]() {
+            return closed_ || capacity_ == 0 || tasks_.size() < capacity_;
+        });
+        if (closed_) {
+            return false;
+        }
+        tasks_.push_back(std::move(task));
+        notEmpty_.notify_one();
+        return true;
+    }
+
+    // Waits for tasks and moves all of them into batch. Returns false once
+    // the queue is closed and empty.
+    bool pop(Batch& batch)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        notEmpty_.wait(lock, [this]() { return closed_ || !tasks_.empty(); });
+        if (tasks_.empty()) {
+            return false;
+        }
+        batch.swap(tasks_);
+        notFull_.notify_all();
+        return true;
+    }
+
+    // Rejects further tasks, the queued ones are still handed out
+    void close()
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        closed_ = true;
+        notEmpty_.notify_all();
+        notFull_.notify_all();
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return tasks_.size();
+    }
+
+    size_t capacity() const { return capacity_; }
+
+private:
+    mutable std::mutex mutex_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    Batch tasks_;
+    size_t capacity_;
+    bool closed_;
+};
+
+} // end namespace detail
+} // end namespace wrappy
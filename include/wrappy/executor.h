@@ -0,0 +1,93 @@
+#pragma once
+
+#include <wrappy/wrappy.h>
+
+#include <future>
+#include <functional>
+#include <memory>
+#include <type_traits>
+
+namespace wrappy {
+
+namespace detail {
+
+template<typename R>
+struct AsyncResult {
+    static R convert(const PythonObject& obj) { return obj.as<R>(); }
+};
+
+template<>
+struct AsyncResult<void> {
+    static void convert(const PythonObject&) { }
+};
+
+} // end namespace detail
+
+// A thread that runs python code on behalf of other threads, so they can
+// continue with other work in the meantime:
+//
+//     std::future<PythonObject> sent = wrappy::asyncCall("mailer.send", message);
+//     ... // do something else
+//     sent.get(); // rethrows a WrappyError if the call failed
+//
+// All tasks queued while the executor was busy are run as one batch under
+// a single acquisition of the GIL. With a non-zero capacity, submitting
+// blocks while that many tasks are waiting. Requires enableThreads().
+class Executor {
+public:
+    explicit Executor(size_t capacity = 0);
+    ~Executor(); // runs all queued tasks
+
+    Executor(const Executor&) = delete;
+    Executor& operator=(const Executor&) = delete;
+
+    // Runs f() on the executor thread, with the GIL held
+    template<typename F>
+    auto submit(F f) -> std::future<decltype(f())>;
+
+    // call(name, args...) on the executor thread, with the result converted
+    // to R there. The arguments are copied and converted on the executor,
+    // so the calling thread doesn't need the GIL for them.
+    template<typename R = PythonObject, typename... Args>
+    std::future<R> call(const std::string& function, Args... args);
+
+    size_t queued() const;    // tasks waiting for the next batch
+    size_t capacity() const;  // 0 if unbounded
+    unsigned long long batches() const; // batches run so far
+
+private:
+    void post(std::function<void()> task);
+    void main();
+
+    struct Impl;
+    std::unique_ptr<Impl> impl_;
+};
+
+// The executor used by asyncCall(), started on first use
+Executor& defaultExecutor();
+
+template<typename R = PythonObject, typename... Args>
+std::future<R> asyncCall(const std::string& function, Args&&... args)
+{
+    return defaultExecutor().call<R>(function, std::forward<Args>(args)...);
+}
+
+template<typename F>
+auto Executor::submit(F f) -> std::future<decltype(f())>
+{
+    typedef decltype(f()) R;
+    auto task = std::make_shared<std::packaged_task<R()>>(std::move(f));
+    std::future<R> result = task->get_future();
+    post([task]() { (*task)(); });
+    return result;
+}
+
+template<typename R, typename... Args>
+std::future<R> Executor::call(const std::string& function, Args... args)
+{
+    return submit(std::bind([function](const Args&... args) {
+        return detail::AsyncResult<R>::convert(wrappy::call(function, args...));
+    }, std::move(args)...));
+}
+
+} // end namespace wrappy
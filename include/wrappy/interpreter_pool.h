@@ -0,0 +1,215 @@
+#pragma once
+
+#include <wrappy/wrappy.h>
+
+#include <array>
+#include <future>
+#include <functional>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+namespace wrappy {
+
+namespace detail {
+
+// The module and resolution caches of one interpreter. A thread that
+// enters a context is assumed to hold the GIL of the corresponding
+// sub-interpreter, so AutoGil does nothing until the context is left.
+struct InterpreterContext;
+
+InterpreterContext* createInterpreterContext();
+void destroyInterpreterContext(InterpreterContext* context);
+// Returns the previously entered context, nullptr for the main interpreter
+InterpreterContext* enterInterpreterContext(InterpreterContext* context);
+
+// Whether a T holds python objects, directly or in the elements of a
+// pair, tuple or container. Those can't be bound to a task of another
+// interpreter.
+template<typename... Ts>
+struct HoldsPythonObject : std::false_type {};
+
+template<typename T, typename... Ts>
+struct HoldsPythonObject<T, Ts...> : std::integral_constant<bool,
+    HoldsPythonObject<T>::value || HoldsPythonObject<Ts...>::value> {};
+
+template<typename T>
+struct HoldsPythonObject<T> : std::is_same<T, PythonObject> {};
+
+template<template<typename...> class C, typename... Ts>
+struct HoldsPythonObject<C<Ts...>> : HoldsPythonObject<Ts...> {};
+
+template<typename T, size_t N>
+struct HoldsPythonObject<std::array<T, N>> : HoldsPythonObject<T> {};
+
+// Runs f() on a worker. A PythonError holds objects of the worker's
+// interpreter, so it is turned into a WrappyError with the formatted
+// message before it can leave.
+template<typename F, typename R>
+struct IsolatedTask {
+    R operator()()
+    {
+        try {
+            return f();
+        } catch (const PythonError& e) {
+            throw WrappyError(e.what());
+        }
+    }
+
+    F f;
+};
+
+} // end namespace detail
+
+// A pool of python sub-interpreters, each with its own modules, caches and
+// worker thread. Work submitted to the pool runs on the worker of one
+// interpreter, and every call returns a std::future for the result:
+//
+//     wrappy::enableThreads();
+//     wrappy::InterpreterPool pool(4);
+//     auto root = pool.call<double>("math.sqrt", 16.0);
+//     double two = pool.callOn<double>(1, "math.sqrt", 4.0).get();
+//
+// Python objects must never cross interpreters. Results that are python
+// objects are returned as InterpreterPool::Object, which remembers the
+// owning interpreter; calls on it are routed there, and passing it as an
+// argument to another interpreter fails with a WrappyError.
+//
+// With python >= 3.12 every sub-interpreter has its own GIL, so pure python
+// code scales across cores. Older versions share one GIL between all
+// interpreters, and the pool only isolates the interpreters' state.
+//
+// Requires enableThreads(). Inside run(), use the regular wrappy API; it
+// operates on the worker's interpreter. Don't use GilAcquire/GilRelease
+// there, and don't keep PythonObjects beyond the end of the task.
+class InterpreterPool {
+public:
+    explicit InterpreterPool(size_t size);
+    ~InterpreterPool(); // finishes all queued work
+
+    InterpreterPool(const InterpreterPool&) = delete;
+    InterpreterPool& operator=(const InterpreterPool&) = delete;
+
+    size_t size() const;
+
+    // A python object owned by one interpreter of the pool. Copies share
+    // the object, the last copy hands the decref back to the owning worker.
+    // If the pool no longer exists, the reference is leaked.
+    class Object {
+    public:
+        Object() = default;
+
+        size_t interpreter() const { return interpreter_; }
+        explicit operator bool() const { return bool(object_); }
+
+        // Throws a WrappyError unless called inside a task running on
+        // the owning interpreter.
+        const PythonObject& get() const;
+
+    private:
+        friend class InterpreterPool;
+
+        std::shared_ptr<PythonObject> object_;
+        const InterpreterPool* pool_ = nullptr;
+        size_t interpreter_ = 0;
+    };
+
+    // Runs f() on the given interpreter, or on the one with the fewest
+    // queued tasks. f must not return a PythonObject, use wrap() instead.
+    template<typename F>
+    auto run(size_t interpreter, F f) -> std::future<decltype(f())>;
+    template<typename F>
+    auto run(F f) -> std::future<decltype(f())>;
+
+    // call() and load() on a pool interpreter. The result is converted with
+    // PythonObject::as<R>() on the worker; R can also be void or Object.
+    // Arguments are copied, and converted with construct() on the worker.
+    // They can't hold PythonObjects, pass an Object of the pool instead.
+    template<typename R, typename... Args>
+    std::future<R> call(const std::string& function, Args... args);
+    template<typename R, typename... Args>
+    std::future<R> callOn(size_t interpreter, const std::string& function, Args... args);
+    // Calls object.method(args...) on the interpreter owning the object
+    template<typename R, typename... Args>
+    std::future<R> call(const Object& object, const std::string& method, Args... args);
+
+    std::future<Object> load(size_t interpreter, const std::string& name);
+
+    // Wraps an object created inside run(). Must be called on a worker
+    // of this pool, the object belongs to the worker's interpreter.
+    Object wrap(PythonObject object) const;
+
+    // Same as wrappy::invalidateCache() on every interpreter of the pool
+    void invalidateCache();
+
+private:
+    class Worker;
+
+    template<typename R>
+    struct Result {};
+
+    void post(size_t interpreter, std::function<void()> task);
+    size_t leastLoaded() const;
+    size_t owner(const Object& object) const;
+    const PythonObject& unwrap(const Object& object) const;
+
+    template<typename T>
+    static const T& unwrap(const T& value) { return value; }
+    template<typename R>
+    R convert(PythonObject result, Result<R>) const { return result.as<R>(); }
+    void convert(PythonObject, Result<void>) const { }
+    Object convert(PythonObject result, Result<Object>) const { return wrap(std::move(result)); }
+
+    std::vector<std::shared_ptr<Worker>> workers_;
+};
+
+template<typename F>
+auto InterpreterPool::run(size_t interpreter, F f) -> std::future<decltype(f())>
+{
+    typedef decltype(f()) R;
+    static_assert(!std::is_same<typename std::decay<R>::type, PythonObject>::value,
+        "Wrappy: Python objects can't leave the interpreter, use wrap().");
+
+    auto task = std::make_shared<std::packaged_task<R()>>(
+        detail::IsolatedTask<F, R>{std::move(f)});
+    std::future<R> result = task->get_future();
+    post(interpreter, [task]() { (*task)(); });
+    return result;
+}
+
+template<typename F>
+auto InterpreterPool::run(F f) -> std::future<decltype(f())>
+{
+    return run(leastLoaded(), std::move(f));
+}
+
+template<typename R, typename... Args>
+std::future<R> InterpreterPool::call(const std::string& function, Args... args)
+{
+    return callOn<R>(leastLoaded(), function, std::move(args)...);
+}
+
+template<typename R, typename... Args>
+std::future<R> InterpreterPool::callOn(size_t interpreter,
+    const std::string& function, Args... args)
+{
+    // Bound arguments are destroyed on the worker
+    static_assert(!detail::HoldsPythonObject<Args...>::value,
+        "Wrappy: Python objects can't be passed to another interpreter, use an Object of the pool.");
+    return run(interpreter, std::bind([this, function](const Args&... args) {
+        return convert(wrappy::call(function, unwrap(args)...), Result<R>());
+    }, std::move(args)...));
+}
+
+template<typename R, typename... Args>
+std::future<R> InterpreterPool::call(const Object& object,
+    const std::string& method, Args... args)
+{
+    static_assert(!detail::HoldsPythonObject<Args...>::value,
+        "Wrappy: Python objects can't be passed to another interpreter, use an Object of the pool.");
+    return run(owner(object), std::bind([this, object, method](const Args&... args) {
+        return convert(wrappy::call(unwrap(object), method, unwrap(args)...), Result<R>());
+    }, std::move(args)...));
+}
+
+} // end namespace wrappy
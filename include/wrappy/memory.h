@@ -0,0 +1,113 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+// Memory accounting per call site: which python functions called through
+// wrappy allocated how much, and how much of that is still alive:
+//
+//     wrappy::memory::setEnabled(true);
+//     ... // run the workload
+//     std::cout << wrappy::memory::dumpText();
+//
+// While enabled, wrappy hooks the allocators of python's PYMEM_DOMAIN_MEM
+// and PYMEM_DOMAIN_OBJ (see PyMem_SetAllocator()), and attributes each block
+// to the innermost call in progress on the allocating thread. Call sites are
+// named like in wrappy::metrics. Allocations outside of any call, and the
+// raw domain, which python uses without holding the GIL, are not tracked.
+// Requires python 3.5 or later, and costs a hash table update per allocation.
+namespace wrappy {
+namespace memory {
+
+struct SiteMemory {
+    std::string name;
+    unsigned long long allocations;    // blocks allocated since the last reset
+    unsigned long long allocatedBytes;
+    unsigned long long liveBlocks;     // blocks not freed yet
+    unsigned long long liveBytes;
+    unsigned long long liveObjects;    // the live blocks from the object domain
+};
+
+// False if the python version has no allocator hooks
+bool supported();
+
+// Installs or removes the hooks. Throws a WrappyError if not supported.
+// Must not be called while sub-interpreters of an InterpreterPool run.
+void setEnabled(bool enabled);
+bool enabled();
+
+// All call sites with allocations or live blocks, most live bytes first
+std::vector<SiteMemory> snapshot();
+
+// Restarts counting the allocations. The live counts are kept, they still
+// describe the memory that is held.
+void reset();
+
+// Human readable table
+std::string dumpText();
+
+struct ArenaStats {
+    unsigned long long allocations;
+    unsigned long long allocatedBytes;
+    unsigned long long liveBlocks;
+    unsigned long long liveBytes;
+};
+
+// Scope for the short-lived allocations of one request on this thread.
+// Python objects are reference counted, so unlike a real arena their
+// memory can't be released in bulk while something might refer to it.
+// While memory tracking is enabled, stats() tells what the request
+// allocated and what survived. With collect, destroying the arena also
+// collects the garbage cycles the request left behind; a full collection
+// usually costs more than a request, so it is off by default.
+class Arena {
+public:
+    explicit Arena(bool collect = false);
+    ~Arena();
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ArenaStats stats() const;
+
+    // Returns free heap memory to the operating system where the C library
+    // supports it (malloc_trim). Walks the whole heap, so call it after
+    // requests that allocated a lot rather than after every one.
+    static void release();
+
+    struct Data;
+
+private:
+    Data* data_; // outlives the arena while blocks allocated in it are alive
+    Data* previous_;
+    bool collect_;
+};
+
+} // end namespace memory
+
+namespace detail {
+
+// Attributes allocations on this thread to the call site `site` points to,
+// until destroyed. Does nothing unless memory tracking is enabled.
+class MemoryScope {
+public:
+    explicit MemoryScope(const std::string* site);
+    ~MemoryScope();
+
+    MemoryScope(const MemoryScope&) = delete;
+    MemoryScope& operator=(const MemoryScope&) = delete;
+
+    bool active() const { return active_; }
+
+    struct Site;
+    Site* resolve(); // nullptr while the site name is unknown
+
+private:
+    const std::string* site_;
+    Site* resolved_;
+    MemoryScope* previous_;
+    bool active_;
+};
+
+} // end namespace detail
+} // end namespace wrappy
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <array>
+#include <string>
+#include <vector>
+
+// Per-call-site metrics: how often each python function was called through
+// wrappy, how often that failed, and how long the phases of a call took:
+//
+//     wrappy::metrics::setEnabled(true);
+//     ... // run the workload
+//     std::cout << wrappy::metrics::dumpText();
+//
+// Calls by name are recorded under that name, calls of a method under
+// "<type>.<method>", calls of a function object under its qualified name and
+// C++ callbacks under "<lambda 0x...>" with the address of the function, or
+// "<callback ...>" with the type of the callable. While disabled, a call only
+// pays for checking the flag.
+namespace wrappy {
+namespace metrics {
+
+enum Phase {
+    Lookup,    // resolving the name, see load()
+    Marshal,   // converting the arguments and building the argument list
+    Execute,   // the python function, or the C++ function of a callback
+    Unmarshal, // checking and taking over the result, and converting it for Function
+};
+
+const size_t PhaseCount = 4;
+
+// Latency distribution in nanoseconds. The buckets are log-linear like an
+// HDR histogram: 8 sub-buckets per power of two, i.e. within 12.5%.
+struct Histogram {
+    static const size_t Buckets = 496;
+
+    unsigned long long count;
+    unsigned long long sumNs;
+    unsigned long long maxNs;
+    std::array<unsigned long long, Buckets> buckets;
+
+    static size_t bucketOf(unsigned long long ns);
+    static unsigned long long lowerBound(size_t bucket);
+
+    double meanNs() const;
+    // Approximate value below which the fraction p (0..1) of samples lie
+    unsigned long long percentileNs(double p) const;
+};
+
+struct CallSite {
+    std::string name;
+    unsigned long long calls;
+    unsigned long long errors;
+    Histogram total;
+    std::array<Histogram, PhaseCount> phases;
+};
+
+void setEnabled(bool enabled);
+bool enabled();
+
+// All call sites recorded since the last reset, most called first
+std::vector<CallSite> snapshot();
+void reset();
+
+// Human readable table, and the same data as a JSON document
+std::string dumpText();
+std::string dumpJson();
+
+} // end namespace metrics
+
+namespace detail {
+
+// Monotonic clock in nanoseconds while metrics are enabled, otherwise 0
+unsigned long long metricsClock();
+
+// Adds one call to the call site, phases are in nanoseconds
+void recordCall(const std::string& site, const unsigned long long* phases, bool error);
+
+// The contents of a JSON string literal
+std::string escapeJson(const std::string& str);
+
+} // end namespace detail
+} // end namespace wrappy
@@ -0,0 +1,185 @@
+#pragma once
+
+#include <wrappy/wrappy.h>
+#include <wrappy/executor.h>
+
+#include <chrono>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <vector>
+
+namespace wrappy {
+
+// A pool of python worker processes on the same host, for python code that
+// must not run inside the application: dependencies that leak, crash, or
+// hold the GIL for a long time. Calls are routed to the worker with the
+// fewest pending calls and return a std::future:
+//
+//     wrappy::enableThreads();
+//     wrappy::ProcessPool::Options options;
+//     options.workers = 4;
+//     wrappy::ProcessPool pool(options);
+//     std::future<double> root = pool.call<double>("math.sqrt", 16.0);
+//
+// Every worker runs the wrappy_worker executable and talks to the pool
+// through two ring buffers in shared memory, one per direction. Arguments
+// and results are pickled by the application's and the worker's
+// interpreter. From python 3.8 on, contiguous buffers like bytearrays and
+// numpy arrays travel out-of-band (pickle protocol 5): the sender copies
+// them straight into the ring, and the worker gets read-only views of the
+// ring memory instead of copies. A view that the called function keeps
+// alive pins its part of the ring until it is released; a call that finds
+// the ring held that way for a second fails with a WrappyError. Results are
+// copied out of the ring once.
+//
+// A worker that can't be restarted after a few attempts is given up, and
+// calls routed to it fail with a WrappyError.
+//
+// The pool supervises its workers. A worker that exits, crashes or takes
+// longer than Options::callTimeout for a call is killed if necessary and
+// restarted; the calls it had not answered yet fail with a WrappyError.
+// Python exceptions raised by the called function are raised again as
+// PythonError, with the worker's traceback in the message.
+//
+// Requires enableThreads(). Don't call into the pool while holding the GIL
+// through GilAcquire, a full ring would wait for the GIL.
+class ProcessPool {
+public:
+    struct Options {
+        Options()
+          : workers(1)
+          , ringBytes(8 << 20)
+          , callTimeout(0)
+          , startTimeout(30000)
+        { }
+
+        size_t workers;
+        size_t ringBytes; // per direction and worker, a message can use up to half.
+                          // Rounded up to 64 bytes, at least 4096.
+        std::chrono::milliseconds callTimeout;  // 0 to wait forever
+        std::chrono::milliseconds startTimeout; // until the worker's interpreter runs
+        std::string workerPath; // defaults to $WRAPPY_WORKER, or wrappy_worker in $PATH
+        std::vector<std::string> searchPaths; // Config::searchPaths of the workers
+    };
+
+    explicit ProcessPool(const Options& options = Options());
+    ~ProcessPool(); // waits for pending calls, then stops the workers
+
+    ProcessPool(const ProcessPool&) = delete;
+    ProcessPool& operator=(const ProcessPool&) = delete;
+
+    size_t size() const;
+
+    // call(name, args...) in a worker, or in the given one. The arguments
+    // are converted with construct() and pickled on the calling thread,
+    // pairs are passed as keyword arguments like for wrappy::call(). The
+    // result is unpickled and converted with PythonObject::as<R>().
+    template<typename R = PythonObject, typename... Args>
+    std::future<R> call(const std::string& function, const Args&... args);
+    template<typename R = PythonObject, typename... Args>
+    std::future<R> callOn(size_t worker, const std::string& function, const Args&... args);
+
+    std::future<PythonObject> callWithArgs(
+        const std::string& function,
+        const std::vector<PythonObject>& args
+            = std::vector<PythonObject>(),
+        const std::vector<std::pair<std::string, PythonObject>>& kwargs
+            = std::vector<std::pair<std::string, PythonObject>>());
+
+    struct WorkerStats {
+        int pid;
+        size_t pending;  // calls sent and not answered yet
+        size_t restarts;
+    };
+
+    std::vector<WorkerStats> stats() const;
+
+    // The worker side, i.e. the main() of wrappy_worker. An application can
+    // also pass its own executable as Options::workerPath, and hand over to
+    // workerMain() early in main() if isWorkerCommand() is true.
+    static bool isWorkerCommand(int argc, char** argv);
+    static int workerMain(int argc, char** argv);
+
+private:
+    class Worker;
+
+    // Called on a thread of the pool with the GIL held, with either the
+    // result or the error
+    typedef std::function<void(PythonObject*, std::exception_ptr)> Completion;
+
+    void submit(size_t worker, const std::string& function,
+        const std::vector<PythonObject>& args,
+        const std::vector<std::pair<std::string, PythonObject>>& kwargs,
+        Completion complete);
+    size_t leastLoaded() const;
+
+    template<typename R>
+    static Completion completion(std::shared_ptr<std::promise<R>> promise);
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    PythonObject dumps_;
+    PythonObject loads_;
+};
+
+template<typename R, typename... Args>
+std::future<R> ProcessPool::call(const std::string& function, const Args&... args)
+{
+    return callOn<R>(leastLoaded(), function, args...);
+}
+
+template<typename R, typename... Args>
+std::future<R> ProcessPool::callOn(size_t worker, const std::string& function, const Args&... args)
+{
+    // Pairs are keyword arguments, as for wrappy::call()
+    std::vector<PythonObject> positional;
+    std::vector<std::pair<std::string, PythonObject>> keywords;
+    {
+        detail::AutoGil gil;
+        detail::ArgumentArray<sizeof...(Args)> arguments;
+        detail::packArguments(arguments.data(), args...);
+        for (detail::Argument& arg : arguments) {
+            if (arg.keyword) {
+                keywords.emplace_back(arg.keyword, std::move(arg.value));
+            } else {
+                positional.push_back(std::move(arg.value));
+            }
+        }
+    }
+
+    auto promise = std::make_shared<std::promise<R>>();
+    std::future<R> result = promise->get_future();
+    submit(worker, function, positional, keywords, completion(promise));
+    return result;
+}
+
+template<typename R>
+ProcessPool::Completion ProcessPool::completion(std::shared_ptr<std::promise<R>> promise)
+{
+    return [promise](PythonObject* result, std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+            return;
+        }
+        try {
+            promise->set_value(detail::AsyncResult<R>::convert(*result));
+        } catch (...) {
+            promise->set_exception(std::current_exception());
+        }
+    };
+}
+
+template<>
+inline ProcessPool::Completion ProcessPool::completion(std::shared_ptr<std::promise<void>> promise)
+{
+    return [promise](PythonObject*, std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value();
+        }
+    };
+}
+
+} // end namespace wrappy
@@ -0,0 +1,109 @@
+#pragma once
+
+#include <atomic>
+#include <string>
+
+// Timeline tracing in the Chrome trace event format, to see where the time
+// of a single slow request goes:
+//
+//     wrappy::trace::start();
+//     ... // run the request
+//     wrappy::trace::stop();
+//     wrappy::trace::writeJson("request.json");
+//
+// The file opens in chrome://tracing and ui.perfetto.dev. Every call made
+// through wrappy, load(), step of a python iterator and C++ callback called
+// from python becomes one event, named like the call sites of
+// wrappy::metrics. With Options::pythonFrames, the python functions running
+// in between are recorded as well, through the interpreter's profile hook
+// (see PyEval_SetProfile()), on every thread that calls into wrappy.
+//
+// Events go to a buffer per thread that only the thread itself writes to,
+// without locks. While stopped, a traced call only pays for checking a flag.
+namespace wrappy {
+namespace trace {
+
+struct Options {
+    Options()
+      : pythonFrames(false)
+      , bufferBytes(64 << 20)
+    { }
+
+    bool pythonFrames;
+    size_t bufferBytes; // per thread, further events are dropped
+};
+
+// Starts a new trace, the events of the previous one are discarded. Must not
+// run concurrently with dumpJson() or writeJson().
+void start(const Options& options = Options());
+void stop();
+bool enabled();
+
+struct Stats {
+    unsigned long long events;
+    unsigned long long dropped; // because a buffer was full
+    size_t threads;             // that recorded events
+};
+
+Stats stats();
+
+// The events of the current or last trace as a JSON document, and the same
+// written to a file, which throws a WrappyError if that fails
+std::string dumpJson();
+void writeJson(const std::string& path);
+
+} // end namespace trace
+
+namespace detail {
+
+// Checked inline, so that a scope costs a single load while not tracing
+extern std::atomic<bool> traceEnabled;
+
+// Monotonic clock in nanoseconds while tracing, otherwise 0. Installs the
+// profile hook on this thread if needed, so the GIL must be held.
+unsigned long long traceClock();
+
+void recordTrace(const char* category, const char* name, size_t size,
+    unsigned long long start, unsigned long long end);
+
+// Records an event from construction to destruction, named by the string
+// that `name` points to at that time
+class TraceScope {
+public:
+    TraceScope(const char* category, const std::string* name)
+      : category_(category)
+      , name_(name)
+      , cname_(nullptr)
+      , start_(traceEnabled.load(std::memory_order_relaxed) ? traceClock() : 0)
+    { }
+
+    TraceScope(const char* category, const char* name)
+      : category_(category)
+      , name_(nullptr)
+      , cname_(name)
+      , start_(traceEnabled.load(std::memory_order_relaxed) ? traceClock() : 0)
+    { }
+
+    ~TraceScope()
+    {
+        if (start_) {
+            finish();
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    bool active() const { return start_ != 0; }
+
+private:
+    void finish();
+
+    const char* category_;
+    const std::string* name_;
+    const char* cname_;
+    unsigned long long start_;
+};
+
+} // end namespace detail
+} // end namespace wrappy
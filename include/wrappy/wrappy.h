@@ -1,26 +1,73 @@
 #pragma once
 
 #include <map>
+#include <set>
+#include <list>
+#include <array>
+#include <deque>
+#include <tuple>
+#include <memory>
 #include <vector>
 #include <string>
+#include <cstddef>
 #include <stdexcept>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#if __cplusplus >= 201703L
+# include <optional>
+#endif
 
 struct _object;
 typedef _object PyObject;
 
 /**
- * Note that this library is *NOT* thread-safe.
+ * Note that by default this library is *NOT* thread-safe.
  *
- * This is basically unfixable since the reference count of a python object
- * is stored in a non-atomic ssize_t and modified without any locking,
- * making any increases and decreases inherently racy.
+ * The reference count of a python object is stored in a non-atomic ssize_t
+ * and modified without any locking, and the interpreter itself relies on
+ * the global interpreter lock (GIL) being held by whoever touches it.
  *
- * If you want to use this in a multi-threaded environment, please make sure
- * to protect all concurrent calls that are not read-only by mutexes.
+ * Calling wrappy::enableThreads() once from the main thread switches to
+ * threaded mode: the main thread gives up the GIL, and every wrappy function
+ * (including copying and destroying a PythonObject) acquires it as needed.
+ * Use GilAcquire to hold on to the GIL across several wrappy calls, and
+ * GilRelease to let other threads run during long C++ sections, e.g. inside
+ * a callback created with construct(Lambda).
  */
 
 namespace wrappy {
 
+namespace detail {
+
+// A buffer obtained from a python object, see ArrayView.
+// The buffer is released when the last copy of `lock` is destroyed.
+struct BufferHandle {
+    void* data;
+    size_t size; // number of elements
+    std::vector<ptrdiff_t> shape;
+    std::vector<ptrdiff_t> strides; // in bytes
+    std::shared_ptr<void> lock;
+};
+
+// Holds the GIL during its lifetime, if threaded mode is enabled
+int acquireAutoGil();
+void releaseAutoGil(int state);
+
+class AutoGil {
+public:
+    AutoGil() : state_(acquireAutoGil()) { }
+    ~AutoGil() { releaseAutoGil(state_); }
+
+    AutoGil(const AutoGil&) = delete;
+    AutoGil& operator=(const AutoGil&) = delete;
+
+private:
+    int state_;
+};
+
+} // end namespace detail
+
 class WrappyError : public std::runtime_error {
 public:
     WrappyError(const std::string& str)
@@ -28,6 +75,47 @@ public:
     { }
 };
 
+// An attribute or keyword name whose python string is created and interned
+// once per interpreter, and then reused by attr(), call(from, name) and
+// keyword arguments:
+//
+//     using namespace wrappy::literals;
+//     list.attr("append"_name);
+//     call("datetime.timedelta", std::make_pair("hours"_name, 1));
+//
+// The characters are not copied, and identified by their address, so a
+// Name can only be made from a string literal.
+class Name;
+
+inline namespace literals {
+
+constexpr Name operator"" _name(const char* str, size_t size);
+
+} // end namespace literals
+
+class Name {
+public:
+    constexpr const char* c_str() const { return str_; }
+    constexpr size_t size() const { return size_; }
+
+private:
+    friend constexpr Name literals::operator"" _name(const char* str, size_t size);
+
+    constexpr Name(const char* str, size_t size) : str_(str), size_(size) { }
+
+    const char* str_;
+    size_t size_;
+};
+
+inline namespace literals {
+
+constexpr Name operator"" _name(const char* str, size_t size)
+{
+    return Name(str, size);
+}
+
+} // end namespace literals
+
 // A Raii-wrapper around PyObject* that transparently handles
 // the necessary reference-counting
 class PythonObject {
@@ -41,6 +129,15 @@ public:
     const char* str() const;
     PyObject* get() const;
     PythonObject attr(const std::string& x) const; // returns self.x
+    PythonObject attr(const Name& x) const;
+
+    // Checked conversion to T, throws a WrappyError if the object can't
+    // be represented as T. Supported are bool, integers, floating point
+    // numbers, std::string, PythonObject, and std::vector, std::map,
+    // std::unordered_map, std::pair and std::tuple of these. Sequences
+    // and dicts are converted in a single pass into pre-sized containers.
+    template<typename T>
+    T as() const;
 
     // Give up ownership of the underlying object
     PyObject* release();
@@ -48,7 +145,9 @@ public:
     // Constructors
     struct owning {};
     struct borrowed {};
-    PythonObject(); // Note that this does not default to "None"
+    // Note that this does not default to "None". It is constexpr, so
+    // global objects are initialized before any other code runs.
+    constexpr PythonObject() : obj_(nullptr) { }
     PythonObject(owning, PyObject*);
     PythonObject(borrowed, PyObject*);
 
@@ -58,7 +157,9 @@ public:
     PythonObject operator()() const; // forwards to self.__call__()
 
     template<typename... Args>
-    PythonObject call(const std::string& f, Args... args);
+    PythonObject call(const std::string& f, Args&&... args);
+    template<typename... Args>
+    PythonObject call(const Name& f, Args&&... args);
 
     // Rule-of-five plumbing
     ~PythonObject();
@@ -71,6 +172,61 @@ private:
     PyObject* obj_;
 };
 
+// A python exception raised by code called through wrappy. Holds the
+// exception objects, the message including the traceback is only formatted
+// by the first call to what().
+class PythonError : public WrappyError {
+public:
+    PythonError(const std::string& context,
+        PythonObject type, PythonObject value, PythonObject traceback);
+
+    const PythonObject& type() const;
+    const PythonObject& value() const;
+    const PythonObject& traceback() const; // may be empty
+
+    // Whether the exception is an instance of cls, e.g. load("KeyError")
+    bool matches(const PythonObject& cls) const;
+
+    const char* what() const noexcept override;
+
+private:
+    struct State;
+    std::shared_ptr<State> state_;
+};
+
+namespace detail {
+
+// Takes the pending python exception and throws it as PythonError, or
+// throws a WrappyError with just the context if there is none.
+[[noreturn]] void throwPythonError(const std::string& context);
+
+// The items of a python iterable. Lists and tuples are indexed directly,
+// everything else goes through the iterator protocol.
+class ItemSource {
+public:
+    ItemSource();
+    explicit ItemSource(const PythonObject& iterable); // throws if not iterable
+    ItemSource(const ItemSource&);
+    ItemSource& operator=(ItemSource);
+    ~ItemSource();
+
+    // Returns a borrowed reference to the next item, which stays valid until
+    // the next call, or nullptr at the end. The caller must hold the GIL.
+    PyObject* next();
+
+    // Replaces the contents of items with up to `count` further items, and
+    // returns false if there were none left. Acquires the GIL once.
+    bool fill(std::vector<PythonObject>& items, size_t count);
+
+private:
+    PythonObject source_; // the list or tuple, or an iterator
+    bool indexed_;
+    size_t index_;
+    PyObject* current_;
+};
+
+} // end namespace detail
+
 // Note that this is an input iterator, iterators cannot 
 // be stored, rewound, or compared to anything but "end"
 struct PythonIterator {
@@ -81,18 +237,43 @@ struct PythonIterator {
     bool operator!=(const PythonIterator&); 
 
 private:
-    PythonIterator(bool, PythonObject);
+    PythonIterator(bool, detail::ItemSource);
     friend PythonIterator begin(PythonObject);
     friend PythonIterator end(PythonObject);
 
     bool stopped_;
-    PythonObject iter_;
+    detail::ItemSource source_;
     PythonObject obj_;
 };
 
 PythonIterator begin(PythonObject);
 PythonIterator end(PythonObject);
 
+// Typed iteration over a python iterable, e.g.
+//
+//     for (double d : wrappy::range<double>(obj)) { ... }
+//
+// The items are converted like PythonObject::as<T>(), in chunks of the
+// given size, so the GIL is only acquired once per chunk.
+// A range can only be iterated once.
+template<typename T>
+class Range;
+
+template<typename T>
+Range<T> range(const PythonObject& iterable, size_t chunk = 256);
+
+// Iteration over a python iterable in chunks of up to `size` items, which
+// are stored in a buffer reused for every chunk:
+//
+//     for (const std::vector<PythonObject>& chunk : wrappy::chunks(obj, 64)) { ... }
+class Chunks;
+
+Chunks chunks(const PythonObject& iterable, size_t size);
+
+// Same as obj.as<T>()
+template<typename T>
+T fromPython(const PythonObject& obj);
+
 // Providing access to pythons global objects
 extern PythonObject None;
 extern PythonObject True;
@@ -100,6 +281,87 @@ extern PythonObject False;
 
 void addModuleSearchPath(const std::string& path);
 
+// Controls how the interpreter is started, see initialize()
+struct Config {
+    Config() : isolated(false), importSite(true), trackMemory(false) { }
+
+    bool isolated;   // ignore the PYTHON* environment variables and user site-packages
+    bool importSite; // import the site module, which adds site-packages to sys.path
+    std::vector<std::string> searchPaths; // put in front of sys.path, in this order
+    std::vector<std::string> preImport;   // imported on a background thread
+    bool trackMemory; // enable memory::setEnabled() right away
+};
+
+// Starts the interpreter, which otherwise happens with the default config
+// when wrappy is first used. Throws a WrappyError if it is already running.
+// Pre-importing switches to threaded mode, so in that case this must be
+// called from the main thread. An interpreter started by the application
+// itself is used as is, and not finalized by wrappy.
+void initialize(const Config& config = Config());
+bool initialized();
+
+struct StartupStats {
+    double initializeSeconds; // starting the interpreter and setting sys.path
+    double preImportSeconds;  // importing in the background so far
+    size_t preImportPending;
+    size_t preImported;
+    size_t preImportFailed;
+};
+
+StartupStats startupStats();
+
+// Switches to threaded mode, see the comment at the top of this file.
+// Must be called from the main thread while no other thread uses wrappy.
+void enableThreads();
+bool threadsEnabled();
+
+// In threaded mode, destroying a PythonObject on a thread that doesn't hold
+// the GIL normally has to acquire it just for the decref. With deferred
+// decrefs enabled, the object is pushed onto a lock-free stack instead, at
+// the cost of one small allocation, and the whole stack is drained the next
+// time any thread acquires the GIL through wrappy, or by
+// flushDeferredDecrefs(). Objects are released newest first.
+void setDeferredDecref(bool enabled);
+void flushDeferredDecrefs();
+
+struct DeferredDecrefStats {
+    size_t depth;     // objects currently waiting on the stack
+    size_t maxDepth;  // largest depth seen so far
+    unsigned long long deferred; // total number of deferred decrefs
+    unsigned long long drains;   // number of non-empty batches drained
+};
+
+DeferredDecrefStats deferredDecrefStats();
+
+// Acquires the GIL for the current thread, can be nested.
+// Threads other than the main thread need enableThreads() to be called first.
+class GilAcquire {
+public:
+    GilAcquire();
+    ~GilAcquire();
+
+    GilAcquire(const GilAcquire&) = delete;
+    GilAcquire& operator=(const GilAcquire&) = delete;
+
+private:
+    int state_;
+};
+
+// Releases the GIL held by the current thread, and re-acquires it on
+// destruction. Don't touch any python objects while it is alive, unless
+// threaded mode is enabled.
+class GilRelease {
+public:
+    GilRelease();
+    ~GilRelease();
+
+    GilRelease(const GilRelease&) = delete;
+    GilRelease& operator=(const GilRelease&) = delete;
+
+private:
+    void* state_;
+};
+
 // There is one quirk of call() for the case of member methods:
 //
 //     call("module.A.foo") 
@@ -113,28 +375,243 @@ void addModuleSearchPath(const std::string& path);
 // self argument in that case is an error.
 
 template<typename... Args>
-PythonObject call(const std::string& f, Args... args);
+PythonObject call(const std::string& f, Args&&... args);
+
+template<typename... Args>
+PythonObject call(const PythonObject& from, const std::string& f, Args&&... args);
 
+// Calls the method from.f(), looked up with an interned name on every call
 template<typename... Args>
-PythonObject call(PythonObject from, const std::string& f, Args... args);
+PythonObject call(const PythonObject& from, const Name& f, Args&&... args);
 
 
 // The template-magic in call() constructs a series of appropriate calls
 // to these functions, but of course they can also be used directly:
 
-PythonObject construct(long long);
+PythonObject construct(bool);
 PythonObject construct(int);
+PythonObject construct(unsigned int);
+PythonObject construct(long);
+PythonObject construct(unsigned long);
+PythonObject construct(long long);
+PythonObject construct(unsigned long long);
+PythonObject construct(float);
 PythonObject construct(double);
+PythonObject construct(const char*);
 PythonObject construct(const std::string&);
-PythonObject construct(PythonObject); // identity
+PythonObject construct(const PythonObject&); // identity
+PythonObject construct(PythonObject&&); // identity
 PythonObject construct(const std::vector<PythonObject>&); // python list
 
+// Standard containers are converted recursively, in a single pass that
+// writes directly into the pre-sized python object.
+template<typename T, typename Alloc>
+PythonObject construct(const std::vector<T, Alloc>&); // python list
+template<typename T, typename Alloc>
+PythonObject construct(const std::list<T, Alloc>&); // python list
+template<typename T, typename Alloc>
+PythonObject construct(const std::deque<T, Alloc>&); // python list
+template<typename T, size_t N>
+PythonObject construct(const std::array<T, N>&); // python list
+template<typename K, typename V, typename Compare, typename Alloc>
+PythonObject construct(const std::map<K, V, Compare, Alloc>&); // python dict
+template<typename K, typename V, typename Hash, typename Eq, typename Alloc>
+PythonObject construct(const std::unordered_map<K, V, Hash, Eq, Alloc>&); // python dict
+template<typename T, typename Compare, typename Alloc>
+PythonObject construct(const std::set<T, Compare, Alloc>&); // python set
+template<typename T, typename Hash, typename Eq, typename Alloc>
+PythonObject construct(const std::unordered_set<T, Hash, Eq, Alloc>&); // python set
+template<typename A, typename B>
+PythonObject construct(const std::pair<A, B>&); // python tuple
+template<typename... Ts>
+PythonObject construct(const std::tuple<Ts...>&); // python tuple
+#if __cplusplus >= 201703L
+template<typename T>
+PythonObject construct(const std::optional<T>&); // None or the value
+#endif
+
+// A block of memory holding arithmetic values, as described by the python
+// buffer protocol. Use buffer() to create one, the fields can be adjusted
+// afterwards.
+struct Buffer {
+    void* data;
+    const char* format; // format string of the struct module, e.g. "d"
+    size_t itemsize;
+    bool readonly;
+    std::vector<ptrdiff_t> shape;
+    std::vector<ptrdiff_t> strides; // in bytes, one per dimension
+    std::shared_ptr<void> owner; // keeps data alive, empty if borrowed
+
+    // A buffer owning a C-contiguous copy of the data
+    Buffer copy() const;
+};
+
+// Exporting a buffer to python does not copy the data. Unless the buffer
+// owns its memory, it must stay valid for as long as python holds on to
+// the exported object, which may well be longer than the call it was
+// passed to. Moving a vector into buffer() or calling Buffer::copy()
+// transfers ownership to python.
+// Buffers to const data are read-only in python.
+template<typename T>
+Buffer buffer(T* data, size_t size);
+template<typename T>
+Buffer buffer(T* data, size_t rows, size_t cols); // C-contiguous
+template<typename T>
+Buffer buffer(T* data, std::vector<ptrdiff_t> shape, std::vector<ptrdiff_t> strides);
+template<typename T>
+Buffer buffer(std::vector<T>& v);
+template<typename T>
+Buffer buffer(const std::vector<T>& v);
+template<typename T>
+Buffer buffer(std::vector<T>&& v); // owning
+template<typename T, size_t N>
+Buffer buffer(std::array<T, N>& a);
+template<typename T, size_t N>
+Buffer buffer(const std::array<T, N>& a);
+
+PythonObject construct(const Buffer&); // python memoryview
+PythonObject numpyArray(const Buffer&); // requires numpy
+
+// Direct access to the memory of a python object supporting the buffer
+// protocol, e.g. a numpy array, a memoryview or a bytearray. The buffer is
+// locked while the view exists, so python can not resize or free it.
+//
+// ArrayView<const T> is a read-only view, ArrayView<T> requires a writable
+// buffer. Constructing a view throws a WrappyError if the object doesn't
+// support the buffer protocol, if its element type doesn't match T, or
+// if it is not C-contiguous. Multi-dimensional buffers are flattened.
+template<typename T>
+class ArrayView {
+public:
+    explicit ArrayView(const PythonObject& obj);
+
+    T* data() const;
+    size_t size() const;
+    T& operator[](size_t i) const;
+    T* begin() const;
+    T* end() const;
+
+private:
+    detail::BufferHandle handle_;
+};
+
+// Like ArrayView, but also accepts non-contiguous buffers and exposes
+// their shape. Elements are accessed with one index per dimension.
+template<typename T>
+class NDArrayView {
+public:
+    explicit NDArrayView(const PythonObject& obj);
+
+    T* data() const;
+    size_t ndim() const;
+    const std::vector<ptrdiff_t>& shape() const;
+    const std::vector<ptrdiff_t>& strides() const; // in bytes
+
+    template<typename... Indices>
+    T& operator()(Indices... indices) const;
+
+private:
+    detail::BufferHandle handle_;
+};
+
 // TODO there is no good way to actually call these constructed functions
 typedef PythonObject (*Lambda)(const std::vector<PythonObject>& args, const std::map<const char*, PythonObject>& kwargs);
 typedef PythonObject (*LambdaWithData)(const std::vector<PythonObject>& args, const std::map<const char*, PythonObject>& kwargs, void* userdata);
 PythonObject construct(Lambda);
 PythonObject construct(LambdaWithData, void*);
 
+namespace detail {
+
+// Signature of a callable with a single, non-template operator()
+template<typename F, typename = void>
+struct CallableTraits {};
+
+template<typename R, typename... Args>
+struct CallableTraits<R(*)(Args...)> {
+    typedef R Result;
+    typedef std::tuple<Args...> Arguments;
+};
+
+template<typename C, typename R, typename... Args>
+struct CallableTraits<R(C::*)(Args...)> : CallableTraits<R(*)(Args...)> {};
+
+template<typename C, typename R, typename... Args>
+struct CallableTraits<R(C::*)(Args...) const> : CallableTraits<R(*)(Args...)> {};
+
+template<typename F>
+struct CallableTraits<F, decltype(void(&F::operator()))>
+  : CallableTraits<decltype(&F::operator())> {};
+
+// Capture-less lambdas with the signature of Lambda keep going to
+// construct(Lambda)
+template<typename F>
+struct IsCallback {
+    static const bool value = !std::is_same<F, PythonObject>::value
+        && !std::is_convertible<F, Lambda>::value
+        && !std::is_convertible<F, LambdaWithData>::value;
+};
+
+} // end namespace detail
+
+// Wraps any C++ callable with a fixed signature as a python function, e.g.
+//
+//     double scale = 2.0;
+//     auto f = wrappy::construct([&](double x, wrappy::ArrayView<const double> v) {
+//         return scale * x * v[0];
+//     });
+//
+// Arguments are converted directly from python's argument array like
+// PythonObject::as<Arg>(), so PythonObject and ArrayView arguments don't
+// copy anything. The result is converted with construct(). Wrong arguments
+// and C++ exceptions are raised as python exceptions. The callable is
+// copied into the python object and destroyed together with it.
+template<typename F, typename = typename std::enable_if<
+    detail::IsCallback<F>::value, typename detail::CallableTraits<F>::Result>::type>
+PythonObject construct(F callable);
+
+namespace detail {
+
+// The element type of a generator, i.e. a callable `bool(T& next)` that
+// returns false at the end, or `std::optional<T>()`
+template<typename F, typename Result = typename CallableTraits<F>::Result,
+    typename Arguments = typename CallableTraits<F>::Arguments>
+struct GeneratorTraits {};
+
+template<typename F, typename T>
+struct GeneratorTraits<F, bool, std::tuple<T&>> {
+    typedef T Element;
+};
+
+#if __cplusplus >= 201703L
+template<typename F, typename T>
+struct GeneratorTraits<F, std::optional<T>, std::tuple<>> {
+    typedef T Element;
+};
+#endif
+
+} // end namespace detail
+
+// A python iterator over a C++ range, which converts the elements with
+// construct() only when python asks for them, so that e.g.
+//
+//     wrappy::call(writer, "writerows", wrappy::constructIter(rows));
+//
+// never holds more than one row as python objects. With a chunk size,
+// the iterator yields lists of up to that many elements instead.
+//
+// The iterator overload refers to the elements in place, they have to
+// outlive the python iterator. A range is moved or copied into it, so
+// pass large containers with std::move(). A generator is called once
+// per element until it signals the end.
+template<typename Iterator>
+PythonObject constructIter(Iterator begin, Iterator end, size_t chunk = 0);
+
+template<typename Range, typename = decltype(std::begin(std::declval<Range&>()))>
+PythonObject constructIter(Range&& range, size_t chunk = 0);
+
+template<typename F, typename = typename detail::GeneratorTraits<F>::Element>
+PythonObject constructIter(F generator, size_t chunk = 0);
+
 PythonObject callWithArgs(
     const std::string& function,
     const std::vector<PythonObject>& args
@@ -154,6 +631,137 @@ PythonObject callWithArgs(
 // Just get an object, without calling a function
 PythonObject load(const std::string& name);
 
+// Evaluate a python expression, or execute python statements, e.g.
+//
+//     bool allowed = wrappy::eval("amount < limit * 2", {
+//         {"amount", wrappy::construct(amount)},
+//         {"limit", wrappy::construct(limit)}}).as<bool>();
+//
+// The code runs in a fresh namespace holding the builtins and the given
+// locals. exec() returns that namespace, i.e. a dict including everything
+// the code assigned. The source is compiled once, later calls with the same
+// text reuse the cached code object, see setCodeCacheCapacity().
+PythonObject eval(
+    const std::string& expression,
+    const std::vector<std::pair<std::string, PythonObject>>& locals
+        = std::vector<std::pair<std::string, PythonObject>>());
+
+PythonObject exec(
+    const std::string& code,
+    const std::vector<std::pair<std::string, PythonObject>>& locals
+        = std::vector<std::pair<std::string, PythonObject>>());
+
+
+// load() and all call() variants taking a function name remember what the
+// name resolved to, so repeated calls skip the import machinery and the
+// attribute lookups. Python code can rebind module attributes at runtime,
+// in which case the cache has to be invalidated explicitly.
+//
+// The name cache is enabled by default. The method cache used by
+// call(from, name) is disabled by default, because every entry keeps
+// `from` alive until it is evicted or invalidated.
+// A capacity of 0 disables the respective cache.
+void setNameCacheCapacity(size_t capacity);
+void setMethodCacheCapacity(size_t capacity);
+
+// Names that load() failed to find are remembered as well, so probing for
+// an optional module fails fast after the first time. addModuleSearchPath()
+// and invalidateCache() forget them.
+void setNegativeCacheCapacity(size_t capacity);
+
+// Code objects compiled by eval() and exec(), keyed by the source text.
+// Keeping a few more than the number of distinct snippets in use avoids
+// compiling them again.
+void setCodeCacheCapacity(size_t capacity);
+
+// Drop all cached entries, or just the ones for the given name.
+void invalidateCache();
+void invalidateCache(const std::string& name);
+
+
+namespace debug {
+
+// True if calls use the vectorcall protocol (python >= 3.9), which passes
+// the arguments as an array instead of building an argument tuple and
+// a kwargs dict.
+bool vectorcallEnabled();
+
+// Counts the python objects allocated by wrappy itself and the reference
+// count operations performed through PythonObject. Only available if the
+// library was built with WRAPPY_DEBUG_COUNTERS, otherwise all counters
+// stay at zero.
+struct Counters {
+    unsigned long long allocations;
+    unsigned long long increfs;
+    unsigned long long decrefs;
+};
+
+bool countersEnabled();
+Counters counters();
+void resetCounters();
+
+} // end namespace debug
+
+
+// A python callable with a fixed C++ signature, e.g.
+//
+//     wrappy::Function<double(double)> sqrt("math.sqrt");
+//     double two = sqrt(4.0);
+//
+// The name is resolved once on construction. Every call converts the
+// arguments with construct() directly into an argument tuple that is reused
+// between calls, and converts the result to R. R can be void or any type
+// supported by PythonObject::as(); a result that can not be converted
+// throws a WrappyError.
+template<typename Signature>
+class Function;
+
+template<typename R, typename... Args>
+class Function<R(Args...)> {
+public:
+    Function() = default;
+    explicit Function(const std::string& name);
+    explicit Function(PythonObject callable);
+
+    R operator()(const Args&... args) const;
+
+    const PythonObject& object() const;
+
+private:
+    PythonObject function_;
+    mutable PythonObject args_;
+};
+
+// Calls a python function once per element of a C++ range, e.g.
+//
+//     std::vector<double> roots = wrappy::callMany<double>("math.sqrt", values);
+//     wrappy::callMany<bool>(validate, rows, std::back_inserter(valid));
+//
+// Elements that are std::tuples are unpacked into positional arguments,
+// anything else is passed as the only argument. The function is resolved
+// once, the GIL is held for the whole batch, and the results are converted
+// to R straight into the output. With Batch::Loop, C++ calls the function
+// and reuses one argument tuple. With Batch::Map, the batch is handed to
+// python in a single call of map(), or itertools.starmap() for tuples.
+enum class Batch {
+    Loop,
+    Map,
+};
+
+template<typename R = PythonObject, typename Range, typename OutputIt>
+OutputIt callMany(const PythonObject& function, const Range& arguments,
+    OutputIt out, Batch batch = Batch::Loop);
+template<typename R = PythonObject, typename Range, typename OutputIt>
+OutputIt callMany(const std::string& function, const Range& arguments,
+    OutputIt out, Batch batch = Batch::Loop);
+
+// Same, collecting the results in a vector. R must not be void.
+template<typename R = PythonObject, typename Range>
+std::vector<R> callMany(const PythonObject& function, const Range& arguments,
+    Batch batch = Batch::Loop);
+template<typename R = PythonObject, typename Range>
+std::vector<R> callMany(const std::string& function, const Range& arguments,
+    Batch batch = Batch::Loop);
 
 // Will call x.__enter__() in constructor and x.__exit__() in destructor
 class ContextManager {
@@ -164,4 +772,15 @@ public:
 
 } // end namespace wrappy
 
+#include <wrappy/metrics.h>
+#include <wrappy/memory.h>
+#include <wrappy/trace.h>
+#include <wrappy/detail/construct.hpp>
 #include <wrappy/detail/call.hpp>
+#include <wrappy/detail/buffer.hpp>
+#include <wrappy/detail/convert.hpp>
+#include <wrappy/detail/iterate.hpp>
+#include <wrappy/detail/callback.hpp>
+#include <wrappy/detail/stream.hpp>
+#include <wrappy/detail/function.hpp>
+#include <wrappy/detail/batch.hpp>
@@ -0,0 +1,252 @@
+// Python header must be included first since they insist on
+// unconditionally defining some system macros
+// (http://bugs.python.org/issue1045893, still broken in python3.4)
+#include <Python.h>
+
+#include <wrappy/interpreter_pool.h>
+#include <wrappy/detail/task_queue.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+
+namespace wrappy {
+
+// One sub-interpreter and the thread running it. The thread owns the
+// interpreter's thread state and only holds its GIL while working through
+// a batch of tasks.
+class InterpreterPool::Worker {
+public:
+    Worker(const InterpreterPool* pool, size_t index)
+      : pool_(pool)
+      , index_(index)
+      , pending_(0)
+      , context_(detail::createInterpreterContext())
+    {
+        std::promise<void> ready;
+        std::future<void> started = ready.get_future();
+        thread_ = std::thread([this, &ready]() { main(ready); });
+        try {
+            started.get();
+        } catch (...) {
+            thread_.join();
+            detail::destroyInterpreterContext(context_);
+            throw;
+        }
+    }
+
+    // Returns false if the worker is already shutting down
+    bool post(std::function<void()> task)
+    {
+        ++pending_;
+        if (!queue_.push(std::move(task))) {
+            --pending_;
+            return false;
+        }
+        return true;
+    }
+
+    size_t pending() const { return pending_.load(std::memory_order_relaxed); }
+
+    // Runs the remaining tasks and ends the interpreter
+    void stop()
+    {
+        queue_.close();
+        thread_.join();
+    }
+
+    // The worker running on the current thread, if any
+    static thread_local Worker* current;
+
+    const InterpreterPool* pool_;
+    size_t index_;
+
+private:
+    void main(std::promise<void>& ready)
+    {
+        // Py_NewInterpreter() needs the GIL and a thread state, this
+        // thread gets one of the main interpreter for the duration.
+        PyGILState_STATE gilState = PyGILState_Ensure();
+        PyThreadState* outer = PyThreadState_Get();
+        PyThreadState* sub = nullptr;
+
+#if PY_VERSION_HEX >= 0x030C0000
+        PyInterpreterConfig config = {};
+        config.use_main_obmalloc = 0;
+        config.allow_fork = 0;
+        config.allow_exec = 0;
+        config.allow_threads = 1;
+        config.allow_daemon_threads = 0;
+        config.check_multi_interp_extensions = 1;
+        config.gil = PyInterpreterConfig_OWN_GIL;
+        PyStatus status = Py_NewInterpreterFromConfig(&sub, &config);
+        if (PyStatus_Exception(status)) {
+            sub = nullptr;
+        }
+#else
+        sub = Py_NewInterpreter();
+#endif
+        if (!sub) {
+            PyThreadState_Swap(outer);
+            PyGILState_Release(gilState);
+            ready.set_exception(std::make_exception_ptr(
+                WrappyError("Wrappy: Couldn't create sub-interpreter.")));
+            return;
+        }
+        PyEval_SaveThread();
+        ready.set_value();
+
+        detail::TaskQueue::Batch batch;
+        while (queue_.pop(batch)) {
+            PyEval_RestoreThread(sub);
+            detail::InterpreterContext* previous = detail::enterInterpreterContext(context_);
+            current = this;
+            for (auto& task : batch) {
+                task(); // packaged tasks, exceptions end up in the future
+                task = nullptr; // captured objects die with the GIL held
+                --pending_;
+            }
+            batch.clear();
+            current = nullptr;
+            detail::enterInterpreterContext(previous);
+            PyEval_SaveThread();
+        }
+
+        // The cached objects have to go before the interpreter
+        PyEval_RestoreThread(sub);
+        detail::InterpreterContext* previous = detail::enterInterpreterContext(context_);
+        detail::destroyInterpreterContext(context_);
+        detail::enterInterpreterContext(previous);
+        Py_EndInterpreter(sub);
+        PyThreadState_Swap(outer);
+        PyGILState_Release(gilState);
+    }
+
+    detail::TaskQueue queue_;
+    std::atomic<size_t> pending_; // queued and running tasks
+    detail::InterpreterContext* context_;
+    std::thread thread_;
+};
+
+thread_local InterpreterPool::Worker* InterpreterPool::Worker::current = nullptr;
+
+InterpreterPool::InterpreterPool(size_t size)
+{
+    if (!threadsEnabled()) {
+        throw WrappyError("Wrappy: InterpreterPool requires enableThreads().");
+    }
+    if (size == 0) {
+        throw WrappyError("Wrappy: InterpreterPool needs at least one interpreter.");
+    }
+
+    try {
+        for (size_t i = 0; i < size; ++i) {
+            workers_.push_back(std::make_shared<Worker>(this, i));
+        }
+    } catch (...) {
+        for (auto& worker : workers_) {
+            worker->stop();
+        }
+        throw;
+    }
+}
+
+InterpreterPool::~InterpreterPool()
+{
+    for (auto& worker : workers_) {
+        worker->stop();
+    }
+}
+
+size_t InterpreterPool::size() const
+{
+    return workers_.size();
+}
+
+void InterpreterPool::post(size_t interpreter, std::function<void()> task)
+{
+    if (interpreter >= workers_.size()) {
+        throw WrappyError("Wrappy: No such interpreter in pool.");
+    }
+    workers_[interpreter]->post(std::move(task));
+}
+
+size_t InterpreterPool::leastLoaded() const
+{
+    auto it = std::min_element(workers_.begin(), workers_.end(),
+        [](const std::shared_ptr<Worker>& a, const std::shared_ptr<Worker>& b) {
+            return a->pending() < b->pending();
+        });
+    return it - workers_.begin();
+}
+
+size_t InterpreterPool::owner(const Object& object) const
+{
+    if (!object || object.pool_ != this) {
+        throw WrappyError("Wrappy: Object does not belong to this pool.");
+    }
+    return object.interpreter_;
+}
+
+const PythonObject& InterpreterPool::unwrap(const Object& object) const
+{
+    size_t interpreter = owner(object);
+    Worker* worker = Worker::current;
+    if (!worker || worker->pool_ != this || worker->index_ != interpreter) {
+        throw WrappyError("Wrappy: Object belongs to another interpreter.");
+    }
+    return *object.object_;
+}
+
+const PythonObject& InterpreterPool::Object::get() const
+{
+    if (!pool_) {
+        throw WrappyError("Wrappy: Empty InterpreterPool::Object.");
+    }
+    return pool_->unwrap(*this);
+}
+
+InterpreterPool::Object InterpreterPool::wrap(PythonObject object) const
+{
+    Worker* worker = Worker::current;
+    if (!worker || worker->pool_ != this) {
+        throw WrappyError("Wrappy: wrap() must be called on a worker of the pool.");
+    }
+
+    std::weak_ptr<Worker> owner = workers_[worker->index_];
+    Object res;
+    res.object_.reset(new PythonObject(std::move(object)), [owner](PythonObject* obj) {
+        if (Worker::current && Worker::current == owner.lock().get()) {
+            delete obj;
+            return;
+        }
+        std::shared_ptr<Worker> worker = owner.lock();
+        if (!worker || !worker->post([obj]() { delete obj; })) {
+            // The interpreter is gone, nothing left to decref
+            obj->release();
+            delete obj;
+        }
+    });
+    res.pool_ = this;
+    res.interpreter_ = worker->index_;
+    return res;
+}
+
+std::future<InterpreterPool::Object> InterpreterPool::load(
+    size_t interpreter, const std::string& name)
+{
+    return run(interpreter, [this, name]() { return wrap(wrappy::load(name)); });
+}
+
+void InterpreterPool::invalidateCache()
+{
+    std::vector<std::future<void>> done;
+    for (size_t i = 0; i < workers_.size(); ++i) {
+        done.push_back(run(i, []() { wrappy::invalidateCache(); }));
+    }
+    for (auto& f : done) {
+        f.get();
+    }
+}
+
+} // end namespace wrappy
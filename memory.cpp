@@ -0,0 +1,397 @@
+#include <Python.h>
+#include "python_compat.h"
+
+#include <wrappy/wrappy.h>
+#include <wrappy/memory.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+namespace wrappy {
+namespace detail {
+
+struct MemoryScope::Site {
+    unsigned long long allocations;
+    unsigned long long allocatedBytes;
+    unsigned long long liveBlocks;
+    unsigned long long liveBytes;
+    unsigned long long liveObjects;
+};
+
+} // end namespace detail
+
+namespace memory {
+
+struct Arena::Data {
+    ArenaStats stats;
+    bool closed; // the Arena is gone, delete once no live blocks are left
+};
+
+} // end namespace memory
+} // end namespace wrappy
+
+namespace {
+
+using namespace wrappy;
+
+typedef detail::MemoryScope::Site Site;
+typedef memory::Arena::Data ArenaData;
+
+struct Block {
+    Site* site;
+    ArenaData* arena;
+    size_t size;
+    bool object;
+};
+
+std::atomic<bool> s_Enabled(false);
+
+// Guards the tables below. The hooks normally run under the GIL, but the
+// sub-interpreters of an InterpreterPool may have their own. The tables are
+// never destroyed, blocks can still be freed during static destruction.
+std::mutex s_Mutex;
+std::unordered_map<std::string, Site>& s_Sites = *new std::unordered_map<std::string, Site>();
+std::unordered_map<void*, Block>& s_Blocks = *new std::unordered_map<void*, Block>();
+
+thread_local detail::MemoryScope* t_Scope = nullptr;
+thread_local ArenaData* t_Arena = nullptr;
+
+#ifdef WRAPPY_ALLOCATOR_HOOKS
+
+// Called with s_Mutex held
+void release(const Block& block)
+{
+    if (block.site) {
+        --block.site->liveBlocks;
+        block.site->liveBytes -= block.size;
+        if (block.object) {
+            --block.site->liveObjects;
+        }
+    }
+    if (block.arena) {
+        --block.arena->stats.liveBlocks;
+        block.arena->stats.liveBytes -= block.size;
+        if (block.arena->closed && block.arena->stats.liveBlocks == 0) {
+            delete block.arena;
+        }
+    }
+}
+
+// Called with s_Mutex held, after the hooks were installed or removed
+void forgetBlocks()
+{
+    for (const auto& entry : s_Blocks) {
+        release(entry.second);
+    }
+    s_Blocks.clear();
+}
+
+void track(void* ptr, size_t size, bool object)
+{
+    Site* site = t_Scope ? t_Scope->resolve() : nullptr;
+    ArenaData* arena = t_Arena;
+    if (!site && !arena) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    if (site) {
+        ++site->allocations;
+        site->allocatedBytes += size;
+        ++site->liveBlocks;
+        site->liveBytes += size;
+        if (object) {
+            ++site->liveObjects;
+        }
+    }
+    if (arena) {
+        ++arena->stats.allocations;
+        arena->stats.allocatedBytes += size;
+        ++arena->stats.liveBlocks;
+        arena->stats.liveBytes += size;
+    }
+    s_Blocks[ptr] = Block {site, arena, size, object};
+}
+
+void untrack(void* ptr)
+{
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    auto it = s_Blocks.find(ptr);
+    if (it != s_Blocks.end()) {
+        Block block = it->second;
+        s_Blocks.erase(it);
+        release(block);
+    }
+}
+
+// A realloc()ed block stays with the site that allocated it
+bool retrack(void* ptr, void* res, size_t size)
+{
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    auto it = s_Blocks.find(ptr);
+    if (it == s_Blocks.end()) {
+        return false;
+    }
+
+    Block block = it->second;
+    s_Blocks.erase(it);
+    if (block.site) {
+        block.site->liveBytes += size - block.size;
+        if (size > block.size) {
+            block.site->allocatedBytes += size - block.size;
+        }
+    }
+    if (block.arena) {
+        block.arena->stats.liveBytes += size - block.size;
+        if (size > block.size) {
+            block.arena->stats.allocatedBytes += size - block.size;
+        }
+    }
+    block.size = size;
+    s_Blocks[res] = block;
+    return true;
+}
+
+// The hooks pass everything on to the allocator they replaced
+struct Hook {
+    PyMemAllocatorDomain domain;
+    PyMemAllocatorEx original;
+};
+
+Hook s_Hooks[] = {
+    {PYMEM_DOMAIN_MEM, PyMemAllocatorEx()},
+    {PYMEM_DOMAIN_OBJ, PyMemAllocatorEx()},
+};
+
+void* hookMalloc(void* ctx, size_t size)
+{
+    Hook* hook = static_cast<Hook*>(ctx);
+    void* res = hook->original.malloc(hook->original.ctx, size);
+    if (res) {
+        track(res, size, hook->domain == PYMEM_DOMAIN_OBJ);
+    }
+    return res;
+}
+
+void* hookCalloc(void* ctx, size_t count, size_t size)
+{
+    Hook* hook = static_cast<Hook*>(ctx);
+    void* res = hook->original.calloc(hook->original.ctx, count, size);
+    if (res) {
+        track(res, count * size, hook->domain == PYMEM_DOMAIN_OBJ);
+    }
+    return res;
+}
+
+void* hookRealloc(void* ctx, void* ptr, size_t size)
+{
+    Hook* hook = static_cast<Hook*>(ctx);
+    void* res = hook->original.realloc(hook->original.ctx, ptr, size);
+    if (res && !(ptr && retrack(ptr, res, size))) {
+        track(res, size, hook->domain == PYMEM_DOMAIN_OBJ);
+    }
+    return res;
+}
+
+void hookFree(void* ctx, void* ptr)
+{
+    Hook* hook = static_cast<Hook*>(ctx);
+    if (ptr) {
+        untrack(ptr);
+    }
+    hook->original.free(hook->original.ctx, ptr);
+}
+
+void installHooks()
+{
+    for (Hook& hook : s_Hooks) {
+        PyMem_GetAllocator(hook.domain, &hook.original);
+        PyMemAllocatorEx allocator = {&hook, hookMalloc, hookCalloc, hookRealloc, hookFree};
+        PyMem_SetAllocator(hook.domain, &allocator);
+    }
+}
+
+void removeHooks()
+{
+    for (Hook& hook : s_Hooks) {
+        PyMem_SetAllocator(hook.domain, &hook.original);
+    }
+}
+
+#endif
+
+} // end unnamed namespace
+
+namespace wrappy {
+namespace memory {
+
+bool supported()
+{
+#ifdef WRAPPY_ALLOCATOR_HOOKS
+    return true;
+#else
+    return false;
+#endif
+}
+
+void setEnabled(bool enabled)
+{
+#ifdef WRAPPY_ALLOCATOR_HOOKS
+    detail::AutoGil gil;
+    if (enabled == s_Enabled) {
+        return;
+    }
+
+    if (enabled) {
+        installHooks();
+    } else {
+        removeHooks();
+    }
+    s_Enabled = enabled;
+
+    // Blocks freed while the hooks weren't installed could have been
+    // reused by now, so start over
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    forgetBlocks();
+#else
+    if (enabled) {
+        throw WrappyError("Wrappy: Memory tracking requires python 3.5 or later.");
+    }
+#endif
+}
+
+bool enabled()
+{
+    return s_Enabled;
+}
+
+std::vector<SiteMemory> snapshot()
+{
+    std::vector<SiteMemory> sites;
+    {
+        std::lock_guard<std::mutex> lock(s_Mutex);
+        for (const auto& entry : s_Sites) {
+            const Site& site = entry.second;
+            if (site.allocations || site.liveBlocks) {
+                sites.push_back(SiteMemory {entry.first, site.allocations, site.allocatedBytes,
+                    site.liveBlocks, site.liveBytes, site.liveObjects});
+            }
+        }
+    }
+
+    std::sort(sites.begin(), sites.end(), [](const SiteMemory& a, const SiteMemory& b) {
+        if (a.liveBytes != b.liveBytes) {
+            return a.liveBytes > b.liveBytes;
+        }
+        return a.allocatedBytes != b.allocatedBytes
+            ? a.allocatedBytes > b.allocatedBytes : a.name < b.name;
+    });
+    return sites;
+}
+
+void reset()
+{
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    for (auto& entry : s_Sites) {
+        entry.second.allocations = 0;
+        entry.second.allocatedBytes = 0;
+    }
+}
+
+std::string dumpText()
+{
+    std::ostringstream out;
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-40s %12s %14s %12s %14s %12s\n",
+        "call site", "allocations", "allocated", "live blocks", "live bytes", "live objects");
+    out << line;
+
+    for (const SiteMemory& site : snapshot()) {
+        std::snprintf(line, sizeof(line), "%-40s %12llu %14llu %12llu %14llu %12llu\n",
+            site.name.c_str(), site.allocations, site.allocatedBytes,
+            site.liveBlocks, site.liveBytes, site.liveObjects);
+        out << line;
+    }
+    return out.str();
+}
+
+Arena::Arena(bool collect)
+  : data_(new Data())
+  , previous_(t_Arena)
+  , collect_(collect)
+{
+    t_Arena = data_;
+}
+
+Arena::~Arena()
+{
+    t_Arena = previous_;
+
+    if (collect_) {
+        detail::AutoGil gil;
+        PyGC_Collect();
+    }
+
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    if (data_->stats.liveBlocks == 0) {
+        delete data_;
+    } else {
+        data_->closed = true;
+    }
+}
+
+ArenaStats Arena::stats() const
+{
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    return data_->stats;
+}
+
+void Arena::release()
+{
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+}
+
+} // end namespace memory
+
+namespace detail {
+
+MemoryScope::MemoryScope(const std::string* site)
+  : site_(site)
+  , resolved_(nullptr)
+  , previous_(nullptr)
+  , active_(s_Enabled.load(std::memory_order_relaxed))
+{
+    if (active_) {
+        previous_ = t_Scope;
+        t_Scope = this;
+    }
+}
+
+MemoryScope::~MemoryScope()
+{
+    if (active_) {
+        t_Scope = previous_;
+    }
+}
+
+MemoryScope::Site* MemoryScope::resolve()
+{
+    if (!resolved_ && !site_->empty()) {
+        std::lock_guard<std::mutex> lock(s_Mutex);
+        resolved_ = &s_Sites[*site_]; // value-initialized, i.e. all zero
+    }
+    return resolved_;
+}
+
+} // end namespace detail
+} // end namespace wrappy
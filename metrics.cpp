@@ -0,0 +1,229 @@
+#include <wrappy/metrics.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <mutex>
+#include <sstream>
+#include <unordered_map>
+
+namespace {
+
+using namespace wrappy;
+
+std::atomic<bool> s_Enabled(false);
+
+struct SiteData {
+    unsigned long long calls;
+    unsigned long long errors;
+    metrics::Histogram total;
+    std::array<metrics::Histogram, metrics::PhaseCount> phases;
+};
+
+std::mutex s_Mutex;
+std::unordered_map<std::string, SiteData> s_Sites;
+
+void add(metrics::Histogram& histogram, unsigned long long ns)
+{
+    ++histogram.count;
+    histogram.sumNs += ns;
+    histogram.maxNs = std::max(histogram.maxNs, ns);
+    ++histogram.buckets[metrics::Histogram::bucketOf(ns)];
+}
+
+const char* const s_PhaseNames[metrics::PhaseCount] = {
+    "lookup", "marshal", "execute", "unmarshal"
+};
+
+void writeJson(std::ostream& out, const metrics::Histogram& histogram)
+{
+    out << "{\"count\": " << histogram.count
+        << ", \"mean_ns\": " << histogram.meanNs()
+        << ", \"p50_ns\": " << histogram.percentileNs(0.5)
+        << ", \"p90_ns\": " << histogram.percentileNs(0.9)
+        << ", \"p99_ns\": " << histogram.percentileNs(0.99)
+        << ", \"max_ns\": " << histogram.maxNs << "}";
+}
+
+} // end unnamed namespace
+
+namespace wrappy {
+namespace metrics {
+
+size_t Histogram::bucketOf(unsigned long long ns)
+{
+    if (ns < 8) {
+        return ns;
+    }
+    size_t exponent = 63 - __builtin_clzll(ns);
+    size_t sub = (ns >> (exponent - 3)) & 7;
+    return (exponent - 2) * 8 + sub;
+}
+
+unsigned long long Histogram::lowerBound(size_t bucket)
+{
+    if (bucket < 16) {
+        return bucket;
+    }
+    size_t exponent = bucket / 8 + 2;
+    return (8ull + bucket % 8) << (exponent - 3);
+}
+
+double Histogram::meanNs() const
+{
+    return count ? double(sumNs) / count : 0.0;
+}
+
+unsigned long long Histogram::percentileNs(double p) const
+{
+    if (!count) {
+        return 0;
+    }
+    unsigned long long rank = static_cast<unsigned long long>(std::ceil(p * count));
+    rank = std::max(rank, 1ull);
+
+    unsigned long long seen = 0;
+    for (size_t i = 0; i < Buckets; ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            // The middle of the bucket, but never more than the maximum
+            unsigned long long low = lowerBound(i);
+            unsigned long long high = i + 1 < Buckets ? lowerBound(i + 1) : low;
+            return std::min(low + (high - low) / 2, maxNs);
+        }
+    }
+    return maxNs;
+}
+
+void setEnabled(bool enabled)
+{
+    s_Enabled = enabled;
+}
+
+bool enabled()
+{
+    return s_Enabled;
+}
+
+std::vector<CallSite> snapshot()
+{
+    std::vector<CallSite> sites;
+    {
+        std::lock_guard<std::mutex> lock(s_Mutex);
+        sites.reserve(s_Sites.size());
+        for (const auto& entry : s_Sites) {
+            sites.push_back(CallSite {entry.first, entry.second.calls,
+                entry.second.errors, entry.second.total, entry.second.phases});
+        }
+    }
+
+    std::sort(sites.begin(), sites.end(), [](const CallSite& a, const CallSite& b) {
+        return a.calls != b.calls ? a.calls > b.calls : a.name < b.name;
+    });
+    return sites;
+}
+
+void reset()
+{
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    s_Sites.clear();
+}
+
+std::string dumpText()
+{
+    std::ostringstream out;
+    char line[256];
+    std::snprintf(line, sizeof(line), "%-40s %10s %8s %10s %10s %10s %10s %10s %10s %10s\n",
+        "call site", "calls", "errors", "p50 ns", "p99 ns", "max ns",
+        "lookup", "marshal", "execute", "unmarshal");
+    out << line;
+
+    for (const CallSite& site : snapshot()) {
+        std::snprintf(line, sizeof(line),
+            "%-40s %10llu %8llu %10llu %10llu %10llu %10.0f %10.0f %10.0f %10.0f\n",
+            site.name.c_str(), site.calls, site.errors,
+            site.total.percentileNs(0.5), site.total.percentileNs(0.99), site.total.maxNs,
+            site.phases[Lookup].meanNs(), site.phases[Marshal].meanNs(),
+            site.phases[Execute].meanNs(), site.phases[Unmarshal].meanNs());
+        out << line;
+    }
+    return out.str();
+}
+
+std::string dumpJson()
+{
+    std::ostringstream out;
+    out << "{\"sites\": [";
+    bool first = true;
+    for (const CallSite& site : snapshot()) {
+        out << (first ? "\n" : ",\n");
+        first = false;
+        out << "  {\"name\": \"" << detail::escapeJson(site.name) << "\""
+            << ", \"calls\": " << site.calls
+            << ", \"errors\": " << site.errors
+            << ", \"total\": ";
+        writeJson(out, site.total);
+        for (size_t phase = 0; phase < PhaseCount; ++phase) {
+            out << ", \"" << s_PhaseNames[phase] << "\": ";
+            writeJson(out, site.phases[phase]);
+        }
+        out << "}";
+    }
+    out << "\n]}\n";
+    return out.str();
+}
+
+} // end namespace metrics
+
+namespace detail {
+
+std::string escapeJson(const std::string& str)
+{
+    std::string res;
+    for (char c : str) {
+        if (c == '"' || c == '\\') {
+            res += '\\';
+            res += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char buffer[8];
+            std::snprintf(buffer, sizeof(buffer), "\\u%04x", c);
+            res += buffer;
+        } else {
+            res += c;
+        }
+    }
+    return res;
+}
+
+unsigned long long metricsClock()
+{
+    if (!s_Enabled.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void recordCall(const std::string& site, const unsigned long long* phases, bool error)
+{
+    unsigned long long total = 0;
+    for (size_t phase = 0; phase < metrics::PhaseCount; ++phase) {
+        total += phases[phase];
+    }
+
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    SiteData& data = s_Sites[site]; // value-initialized, i.e. all zero
+    ++data.calls;
+    if (error) {
+        ++data.errors;
+    }
+    add(data.total, total);
+    for (size_t phase = 0; phase < metrics::PhaseCount; ++phase) {
+        add(data.phases[phase], phases[phase]);
+    }
+}
+
+} // end namespace detail
+} // end namespace wrappy
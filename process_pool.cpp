@@ -0,0 +1,1108 @@
+// Python header must be included first since they insist on
+// unconditionally defining some system macros
+// (http://bugs.python.org/issue1045893, still broken in python3.4)
+#include <Python.h>
+#include "python_compat.h"
+
+#include <wrappy/process_pool.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include <fcntl.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2,
+    "Wrappy: The rings in shared memory need lock-free 64 bit atomics.");
+
+namespace {
+
+using namespace wrappy;
+
+const char* const s_WorkerFlag = "--wrappy-worker";
+
+// Restarts of a worker in a row before it is given up
+const int s_StartAttempts = 5;
+
+// How long a call waits for space once every earlier call was answered,
+// i.e. when only views that the worker keeps alive hold the ring
+const std::chrono::milliseconds s_DrainTimeout(1000);
+
+// Pickling on both sides of the rings. Contiguous buffers are passed
+// out-of-band where pickle supports it, see ProcessPool.
+const char* const s_PickleCode = R"(
+try:
+    import cPickle as pickle
+except ImportError:
+    import pickle
+
+def dumps(obj):
+    buffers = []
+    if not hasattr(pickle, 'PickleBuffer'):
+        return pickle.dumps(obj, pickle.HIGHEST_PROTOCOL), buffers
+    def keep(buffer):
+        try:
+            buffers.append(buffer.raw())
+        except BufferError:
+            return True # not contiguous, pickled in-band
+        return False
+    return pickle.dumps(obj, 5, buffer_callback=keep), buffers
+
+def loads(data, buffers):
+    if buffers:
+        return pickle.loads(data, buffers=buffers)
+    return pickle.loads(data)
+
+def failure(exc, text):
+    try:
+        return dumps((exc, text))
+    except Exception:
+        return dumps((RuntimeError('%s: %s' % (type(exc).__name__, exc)), text))
+
+def release(views):
+    released = True
+    for view in views:
+        try:
+            view.release()
+        except BufferError:
+            released = False
+    return released
+)";
+
+//
+// Rings in shared memory
+//
+
+const uint64_t s_Align = 64;
+
+// Room for a few messages of half the ring, with their headers
+const uint64_t s_MinRingBytes = 64 * s_Align;
+
+uint64_t align(uint64_t size)
+{
+    return (size + s_Align - 1) & ~(s_Align - 1);
+}
+
+// A single producer, single consumer queue of messages. head and tail
+// count the bytes written and consumed since the start.
+struct Ring {
+    std::atomic<uint64_t> head;
+    char padHead[s_Align - sizeof(uint64_t)];
+    std::atomic<uint64_t> tail;
+    char padTail[s_Align - sizeof(uint64_t)];
+    sem_t items; // posted for every message
+    sem_t space; // posted whenever the consumer frees space
+};
+
+enum Kind : uint32_t {
+    Skip,   // padding up to the end of the ring
+    Call,   // pickled (function, args, kwargs)
+    Stop,
+    Result, // pickled result
+    Error,  // pickled (exception, formatted traceback)
+};
+
+// Followed by the sizes of the out-of-band buffers, the pickle, and the
+// buffers, each starting at a multiple of s_Align
+struct Message {
+    uint64_t size; // of everything, a multiple of s_Align
+    uint64_t id;
+    uint32_t kind;
+    uint32_t buffers;
+    uint64_t pickleSize;
+
+    const uint64_t* bufferSizes() const { return reinterpret_cast<const uint64_t*>(this + 1); }
+    const char* pickle() const { return reinterpret_cast<const char*>(bufferSizes() + buffers); }
+};
+
+struct Chunk {
+    const void* data;
+    size_t size;
+};
+
+uint64_t messageSize(const Chunk& pickle, const std::vector<Chunk>& buffers)
+{
+    uint64_t size = align(sizeof(Message) + buffers.size() * sizeof(uint64_t) + pickle.size);
+    for (const Chunk& buffer : buffers) {
+        size += align(buffer.size);
+    }
+    return size;
+}
+
+// The whole shared memory of one worker
+struct Segment {
+    uint64_t ringBytes; // a multiple of s_Align, so a Skip header always fits
+    sem_t ready; // the worker's interpreter runs
+    Ring requests;
+    Ring responses;
+};
+
+size_t segmentSize(size_t ringBytes)
+{
+    return align(sizeof(Segment)) + 2 * ringBytes;
+}
+
+void initRing(Ring* ring)
+{
+    new (&ring->head) std::atomic<uint64_t>(0);
+    new (&ring->tail) std::atomic<uint64_t>(0);
+    sem_init(&ring->items, 1, 0);
+    sem_init(&ring->space, 1, 0);
+}
+
+void destroyRing(Ring* ring)
+{
+    sem_destroy(&ring->items);
+    sem_destroy(&ring->space);
+}
+
+// Returns false on timeout
+bool waitFor(sem_t* sem, std::chrono::milliseconds timeout)
+{
+    timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    long long ns = deadline.tv_nsec + timeout.count() * 1000000ll;
+    deadline.tv_sec += ns / 1000000000ll;
+    deadline.tv_nsec = ns % 1000000000ll;
+
+    while (sem_timedwait(sem, &deadline) < 0) {
+        if (errno != EINTR) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// One end of a ring. The consumer reads ahead of the tail, and frees the
+// messages in order once they are no longer needed.
+class RingEnd {
+public:
+    RingEnd() : ring_(nullptr), data_(nullptr), capacity_(0), cursor_(0) { }
+
+    RingEnd(Ring* ring, char* data, uint64_t capacity)
+      : ring_(ring)
+      , data_(data)
+      , capacity_(capacity)
+      , cursor_(ring->tail.load())
+    { }
+
+    uint64_t capacity() const { return capacity_; }
+
+    // Waits for space as long as keepWaiting() returns true, and returns
+    // false if it gave up
+    template<typename KeepWaiting>
+    bool write(uint64_t id, uint32_t kind, const Chunk& pickle,
+        const std::vector<Chunk>& buffers, KeepWaiting keepWaiting)
+    {
+        uint64_t size = messageSize(pickle, buffers);
+        uint64_t head = ring_->head.load(std::memory_order_relaxed);
+        uint64_t contiguous = capacity_ - head % capacity_;
+        uint64_t needed = size + (contiguous < size ? contiguous : 0);
+
+        while (capacity_ - (head - ring_->tail.load(std::memory_order_acquire)) < needed) {
+            if (!keepWaiting()) {
+                return false;
+            }
+            waitFor(&ring_->space, std::chrono::milliseconds(50));
+        }
+
+        if (contiguous < size) {
+            Message* skip = at(head);
+            skip->size = contiguous;
+            skip->kind = Skip;
+            head += contiguous;
+        }
+
+        Message* message = at(head);
+        message->size = size;
+        message->id = id;
+        message->kind = kind;
+        message->buffers = buffers.size();
+        message->pickleSize = pickle.size;
+
+        uint64_t* sizes = reinterpret_cast<uint64_t*>(message + 1);
+        if (pickle.size) {
+            std::memcpy(sizes + buffers.size(), pickle.data, pickle.size);
+        }
+        char* dst = reinterpret_cast<char*>(message)
+            + align(sizeof(Message) + buffers.size() * sizeof(uint64_t) + pickle.size);
+        for (size_t i = 0; i < buffers.size(); ++i) {
+            sizes[i] = buffers[i].size;
+            std::memcpy(dst, buffers[i].data, buffers[i].size);
+            dst += align(buffers[i].size);
+        }
+
+        ring_->head.store(head + size, std::memory_order_release);
+        sem_post(&ring_->items);
+        return true;
+    }
+
+    // The next message, or nullptr if none arrived within the timeout
+    const Message* read(std::chrono::milliseconds timeout)
+    {
+        if (!waitFor(&ring_->items, timeout)) {
+            return nullptr;
+        }
+
+        // Every post belongs to a message that is already written
+        const Message* message = at(cursor_);
+        if (message->kind == Skip) {
+            cursor_ += message->size;
+            message = at(cursor_);
+        }
+        cursor_ += message->size;
+        ends_.push_back(cursor_);
+        return message;
+    }
+
+    // The start of the out-of-band buffers of a message
+    static const char* buffers(const Message* message)
+    {
+        return reinterpret_cast<const char*>(message)
+            + align(sizeof(Message) + message->buffers * sizeof(uint64_t) + message->pickleSize);
+    }
+
+    // Frees the oldest message that was read, including the padding before it
+    void releaseOldest()
+    {
+        ring_->tail.store(ends_.front(), std::memory_order_release);
+        ends_.pop_front();
+        sem_post(&ring_->space);
+    }
+
+private:
+    Message* at(uint64_t position) const
+    {
+        return reinterpret_cast<Message*>(data_ + position % capacity_);
+    }
+
+    Ring* ring_;
+    char* data_;
+    uint64_t capacity_;
+    uint64_t cursor_; // consumer only
+    std::deque<uint64_t> ends_; // of the messages read and not released yet
+};
+
+// Shared memory mapping of one Segment
+class SharedSegment {
+public:
+    explicit SharedSegment(size_t ringBytes)
+      : fd_(-1)
+      , size_(segmentSize(align(ringBytes)))
+      , segment_(nullptr)
+    {
+        // The name only exists until the worker inherited the descriptor
+        static std::atomic<unsigned> counter(0);
+        std::string name = "/wrappy-" + std::to_string(getpid()) + "-" + std::to_string(counter++);
+        fd_ = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+        if (fd_ < 0) {
+            throw WrappyError("Wrappy: Couldn't create shared memory: " + std::string(strerror(errno)));
+        }
+        shm_unlink(name.c_str());
+
+        if (ftruncate(fd_, size_) < 0 || !map()) {
+            close(fd_);
+            throw WrappyError("Wrappy: Couldn't map shared memory: " + std::string(strerror(errno)));
+        }
+        segment_->ringBytes = align(ringBytes);
+        sem_init(&segment_->ready, 1, 0);
+        initRing(&segment_->requests);
+        initRing(&segment_->responses);
+    }
+
+    // The worker's side, with the inherited descriptor
+    SharedSegment(int fd, size_t ringBytes)
+      : fd_(fd)
+      , size_(segmentSize(align(ringBytes)))
+      , segment_(nullptr)
+    {
+        if (!map() || segment_->ringBytes != align(ringBytes)) {
+            throw WrappyError("Wrappy: Couldn't map shared memory of the pool.");
+        }
+    }
+
+    ~SharedSegment()
+    {
+        munmap(segment_, size_);
+        close(fd_);
+    }
+
+    SharedSegment(const SharedSegment&) = delete;
+    SharedSegment& operator=(const SharedSegment&) = delete;
+
+    // Back to the initial state, after the worker died
+    void reset()
+    {
+        destroyRing(&segment_->requests);
+        destroyRing(&segment_->responses);
+        sem_destroy(&segment_->ready);
+        sem_init(&segment_->ready, 1, 0);
+        initRing(&segment_->requests);
+        initRing(&segment_->responses);
+    }
+
+    int fd() const { return fd_; }
+    Segment* get() const { return segment_; }
+
+    RingEnd requests() const { return RingEnd(&segment_->requests, data(), segment_->ringBytes); }
+    RingEnd responses() const
+    {
+        return RingEnd(&segment_->responses, data() + segment_->ringBytes, segment_->ringBytes);
+    }
+
+private:
+    bool map()
+    {
+        void* mem = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+        if (mem == MAP_FAILED) {
+            return false;
+        }
+        segment_ = static_cast<Segment*>(mem);
+        return true;
+    }
+
+    char* data() const { return reinterpret_cast<char*>(segment_) + align(sizeof(Segment)); }
+
+    int fd_;
+    size_t size_;
+    Segment* segment_;
+};
+
+// A pickled message, with the views of its memory. Needs the GIL for
+// everything but reading the chunks.
+class Pickled {
+public:
+    // dumped is the (bytes, buffers) tuple returned by dumps()
+    explicit Pickled(PythonObject dumped)
+      : dumped_(std::move(dumped))
+    {
+        PyObject* data = PyTuple_GetItem(dumped_.get(), 0);
+        PyObject* buffers = PyTuple_GetItem(dumped_.get(), 1);
+        if (!data || !buffers) {
+            detail::throwPythonError("Wrappy: Couldn't pickle message.");
+        }
+
+        views_.reserve(1 + PyList_Size(buffers));
+        view(data);
+        for (Py_ssize_t i = 0; i < PyList_Size(buffers); ++i) {
+            view(PyList_GET_ITEM(buffers, i));
+        }
+    }
+
+    ~Pickled()
+    {
+        for (Py_buffer& view : views_) {
+            PyBuffer_Release(&view);
+        }
+    }
+
+    Pickled(const Pickled&) = delete;
+    Pickled& operator=(const Pickled&) = delete;
+
+    Chunk pickle() const { return Chunk {views_[0].buf, size_t(views_[0].len)}; }
+
+    std::vector<Chunk> buffers() const
+    {
+        std::vector<Chunk> res;
+        for (size_t i = 1; i < views_.size(); ++i) {
+            res.push_back(Chunk {views_[i].buf, size_t(views_[i].len)});
+        }
+        return res;
+    }
+
+private:
+    void view(PyObject* obj)
+    {
+        views_.emplace_back();
+        if (PyObject_GetBuffer(obj, &views_.back(), PyBUF_SIMPLE) < 0) {
+            views_.pop_back();
+            detail::throwPythonError("Wrappy: Couldn't pickle message.");
+        }
+    }
+
+    PythonObject dumped_;
+    std::vector<Py_buffer> views_;
+};
+
+PythonObject checked(PyObject* obj, const char* context)
+{
+    if (!obj) {
+        detail::throwPythonError(context);
+    }
+    return PythonObject(PythonObject::owning {}, obj);
+}
+
+PythonObject pickleCode()
+{
+    return exec(s_PickleCode);
+}
+
+PythonObject function(const PythonObject& code, const char* name)
+{
+    PyObject* obj = PyDict_GetItemString(code.get(), name);
+    if (!obj) {
+        throw WrappyError("Wrappy: Couldn't set up pickling.");
+    }
+    return PythonObject(PythonObject::borrowed {}, obj);
+}
+
+std::string describeExit(int status)
+{
+    if (WIFSIGNALED(status)) {
+        return "was killed by signal " + std::to_string(WTERMSIG(status));
+    }
+    return "exited with status " + std::to_string(WEXITSTATUS(status));
+}
+
+} // end unnamed namespace
+
+namespace wrappy {
+
+// One worker process, with the thread that reads its responses and
+// restarts it when it dies. Workers are started on that thread, since
+// PR_SET_PDEATHSIG fires when the thread that forked exits.
+class ProcessPool::Worker {
+public:
+    Worker(const ProcessPool& pool, const Options& options)
+      : pool_(pool)
+      , options_(options)
+      , segment_(options.ringBytes)
+      , requests_(segment_.requests())
+      , responses_(segment_.responses())
+      , pid_(-1)
+      , alive_(false)
+      , stopping_(false)
+      , timedOut_(false)
+      , restarts_(0)
+      , nextId_(0)
+    {
+        std::promise<void> started;
+        std::future<void> result = started.get_future();
+        thread_ = std::thread([this, &started]() { main(started); });
+        try {
+            result.get();
+        } catch (...) {
+            thread_.join();
+            throw;
+        }
+    }
+
+    ~Worker()
+    {
+        requestStop();
+        thread_.join();
+    }
+
+    // Writes a call to the worker, the GIL must not be held
+    void send(const Pickled& pickled, Completion complete)
+    {
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        if (messageSize(pickled.pickle(), pickled.buffers()) > requests_.capacity() / 2) {
+            throw WrappyError("Wrappy: Call is too large for the ring of the ProcessPool, "
+                "increase Options::ringBytes.");
+        }
+        if (!alive_) {
+            throw WrappyError(failure_.empty() ? "Wrappy: Worker process isn't running." : failure_);
+        }
+
+        uint64_t id = nextId_++;
+        {
+            std::lock_guard<std::mutex> pendingLock(pendingMutex_);
+            pending_[id] = Pending {std::move(complete), std::chrono::steady_clock::now()};
+        }
+
+        // Gives up if the worker dies, the restart fails the call
+        std::chrono::steady_clock::time_point drained;
+        bool written = requests_.write(id, Call, pickled.pickle(), pickled.buffers(),
+            [this, id, &drained]() {
+                if (!alive_) {
+                    return false;
+                }
+                if (oldestPending() != id) {
+                    drained = std::chrono::steady_clock::time_point();
+                    return true;
+                }
+                auto now = std::chrono::steady_clock::now();
+                if (drained == std::chrono::steady_clock::time_point()) {
+                    drained = now;
+                }
+                return now - drained < s_DrainTimeout;
+            });
+        if (!written && alive_) {
+            std::lock_guard<std::mutex> pendingLock(pendingMutex_);
+            if (pending_.erase(id)) {
+                throw WrappyError("Wrappy: The ring of the ProcessPool is held by buffers that the "
+                    "worker keeps alive, increase Options::ringBytes or release them.");
+            }
+        }
+    }
+
+    // Sends Stop once all calls before it are answered. The worker exits
+    // after answering them, and the thread after failing anything left.
+    void requestStop()
+    {
+        if (stopping_.exchange(true)) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(writeMutex_);
+        if (alive_) {
+            requests_.write(nextId_++, Stop, Chunk {nullptr, 0}, std::vector<Chunk>(),
+                [this]() { return alive_.load(); });
+        }
+    }
+
+    size_t pending() const
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        return pending_.size();
+    }
+
+    WorkerStats stats() const
+    {
+        return WorkerStats {pid_.load(), pending(), restarts_.load()};
+    }
+
+private:
+    // The id of the oldest call that wasn't answered, or -1
+    uint64_t oldestPending() const
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex_);
+        return pending_.empty() ? uint64_t(-1) : pending_.begin()->first;
+    }
+
+    struct Pending {
+        Completion complete;
+        std::chrono::steady_clock::time_point sent;
+    };
+
+    void main(std::promise<void>& started)
+    {
+        try {
+            start();
+        } catch (...) {
+            started.set_exception(std::current_exception());
+            return;
+        }
+        started.set_value();
+
+        while (pid_ > 0) {
+            const Message* message = responses_.read(std::chrono::milliseconds(50));
+            if (message) {
+                complete(message);
+                responses_.releaseOldest();
+            } else {
+                supervise();
+            }
+        }
+        std::string reason;
+        {
+            std::lock_guard<std::mutex> lock(writeMutex_);
+            reason = failure_.empty() ? "Wrappy: ProcessPool was destroyed." : failure_;
+        }
+        failAll(reason);
+    }
+
+    void spawn()
+    {
+        // Everything is prepared before fork(), the child may only call
+        // async-signal-safe functions until exec
+        std::vector<std::string> strings;
+        const char* path = std::getenv("WRAPPY_WORKER");
+        strings.push_back(!options_.workerPath.empty() ? options_.workerPath
+            : path ? path : "wrappy_worker");
+        strings.push_back(s_WorkerFlag);
+        strings.push_back(std::to_string(segment_.fd()));
+        strings.push_back(std::to_string(options_.ringBytes));
+        strings.push_back(std::to_string(getpid()));
+        strings.insert(strings.end(), options_.searchPaths.begin(), options_.searchPaths.end());
+
+        std::vector<char*> argv;
+        for (std::string& s : strings) {
+            argv.push_back(&s[0]);
+        }
+        argv.push_back(nullptr);
+
+        pid_t parent = getpid();
+        pid_t pid = fork();
+        if (pid < 0) {
+            throw WrappyError("Wrappy: Couldn't start worker process: " + std::string(strerror(errno)));
+        }
+        if (pid == 0) {
+#ifdef __linux__
+            prctl(PR_SET_PDEATHSIG, SIGKILL);
+#endif
+            if (getppid() != parent) {
+                _exit(1);
+            }
+            int flags = fcntl(segment_.fd(), F_GETFD);
+            fcntl(segment_.fd(), F_SETFD, flags & ~FD_CLOEXEC);
+            execvp(argv[0], argv.data());
+            _exit(127);
+        }
+        pid_ = pid;
+        workerPath_ = strings[0];
+    }
+
+    // Spawns the worker and waits until its interpreter runs
+    void start()
+    {
+        spawn();
+
+        auto deadline = std::chrono::steady_clock::now() + options_.startTimeout;
+        while (!waitFor(&segment_.get()->ready, std::chrono::milliseconds(50))) {
+            int status;
+            if (waitpid(pid_, &status, WNOHANG) == pid_) {
+                pid_ = -1;
+                throw WrappyError("Wrappy: Worker process " + workerPath_ + " "
+                    + describeExit(status) + " during startup.");
+            }
+            if (std::chrono::steady_clock::now() > deadline) {
+                kill(pid_, SIGKILL);
+                waitpid(pid_, nullptr, 0);
+                pid_ = -1;
+                throw WrappyError("Wrappy: Worker process " + workerPath_ + " didn't start in time.");
+            }
+        }
+        alive_ = true;
+    }
+
+    // Reaps a worker that exited, and kills one that is stuck in a call
+    void supervise()
+    {
+        int status;
+        if (waitpid(pid_, &status, WNOHANG) == pid_) {
+            if (stopping_) {
+                alive_ = false;
+                pid_ = -1;
+                return;
+            }
+            restart(timedOut_
+                ? "Wrappy: Call timed out, the worker process was restarted."
+                : "Wrappy: Worker process " + describeExit(status) + ", it was restarted.");
+            return;
+        }
+
+        if (options_.callTimeout.count() > 0 && !timedOut_) {
+            // Queued calls only start once the previous one is answered
+            std::lock_guard<std::mutex> lock(pendingMutex_);
+            if (!pending_.empty()) {
+                auto started = std::max(pending_.begin()->second.sent, lastResponse_);
+                if (std::chrono::steady_clock::now() - started > options_.callTimeout) {
+                    timedOut_ = true;
+                    kill(pid_, SIGKILL);
+                }
+            }
+        }
+    }
+
+    // Holds writeMutex_ while the worker starts, so that calls made right
+    // after a crash wait for it. Between attempts it is released, and
+    // calls fail right away.
+    void restart(const std::string& reason)
+    {
+        alive_ = false; // writers waiting for space give up
+        std::unique_lock<std::mutex> lock(writeMutex_);
+        pid_ = -1;
+        timedOut_ = false;
+        failAll(reason);
+
+        std::string error;
+        for (int attempt = 0; attempt < s_StartAttempts && !stopping_; ++attempt) {
+            if (attempt > 0) {
+                lock.unlock();
+                std::this_thread::sleep_for(std::chrono::milliseconds(100 << attempt));
+                lock.lock();
+            }
+            segment_.reset();
+            requests_ = segment_.requests();
+            responses_ = segment_.responses();
+            ++restarts_;
+            try {
+                start();
+                return;
+            } catch (const WrappyError& e) {
+                error = e.what();
+            }
+        }
+
+        // pid_ stays -1, the thread fails what is left and exits
+        if (!stopping_) {
+            failure_ = "Wrappy: Worker process couldn't be restarted. " + error;
+        }
+    }
+
+    void failAll(const std::string& reason)
+    {
+        std::map<uint64_t, Pending> failed;
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex_);
+            failed.swap(pending_);
+        }
+        for (auto& entry : failed) {
+            entry.second.complete(nullptr, std::make_exception_ptr(WrappyError(reason)));
+        }
+        if (!failed.empty()) {
+            detail::AutoGil gil;
+            failed.clear(); // the completions may hold python objects
+        }
+    }
+
+    void complete(const Message* message)
+    {
+        Pending pending;
+        {
+            std::lock_guard<std::mutex> lock(pendingMutex_);
+            lastResponse_ = std::chrono::steady_clock::now();
+            auto it = pending_.find(message->id);
+            if (it == pending_.end()) {
+                return;
+            }
+            pending = std::move(it->second);
+            pending_.erase(it);
+        }
+
+        detail::AutoGil gil;
+        try {
+            PythonObject value = unpickle(message);
+            if (message->kind == Result) {
+                pending.complete(&value, nullptr);
+            } else {
+                raise(value);
+            }
+        } catch (...) {
+            pending.complete(nullptr, std::current_exception());
+        }
+        pending.complete = nullptr;
+    }
+
+    // Results are copied out of the ring, so that it can be reused right away
+    PythonObject unpickle(const Message* message)
+    {
+        PythonObject data = checked(PyBytes_FromStringAndSize(message->pickle(), message->pickleSize),
+            "Wrappy: Couldn't unpickle result.");
+        PythonObject buffers = checked(PyList_New(message->buffers), "Wrappy: Couldn't unpickle result.");
+        const char* buffer = RingEnd::buffers(message);
+        for (uint32_t i = 0; i < message->buffers; ++i) {
+            uint64_t size = message->bufferSizes()[i];
+            PyObject* copy = PyByteArray_FromStringAndSize(buffer, size);
+            if (!copy) {
+                detail::throwPythonError("Wrappy: Couldn't unpickle result.");
+            }
+            PyList_SET_ITEM(buffers.get(), i, copy);
+            buffer += align(size);
+        }
+        return checked(PyObject_CallFunctionObjArgs(pool_.loads_.get(), data.get(), buffers.get(), nullptr),
+            "Wrappy: Couldn't unpickle result.");
+    }
+
+    // Raises the (exception, traceback text) of the worker as PythonError
+    void raise(const PythonObject& failure)
+    {
+        PyObject* exc = PyTuple_GetItem(failure.get(), 0);
+        PyObject* text = PyTuple_GetItem(failure.get(), 1);
+        if (!exc || !text) {
+            detail::throwPythonError("Wrappy: Couldn't unpickle exception.");
+        }
+        std::string context = "Wrappy: Exception in worker process " + std::to_string(pid_.load());
+        const char* str;
+        Py_ssize_t size;
+        if (compat::asStringAndSize(text, &str, &size) == 0) {
+            context += ":\n" + std::string(str, size);
+        }
+        PyErr_SetObject(reinterpret_cast<PyObject*>(Py_TYPE(exc)), exc);
+        detail::throwPythonError(context);
+    }
+
+    const ProcessPool& pool_;
+    Options options_;
+    SharedSegment segment_;
+    RingEnd requests_;  // writeMutex_
+    RingEnd responses_; // thread_ only
+    std::string workerPath_;
+    std::atomic<pid_t> pid_;
+    std::atomic<bool> alive_;
+    std::atomic<bool> stopping_;
+    bool timedOut_; // thread_ only
+    std::atomic<size_t> restarts_;
+    uint64_t nextId_; // writeMutex_
+    std::string failure_; // writeMutex_, why the worker was given up
+    std::mutex writeMutex_;
+
+    mutable std::mutex pendingMutex_;
+    std::map<uint64_t, Pending> pending_;
+    std::chrono::steady_clock::time_point lastResponse_;
+
+    std::thread thread_;
+};
+
+ProcessPool::ProcessPool(const Options& options)
+{
+    if (!threadsEnabled()) {
+        throw WrappyError("Wrappy: ProcessPool requires enableThreads().");
+    }
+    if (options.workers == 0) {
+        throw WrappyError("Wrappy: ProcessPool needs at least one worker.");
+    }
+    if (options.ringBytes < s_MinRingBytes) {
+        throw WrappyError("Wrappy: Options::ringBytes of the ProcessPool must be at least "
+            + std::to_string(s_MinRingBytes) + ".");
+    }
+    {
+        detail::AutoGil gil;
+        PythonObject code = pickleCode();
+        dumps_ = function(code, "dumps");
+        loads_ = function(code, "loads");
+    }
+
+    for (size_t i = 0; i < options.workers; ++i) {
+        workers_.emplace_back(new Worker(*this, options));
+    }
+}
+
+ProcessPool::~ProcessPool()
+{
+    for (auto& worker : workers_) {
+        worker->requestStop();
+    }
+    workers_.clear();
+}
+
+size_t ProcessPool::size() const
+{
+    return workers_.size();
+}
+
+std::future<PythonObject> ProcessPool::callWithArgs(
+    const std::string& function,
+    const std::vector<PythonObject>& args,
+    const std::vector<std::pair<std::string, PythonObject>>& kwargs)
+{
+    auto promise = std::make_shared<std::promise<PythonObject>>();
+    std::future<PythonObject> result = promise->get_future();
+    submit(leastLoaded(), function, args, kwargs, completion(promise));
+    return result;
+}
+
+void ProcessPool::submit(size_t worker, const std::string& function,
+    const std::vector<PythonObject>& args,
+    const std::vector<std::pair<std::string, PythonObject>>& kwargs,
+    Completion complete)
+{
+    if (worker >= workers_.size()) {
+        throw WrappyError("Wrappy: No such worker in ProcessPool.");
+    }
+
+    std::unique_ptr<Pickled> pickled;
+    {
+        detail::AutoGil gil;
+        PythonObject tuple = checked(PyTuple_New(args.size()), "Wrappy: Couldn't create python tuple.");
+        for (size_t i = 0; i < args.size(); ++i) {
+            PyObject* arg = args[i].get();
+            Py_INCREF(arg);
+            PyTuple_SET_ITEM(tuple.get(), i, arg);
+        }
+        PythonObject dict = checked(PyDict_New(), "Wrappy: Couldn't create python dict.");
+        for (const auto& kwarg : kwargs) {
+            if (PyDict_SetItemString(dict.get(), kwarg.first.c_str(), kwarg.second.get()) < 0) {
+                detail::throwPythonError("Wrappy: Couldn't create python dict.");
+            }
+        }
+        PythonObject request = checked(Py_BuildValue("(sOO)", function.c_str(), tuple.get(), dict.get()),
+            "Wrappy: Couldn't create python tuple.");
+        pickled.reset(new Pickled(checked(
+            PyObject_CallFunctionObjArgs(dumps_.get(), request.get(), nullptr),
+            "Wrappy: Couldn't pickle call.")));
+    }
+
+    // The views of the pickle stay valid without the GIL, nothing else
+    // refers to the objects
+    try {
+        workers_[worker]->send(*pickled, std::move(complete));
+    } catch (...) {
+        detail::AutoGil gil;
+        pickled.reset();
+        throw;
+    }
+    detail::AutoGil gil;
+    pickled.reset();
+}
+
+size_t ProcessPool::leastLoaded() const
+{
+    size_t best = 0;
+    size_t fewest = workers_[0]->pending();
+    for (size_t i = 1; i < workers_.size() && fewest > 0; ++i) {
+        size_t pending = workers_[i]->pending();
+        if (pending < fewest) {
+            best = i;
+            fewest = pending;
+        }
+    }
+    return best;
+}
+
+std::vector<ProcessPool::WorkerStats> ProcessPool::stats() const
+{
+    std::vector<WorkerStats> res;
+    for (const auto& worker : workers_) {
+        res.push_back(worker->stats());
+    }
+    return res;
+}
+
+bool ProcessPool::isWorkerCommand(int argc, char** argv)
+{
+    return argc > 1 && std::strcmp(argv[1], s_WorkerFlag) == 0;
+}
+
+} // end namespace wrappy
+
+namespace {
+
+// Read-only views of the out-of-band buffers in the ring
+PythonObject bufferViews(const Message* message)
+{
+    PythonObject views = checked(PyList_New(message->buffers), "Wrappy: Couldn't create python list.");
+    const char* buffer = RingEnd::buffers(message);
+    for (uint32_t i = 0; i < message->buffers; ++i) {
+        uint64_t size = message->bufferSizes()[i];
+#if PY_VERSION_HEX >= 0x03030000
+        PyObject* view = PyMemoryView_FromMemory(const_cast<char*>(buffer), size, PyBUF_READ);
+#else
+        PyObject* view = PyBuffer_FromMemory(const_cast<char*>(buffer), size);
+#endif
+        if (!view) {
+            detail::throwPythonError("Wrappy: Couldn't create python memoryview.");
+        }
+        PyList_SET_ITEM(views.get(), i, view);
+        buffer += align(size);
+    }
+    return views;
+}
+
+PythonObject failure(const PythonObject& code, const PythonObject& value, const char* text)
+{
+    PythonObject str(PythonObject::owning {}, compat::fromString(text));
+    return checked(PyObject_CallFunctionObjArgs(function(code, "failure").get(),
+        value.get(), str.get(), nullptr), "Wrappy: Couldn't pickle exception.");
+}
+
+// Runs one call, and returns the pickled result or exception
+PythonObject answer(const PythonObject& code, const Message* message, const PythonObject& views,
+    uint32_t* kind)
+{
+    PythonObject dumps = function(code, "dumps");
+    try {
+        PythonObject data = checked(PyBytes_FromStringAndSize(message->pickle(), message->pickleSize),
+            "Wrappy: Couldn't unpickle call.");
+        PythonObject request = checked(PyObject_CallFunctionObjArgs(function(code, "loads").get(),
+            data.get(), views.get(), nullptr), "Wrappy: Couldn't unpickle call.");
+
+        const char* name;
+        PyObject* args;
+        PyObject* kwargs;
+        if (!PyArg_ParseTuple(request.get(), "sOO", &name, &args, &kwargs)) {
+            detail::throwPythonError("Wrappy: Couldn't unpickle call.");
+        }
+        PythonObject result = checked(PyObject_Call(load(name).get(), args, kwargs),
+            "Wrappy: Exception in worker process.");
+        *kind = Result;
+        return checked(PyObject_CallFunctionObjArgs(dumps.get(), result.get(), nullptr),
+            "Wrappy: Couldn't pickle result.");
+    } catch (const PythonError& e) {
+        *kind = Error;
+        return failure(code, e.value() ? e.value() : call("RuntimeError", e.what()), e.what());
+    } catch (const std::exception& e) {
+        *kind = Error;
+        return failure(code, call("RuntimeError", e.what()), e.what());
+    }
+}
+
+int serve(SharedSegment& segment, pid_t parent)
+{
+    PythonObject code = pickleCode();
+    PythonObject release = function(code, "release");
+    RingEnd requests = segment.requests();
+    RingEnd responses = segment.responses();
+    sem_post(&segment.get()->ready);
+
+    // Calls answered, in order, with the views that may still use their
+    // part of the ring
+    std::deque<PythonObject> done;
+    for (;;) {
+        while (!done.empty()) {
+            PythonObject released = checked(PyObject_CallFunctionObjArgs(release.get(),
+                done.front().get(), nullptr), "Wrappy: Couldn't release buffers.");
+            if (!PyObject_IsTrue(released.get())) {
+                break;
+            }
+            done.pop_front();
+            requests.releaseOldest();
+        }
+
+        const Message* message = requests.read(std::chrono::milliseconds(done.empty() ? 1000 : 100));
+        if (!message) {
+            if (getppid() != parent) {
+                return 1;
+            }
+            continue;
+        }
+        if (message->kind == Stop) {
+            return 0;
+        }
+
+        PythonObject views = bufferViews(message);
+        uint32_t kind;
+        std::unique_ptr<Pickled> pickled(new Pickled(answer(code, message, views, &kind)));
+        if (messageSize(pickled->pickle(), pickled->buffers()) > responses.capacity() / 2) {
+            const char* text = "Wrappy: Result is too large for the ring of the ProcessPool, "
+                "increase Options::ringBytes.";
+            kind = Error;
+            pickled.reset(new Pickled(failure(code, call("RuntimeError", text), text)));
+        }
+        responses.write(message->id, kind, pickled->pickle(), pickled->buffers(),
+            [parent]() { return getppid() == parent; });
+        done.push_back(views);
+    }
+}
+
+} // end unnamed namespace
+
+namespace wrappy {
+
+int ProcessPool::workerMain(int argc, char** argv)
+{
+    if (!isWorkerCommand(argc, argv) || argc < 5) {
+        std::fprintf(stderr, "wrappy_worker: Must be started by a wrappy::ProcessPool.\n");
+        return 2;
+    }
+
+    try {
+        SharedSegment segment(std::atoi(argv[2]), std::strtoull(argv[3], nullptr, 10));
+        Config config;
+        config.searchPaths.assign(argv + 5, argv + argc);
+        initialize(config);
+        return serve(segment, std::atoi(argv[4]));
+    } catch (const std::exception& e) {
+        std::fprintf(stderr, "wrappy_worker: %s\n", e.what());
+        return 1;
+    }
+}
+
+} // end namespace wrappy
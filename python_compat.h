@@ -0,0 +1,162 @@
+#pragma once
+
+// Differences between the python 2 and python 3 C API, for the library
+// sources only. Must be included after Python.h.
+
+#if PY_MAJOR_VERSION >= 3
+#define WRAPPY_PYTHON3
+#endif
+
+// PyObject_Vectorcall() became public in python 3.9
+#if PY_VERSION_HEX >= 0x03090000
+#define WRAPPY_VECTORCALL
+#endif
+
+// PyMemAllocatorEx, with calloc, appeared in python 3.5
+#if PY_VERSION_HEX >= 0x03050000
+#define WRAPPY_ALLOCATOR_HOOKS
+#endif
+
+// METH_FASTCALL | METH_KEYWORDS became stable in python 3.7
+#if PY_VERSION_HEX >= 0x03070000
+#define WRAPPY_FASTCALL
+#endif
+
+// From python 3.12 on, sub-interpreters can have their own GIL and must
+// not share static types. wrappy's types are heap types per interpreter.
+#if PY_VERSION_HEX >= 0x030C0000
+#define WRAPPY_HEAP_TYPES
+#endif
+
+#include <cstring>
+
+namespace wrappy {
+namespace compat {
+
+// A static type object with only the object header set, for the tp_* fields
+// to be filled in before PyType_Ready(). Unlike a partial aggregate
+// initializer, this doesn't trip -Wmissing-field-initializers.
+inline PyTypeObject staticType()
+{
+    PyTypeObject type;
+    std::memset(&type, 0, sizeof(type));
+    PyVarObject head = { PyObject_HEAD_INIT(nullptr) 0 };
+    std::memcpy(&type, &head, sizeof(head));
+    return type;
+}
+
+// Whether the weak reference ref still refers to obj.
+// PyWeakref_GetObject() is deprecated from python 3.13 on.
+inline bool refersTo(PyObject* ref, PyObject* obj)
+{
+#if PY_VERSION_HEX >= 0x030D0000
+    PyObject* target = nullptr;
+    if (PyWeakref_GetRef(ref, &target) < 0) {
+        PyErr_Clear();
+        return false;
+    }
+    Py_XDECREF(target);
+    return target == obj;
+#else
+    return PyWeakref_GetObject(ref) == obj;
+#endif
+}
+
+#ifdef WRAPPY_PYTHON3
+
+inline PyObject* fromLong(long value)
+{
+    return PyLong_FromLong(value);
+}
+
+inline PyObject* fromString(const char* str)
+{
+    return PyUnicode_FromString(str);
+}
+
+inline PyObject* fromString(const char* str, size_t size)
+{
+    return PyUnicode_FromStringAndSize(str, size);
+}
+
+// The UTF-8 representation is cached in the str object
+inline const char* asString(PyObject* obj)
+{
+    return PyUnicode_AsUTF8(obj);
+}
+
+inline PyObject* internString(const char* str, size_t size)
+{
+    PyObject* res = PyUnicode_FromStringAndSize(str, size);
+    if (res) {
+        PyUnicode_InternInPlace(&res);
+    }
+    return res;
+}
+
+inline PyObject* evalCode(PyObject* code, PyObject* globals, PyObject* locals)
+{
+    return PyEval_EvalCode(code, globals, locals);
+}
+
+// Accepts str and bytes
+inline int asStringAndSize(PyObject* obj, const char** buffer, Py_ssize_t* size)
+{
+    if (PyBytes_Check(obj)) {
+        char* bytes;
+        int res = PyBytes_AsStringAndSize(obj, &bytes, size);
+        *buffer = bytes;
+        return res;
+    }
+    *buffer = PyUnicode_AsUTF8AndSize(obj, size);
+    return *buffer ? 0 : -1;
+}
+
+#else
+
+inline PyObject* fromLong(long value)
+{
+    return PyInt_FromLong(value);
+}
+
+inline PyObject* fromString(const char* str)
+{
+    return PyString_FromString(str);
+}
+
+inline PyObject* fromString(const char* str, size_t size)
+{
+    return PyString_FromStringAndSize(str, size);
+}
+
+inline const char* asString(PyObject* obj)
+{
+    return PyString_AsString(obj);
+}
+
+inline PyObject* internString(const char* str, size_t size)
+{
+    PyObject* res = PyString_FromStringAndSize(str, size);
+    if (res) {
+        PyString_InternInPlace(&res);
+    }
+    return res;
+}
+
+inline PyObject* evalCode(PyObject* code, PyObject* globals, PyObject* locals)
+{
+    return PyEval_EvalCode(reinterpret_cast<PyCodeObject*>(code), globals, locals);
+}
+
+inline int asStringAndSize(PyObject* obj, const char** buffer, Py_ssize_t* size)
+{
+    char* str;
+    int res = PyString_AsStringAndSize(obj, &str, size);
+    *buffer = str;
+    return res;
+}
+
+#endif
+
+} // end namespace compat
+} // end namespace wrappy
@@ -0,0 +1,167 @@
+#define BOOST_TEST_MODULE buffer
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include <wrappy/wrappy.h>
+
+namespace {
+
+double item(wrappy::PythonObject sequence, int index)
+{
+    return wrappy::call("operator.getitem", sequence, index).floating();
+}
+
+} // end unnamed namespace
+
+BOOST_AUTO_TEST_CASE(export_vector)
+{
+    std::vector<double> v {1.0, 2.0, 3.0, 4.0};
+    auto view = wrappy::construct(wrappy::buffer(v));
+
+    BOOST_CHECK_EQUAL(wrappy::call("len", view).num(), 4);
+    BOOST_CHECK_EQUAL(view.attr("format").str(), std::string("d"));
+    BOOST_CHECK_EQUAL(view.attr("itemsize").num(), 8);
+    BOOST_CHECK(!view.attr("readonly").num());
+
+    // The memoryview refers to the memory of v
+    v[2] = 7.0;
+    auto values = wrappy::call("struct.unpack", "4d", wrappy::call(view, "tobytes"));
+    BOOST_CHECK_EQUAL(item(values, 2), 7.0);
+}
+
+BOOST_AUTO_TEST_CASE(export_const)
+{
+    const std::array<int, 3> a {{1, 2, 3}};
+    auto view = wrappy::construct(wrappy::buffer(a));
+    BOOST_CHECK(view.attr("readonly").num());
+    BOOST_CHECK_EQUAL(view.attr("format").str(), std::string("i"));
+}
+
+BOOST_AUTO_TEST_CASE(export_owning)
+{
+    wrappy::PythonObject view;
+    {
+        std::vector<double> v {1.0, 2.0, 3.0};
+        view = wrappy::construct(wrappy::buffer(std::move(v)));
+    }
+
+    auto values = wrappy::call("struct.unpack", "3d", wrappy::call(view, "tobytes"));
+    BOOST_CHECK_EQUAL(item(values, 1), 2.0);
+}
+
+BOOST_AUTO_TEST_CASE(export_2d)
+{
+    double matrix[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    auto view = wrappy::construct(wrappy::buffer(matrix, 2, 4));
+
+    BOOST_CHECK_EQUAL(view.attr("ndim").num(), 2);
+    BOOST_CHECK_EQUAL(item(view.attr("shape"), 1), 4);
+    auto values = wrappy::call("struct.unpack", "8d", wrappy::call(view, "tobytes"));
+    BOOST_CHECK_EQUAL(item(values, 5), 6.0);
+}
+
+BOOST_AUTO_TEST_CASE(export_layouts)
+{
+    double matrix[] = {1, 2, 3, 4, 5, 6};
+    wrappy::PythonObject view = wrappy::construct(wrappy::buffer(matrix, 2, 3));
+    if (!wrappy::call("hasattr", view, "obj").as<bool>()) {
+        return; // no access to the exporter before python 3.3
+    }
+
+    // Requests the buffer from the exporter with the given PyBUF_* flags
+    wrappy::PythonObject getBuffer = wrappy::call("operator.getitem", wrappy::exec(
+        "import ctypes\n"
+        "api = ctypes.pythonapi\n"
+        "api.PyObject_GetBuffer.argtypes = [ctypes.py_object, ctypes.c_void_p, ctypes.c_int]\n"
+        "api.PyBuffer_Release.argtypes = [ctypes.c_void_p]\n"
+        "def get(obj, flags):\n"
+        "    view = ctypes.create_string_buffer(256)\n"
+        "    api.PyObject_GetBuffer(obj, view, flags)\n"
+        "    api.PyBuffer_Release(view)\n"), "get");
+    const int strides = 0x10 | 0x08; // PyBUF_STRIDES
+    const int cContiguous = 0x20 | strides, fContiguous = 0x40 | strides, anyContiguous = 0x80 | strides;
+
+    wrappy::PythonObject exporter = view.attr("obj");
+    BOOST_CHECK_NO_THROW(wrappy::call(getBuffer, "__call__", exporter, cContiguous));
+    BOOST_CHECK_NO_THROW(wrappy::call(getBuffer, "__call__", exporter, anyContiguous));
+    try {
+        wrappy::call(getBuffer, "__call__", exporter, fContiguous);
+        BOOST_ERROR("Expected BufferError");
+    } catch (const wrappy::PythonError& e) {
+        BOOST_CHECK(e.matches(wrappy::load("BufferError")));
+    }
+
+    // One dimension is both
+    wrappy::PythonObject row = wrappy::construct(wrappy::buffer(matrix, 6)).attr("obj");
+    BOOST_CHECK_NO_THROW(wrappy::call(getBuffer, "__call__", row, fContiguous));
+}
+
+BOOST_AUTO_TEST_CASE(copy_strided)
+{
+    // Every other column of a 2x4 matrix
+    double matrix[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    auto strided = wrappy::buffer(matrix, {2, 2}, {4*sizeof(double), 2*sizeof(double)});
+
+    // Copies are C-contiguous and don't refer to the original memory
+    auto copy = strided.copy();
+    matrix[2] = 0.0;
+    BOOST_CHECK_EQUAL(copy.strides[0], ptrdiff_t(2*sizeof(double)));
+
+    auto view = wrappy::construct(copy);
+    auto values = wrappy::call("struct.unpack", "4d", wrappy::call(view, "tobytes"));
+    BOOST_CHECK_EQUAL(item(values, 1), 3.0);
+    BOOST_CHECK_EQUAL(item(values, 2), 5.0);
+}
+
+BOOST_AUTO_TEST_CASE(view_roundtrip)
+{
+    std::vector<double> v {1.0, 2.0, 3.0};
+    auto exported = wrappy::construct(wrappy::buffer(v));
+
+    wrappy::ArrayView<double> view(exported);
+    BOOST_CHECK_EQUAL(view.size(), 3u);
+    BOOST_CHECK(view.data() == v.data());
+
+    double sum = 0;
+    for (double d : view) {
+        sum += d;
+    }
+    BOOST_CHECK_EQUAL(sum, 6.0);
+}
+
+BOOST_AUTO_TEST_CASE(view_errors)
+{
+    std::vector<double> v {1.0, 2.0, 3.0};
+    const std::vector<double>& cv = v;
+
+    // Wrong element type
+    BOOST_CHECK_THROW(wrappy::ArrayView<const float>(wrappy::construct(wrappy::buffer(v))),
+        wrappy::WrappyError);
+    // Not writable
+    BOOST_CHECK_THROW(wrappy::ArrayView<double>(wrappy::construct(wrappy::buffer(cv))),
+        wrappy::WrappyError);
+    // No buffer at all
+    BOOST_CHECK_THROW(wrappy::ArrayView<const double>(wrappy::construct(1.0)),
+        wrappy::WrappyError);
+
+    // 'l' and 'q' are the same thing on 64 bit platforms
+    std::vector<long long> ll {1, 2};
+    wrappy::ArrayView<const long> longs(wrappy::construct(wrappy::buffer(ll)));
+    BOOST_CHECK_EQUAL(longs[1], 2);
+}
+
+BOOST_AUTO_TEST_CASE(view_strided)
+{
+    double matrix[] = {1, 2, 3, 4, 5, 6, 7, 8};
+    auto strided = wrappy::buffer(matrix, {2, 2}, {4*sizeof(double), 2*sizeof(double)});
+    wrappy::PythonObject exported(wrappy::construct(strided));
+
+    BOOST_CHECK_THROW(wrappy::ArrayView<const double> flat(exported), wrappy::WrappyError);
+
+    wrappy::NDArrayView<const double> view(exported);
+    BOOST_CHECK_EQUAL(view.ndim(), 2u);
+    BOOST_CHECK_EQUAL(view.shape()[1], 2);
+    BOOST_CHECK_EQUAL(view(1, 1), 7.0);
+}
@@ -0,0 +1,75 @@
+#define BOOST_TEST_MODULE executor
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include <wrappy/wrappy.h>
+#include <wrappy/executor.h>
+
+#include <algorithm>
+#include <thread>
+
+namespace {
+
+struct ThreadedMode {
+    ThreadedMode() { wrappy::enableThreads(); }
+};
+
+} // end unnamed namespace
+
+BOOST_GLOBAL_FIXTURE(ThreadedMode);
+
+BOOST_AUTO_TEST_CASE(async_call)
+{
+    std::future<wrappy::PythonObject> root = wrappy::asyncCall("math.sqrt", 16.0);
+    std::future<std::string> joined = wrappy::asyncCall<std::string>(
+        "os.path.join", "a", std::string("b"));
+    std::future<void> seeded = wrappy::asyncCall<void>("random.seed", 0);
+
+    BOOST_CHECK_EQUAL(root.get().floating(), 4.0);
+    BOOST_CHECK_EQUAL(joined.get(), "a/b");
+    seeded.get();
+
+    BOOST_CHECK_THROW(wrappy::asyncCall("asdf").get(), wrappy::WrappyError);
+    BOOST_CHECK_THROW(wrappy::asyncCall<int>("str", 1).get(), wrappy::WrappyError);
+}
+
+BOOST_AUTO_TEST_CASE(batches)
+{
+    wrappy::Executor executor;
+
+    // Everything queued while the executor waits for the GIL is one batch
+    std::vector<std::future<double>> results;
+    {
+        wrappy::GilAcquire gil;
+        for (int i = 0; i < 10; ++i) {
+            results.push_back(executor.call<double>("math.sqrt", double(i*i)));
+        }
+    }
+    for (int i = 0; i < 10; ++i) {
+        BOOST_CHECK_EQUAL(results[i].get(), i);
+    }
+    BOOST_CHECK(executor.batches() <= 2u);
+}
+
+BOOST_AUTO_TEST_CASE(backpressure)
+{
+    wrappy::Executor executor(2);
+    BOOST_CHECK_EQUAL(executor.capacity(), 2u);
+
+    std::vector<std::future<void>> results;
+    size_t maxQueued = 0;
+    std::thread producer([&]() {
+        for (int i = 0; i < 20; ++i) {
+            results.push_back(executor.submit([]() { wrappy::call("math.sqrt", 2.0); }));
+            maxQueued = std::max(maxQueued, executor.queued());
+        }
+    });
+    producer.join();
+    BOOST_CHECK(maxQueued <= 2u);
+
+    for (auto& result : results) {
+        result.get();
+    }
+}
@@ -0,0 +1,103 @@
+#define BOOST_TEST_MODULE memory
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include <wrappy/wrappy.h>
+
+#include <string>
+
+namespace {
+
+const wrappy::memory::SiteMemory* findSite(
+    const std::vector<wrappy::memory::SiteMemory>& sites, const std::string& prefix)
+{
+    for (const auto& site : sites) {
+        if (site.name.compare(0, prefix.size(), prefix) == 0) {
+            return &site;
+        }
+    }
+    return nullptr;
+}
+
+} // end unnamed namespace
+
+// Must run before anything else in this process uses wrappy
+BOOST_AUTO_TEST_CASE(enable_at_startup)
+{
+    if (!wrappy::memory::supported()) {
+        BOOST_CHECK_THROW(wrappy::memory::setEnabled(true), wrappy::WrappyError);
+        return;
+    }
+
+    wrappy::Config config;
+    config.trackMemory = true;
+    wrappy::initialize(config);
+    BOOST_CHECK(wrappy::memory::enabled());
+}
+
+BOOST_AUTO_TEST_CASE(call_sites)
+{
+    if (!wrappy::memory::supported()) {
+        return;
+    }
+
+    wrappy::memory::setEnabled(true);
+    auto kept = wrappy::call("bytearray", 100000);
+    wrappy::call("bytearray", 200000);
+
+    auto sites = wrappy::memory::snapshot();
+    const wrappy::memory::SiteMemory* site = findSite(sites, "bytearray");
+    BOOST_REQUIRE(site);
+    BOOST_CHECK(site->allocations >= 2);
+    BOOST_CHECK(site->allocatedBytes >= 300000);
+    BOOST_CHECK(site->liveBytes >= 100000);
+    BOOST_CHECK(site->liveBytes < 200000);
+    BOOST_CHECK(site->liveObjects >= 1);
+
+    // Freeing the block is seen, and reset() keeps the live counts
+    wrappy::memory::reset();
+    kept = wrappy::None;
+    sites = wrappy::memory::snapshot();
+    site = findSite(sites, "bytearray");
+    BOOST_CHECK(!site || (site->allocations == 0 && site->liveBytes < 100000));
+
+    // Allocations inside a callback belong to the callback
+    auto callback = wrappy::construct([]() { return std::string(50000, 'x'); });
+    kept = callback();
+    sites = wrappy::memory::snapshot();
+    site = findSite(sites, "<callback");
+    BOOST_REQUIRE(site);
+    BOOST_CHECK(site->liveBytes >= 50000);
+    BOOST_CHECK(wrappy::memory::dumpText().find("<callback") != std::string::npos);
+
+    kept = wrappy::None;
+    wrappy::memory::setEnabled(false);
+    BOOST_CHECK(!wrappy::memory::enabled());
+}
+
+BOOST_AUTO_TEST_CASE(arena)
+{
+    if (!wrappy::memory::supported()) {
+        return;
+    }
+
+    wrappy::memory::setEnabled(true);
+    {
+        wrappy::memory::Arena arena;
+        auto request = wrappy::call("bytearray", 100000);
+        BOOST_CHECK(arena.stats().allocatedBytes >= 100000);
+        BOOST_CHECK(arena.stats().liveBytes >= 100000);
+
+        request = wrappy::None;
+        BOOST_CHECK(arena.stats().liveBytes < 100000);
+    }
+    {
+        // Collects and trims only when asked to
+        wrappy::memory::Arena collecting(true);
+        wrappy::call("bytearray", 100000);
+    }
+    wrappy::memory::Arena::release();
+    wrappy::memory::setEnabled(false);
+}
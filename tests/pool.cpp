@@ -0,0 +1,98 @@
+#define BOOST_TEST_MODULE pool
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include <wrappy/wrappy.h>
+#include <wrappy/interpreter_pool.h>
+
+namespace {
+
+struct ThreadedMode {
+    ThreadedMode() { wrappy::enableThreads(); }
+};
+
+bool hasMarker()
+{
+    return wrappy::call("hasattr", wrappy::load("sys"), "wrappy_marker").as<bool>();
+}
+
+} // end unnamed namespace
+
+BOOST_GLOBAL_FIXTURE(ThreadedMode);
+
+BOOST_AUTO_TEST_CASE(calls)
+{
+    wrappy::InterpreterPool pool(2);
+    BOOST_CHECK_EQUAL(pool.size(), 2u);
+
+    std::vector<std::future<double>> results;
+    for (int i = 0; i < 20; ++i) {
+        results.push_back(pool.call<double>("math.sqrt", double(i*i)));
+    }
+    for (int i = 0; i < 20; ++i) {
+        BOOST_CHECK_EQUAL(results[i].get(), i);
+    }
+
+    BOOST_CHECK_EQUAL(pool.callOn<double>(1, "math.sqrt", 4.0).get(), 2.0);
+    BOOST_CHECK_THROW(pool.callOn<double>(1, "math.sqrt", "x").get(), wrappy::WrappyError);
+    BOOST_CHECK_THROW(pool.callOn<void>(2, "math.sqrt", 4.0), wrappy::WrappyError);
+}
+
+BOOST_AUTO_TEST_CASE(isolation)
+{
+    wrappy::InterpreterPool pool(2);
+
+    pool.run(0, []() {
+        wrappy::call("setattr", wrappy::load("sys"), "wrappy_marker", 1);
+    }).get();
+
+    BOOST_CHECK(pool.run(0, hasMarker).get());
+    BOOST_CHECK(!pool.run(1, hasMarker).get());
+    BOOST_CHECK(!hasMarker());
+}
+
+BOOST_AUTO_TEST_CASE(objects)
+{
+    typedef wrappy::InterpreterPool::Object Object;
+    wrappy::InterpreterPool pool(2);
+
+    Object date = pool.callOn<Object>(1, "datetime.date", 2003, 8, 4).get();
+    BOOST_CHECK_EQUAL(date.interpreter(), 1u);
+    BOOST_CHECK_EQUAL(pool.call<std::string>(date, "isoformat").get(), "2003-08-04");
+
+    // Objects can only be used on their own interpreter
+    BOOST_CHECK_THROW(date.get(), wrappy::WrappyError);
+    BOOST_CHECK_THROW(pool.callOn<std::string>(0, "str", date).get(), wrappy::WrappyError);
+    BOOST_CHECK_EQUAL(pool.callOn<std::string>(1, "str", date).get(), "2003-08-04");
+
+    wrappy::InterpreterPool other(1);
+    BOOST_CHECK_THROW(other.call<std::string>(date, "isoformat"), wrappy::WrappyError);
+
+    Object path = pool.load(0, "os.path").get();
+    BOOST_CHECK_EQUAL(pool.call<std::string>(path, "join", "a", "b").get(), "a/b");
+}
+
+BOOST_AUTO_TEST_CASE(types)
+{
+    // wrappy's own python types in every interpreter at once
+    wrappy::InterpreterPool pool(4);
+    std::vector<std::future<long long>> sums;
+    for (int i = 0; i < 40; ++i) {
+        sums.push_back(pool.run([]() {
+            long long sum = 0;
+            for (int j = 0; j < 50; ++j) {
+                std::vector<int> v {1, 2, 3};
+                sum += wrappy::call("sum", wrappy::constructIter(v)).num();
+                wrappy::PythonObject view = wrappy::construct(wrappy::buffer(v));
+                sum += wrappy::call("len", view).num();
+            }
+            return sum;
+        }));
+    }
+    for (auto& sum : sums) {
+        BOOST_CHECK_EQUAL(sum.get(), 50 * 9);
+    }
+    BOOST_CHECK_EQUAL(wrappy::call("sum", wrappy::constructIter(std::vector<int> {1, 2})).num(), 3);
+}
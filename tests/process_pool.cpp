@@ -0,0 +1,188 @@
+#define BOOST_TEST_MODULE process_pool
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include <wrappy/wrappy.h>
+#include <wrappy/process_pool.h>
+
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+
+struct ThreadedMode {
+    ThreadedMode() { wrappy::enableThreads(); }
+};
+
+wrappy::ProcessPool::Options options(size_t workers)
+{
+    wrappy::ProcessPool::Options options;
+    options.workers = workers;
+    options.workerPath = WRAPPY_WORKER_PATH;
+    return options;
+}
+
+} // end unnamed namespace
+
+BOOST_GLOBAL_FIXTURE(ThreadedMode);
+
+BOOST_AUTO_TEST_CASE(calls)
+{
+    wrappy::ProcessPool pool(options(2));
+    BOOST_CHECK_EQUAL(pool.size(), 2u);
+
+    std::vector<std::future<double>> roots;
+    for (int i = 0; i < 100; ++i) {
+        roots.push_back(pool.call<double>("math.sqrt", double(i*i)));
+    }
+    for (int i = 0; i < 100; ++i) {
+        BOOST_CHECK_EQUAL(roots[i].get(), i);
+    }
+
+    std::future<int> parsed = pool.callOn<int>(1, "int", "ff", 16);
+    BOOST_CHECK_EQUAL(parsed.get(), 255);
+
+    std::future<wrappy::PythonObject> keywords = pool.callWithArgs("int",
+        {wrappy::construct("ff")}, {{"base", wrappy::construct(16)}});
+    BOOST_CHECK_EQUAL(keywords.get().num(), 255);
+    std::future<int> pair = pool.call<int>("int", "ff", std::make_pair(std::string("base"), 16));
+    BOOST_CHECK_EQUAL(pair.get(), 255);
+
+    // Runs in another process
+    int pid = pool.call<int>("os.getpid").get();
+    BOOST_CHECK(pid != wrappy::call("os.getpid").num());
+    BOOST_CHECK_EQUAL(pool.stats()[0].restarts + pool.stats()[1].restarts, 0u);
+}
+
+BOOST_AUTO_TEST_CASE(buffers)
+{
+    wrappy::ProcessPool pool(options(1));
+
+    wrappy::PythonObject data = wrappy::eval("bytearray(range(256)) * 4096");
+    wrappy::PythonObject copy = pool.call("bytearray", data).get();
+    BOOST_CHECK(wrappy::call("operator.eq", data, copy).as<bool>());
+    BOOST_CHECK_EQUAL(pool.call<int>("len", data).get(), 1 << 20);
+
+    // More than half of the ring
+    wrappy::ProcessPool::Options small = options(1);
+    small.ringBytes = 1 << 16;
+    wrappy::ProcessPool smallPool(small);
+    BOOST_CHECK_THROW(smallPool.call("len", data), wrappy::WrappyError);
+    BOOST_CHECK_EQUAL(smallPool.call<int>("len", "abc").get(), 3);
+
+    // Rounded up, so that messages wrap around the end of the ring
+    wrappy::ProcessPool::Options odd = options(1);
+    odd.ringBytes = 4100;
+    wrappy::ProcessPool oddPool(odd);
+    std::vector<std::future<std::string>> strings;
+    for (int i = 0; i < 40; ++i) {
+        strings.push_back(oddPool.call<std::string>("str", i));
+    }
+    for (int i = 0; i < 40; ++i) {
+        BOOST_CHECK_EQUAL(strings[i].get(), std::to_string(i));
+    }
+
+    wrappy::ProcessPool::Options tiny = options(1);
+    tiny.ringBytes = 256;
+    BOOST_CHECK_THROW(wrappy::ProcessPool tinyPool(tiny), wrappy::WrappyError);
+
+    // Views kept alive by the worker pin the ring, only with out-of-band buffers
+    if (!wrappy::call("hasattr", wrappy::load("pickle"), "PickleBuffer").as<bool>()) {
+        return;
+    }
+    std::string module = "wrappy_test_pin_" + std::to_string(getpid());
+    {
+        std::ofstream out(module + ".py");
+        out << "import pickle\n"
+            << "views = []\n"
+            << "def pin(buffer):\n"
+            << "    views.append(pickle.PickleBuffer(buffer))\n";
+    }
+    small.searchPaths.push_back(".");
+    wrappy::ProcessPool pinningPool(small);
+    wrappy::PythonObject chunk = wrappy::call("pickle.PickleBuffer", wrappy::eval("bytearray(20000)"));
+    for (int i = 0; i < 3; ++i) {
+        pinningPool.call(module + ".pin", chunk).get();
+    }
+    BOOST_CHECK_THROW(pinningPool.call("len", chunk), wrappy::WrappyError);
+    std::remove((module + ".py").c_str());
+}
+
+BOOST_AUTO_TEST_CASE(errors)
+{
+    wrappy::ProcessPool pool(options(1));
+
+    try {
+        pool.call("int", "x").get();
+        BOOST_ERROR("Expected PythonError");
+    } catch (const wrappy::PythonError& e) {
+        BOOST_CHECK(e.matches(wrappy::load("ValueError")));
+        BOOST_CHECK(std::string(e.what()).find("Exception in worker process") != std::string::npos);
+    }
+    BOOST_CHECK_THROW(pool.call("nonexistent.function").get(), wrappy::PythonError);
+    BOOST_CHECK_EQUAL(pool.call<int>("len", "abc").get(), 3);
+}
+
+BOOST_AUTO_TEST_CASE(crashes)
+{
+    wrappy::ProcessPool pool(options(1));
+
+    int pid = pool.stats()[0].pid;
+    BOOST_CHECK_THROW(pool.call("os._exit", 3).get(), wrappy::WrappyError);
+    BOOST_CHECK_EQUAL(pool.call<int>("len", "abc").get(), 3);
+    BOOST_CHECK_EQUAL(pool.stats()[0].restarts, 1u);
+    BOOST_CHECK(pool.stats()[0].pid != pid);
+}
+
+BOOST_AUTO_TEST_CASE(failed_restarts)
+{
+    // A worker that only starts once
+    std::string marker = "wrappy_test_started_" + std::to_string(getpid());
+    std::string script = "wrappy_test_worker_" + std::to_string(getpid()) + ".sh";
+    {
+        std::ofstream out(script);
+        out << "#!/bin/sh\n"
+            << "[ -e " << marker << " ] && exit 1\n"
+            << "touch " << marker << "\n"
+            << "exec " << WRAPPY_WORKER_PATH << " \"$@\"\n";
+    }
+    chmod(script.c_str(), 0700);
+
+    wrappy::ProcessPool::Options once = options(1);
+    once.workerPath = "./" + script;
+    {
+        wrappy::ProcessPool pool(once);
+        BOOST_CHECK_EQUAL(pool.call<int>("len", "abc").get(), 3);
+        BOOST_CHECK_THROW(pool.call("os._exit", 3).get(), wrappy::WrappyError);
+
+        // Fails instead of waiting for the worker forever
+        auto start = std::chrono::steady_clock::now();
+        while (pool.stats()[0].restarts < 5 && std::chrono::steady_clock::now() - start < std::chrono::seconds(30)) {
+            try {
+                pool.call("len", "abc").get();
+            } catch (const wrappy::WrappyError&) {
+            }
+        }
+        BOOST_CHECK_THROW(pool.call("len", "abc").get(), wrappy::WrappyError);
+    }
+    std::remove(marker.c_str());
+    std::remove(script.c_str());
+}
+
+BOOST_AUTO_TEST_CASE(timeouts)
+{
+    wrappy::ProcessPool::Options timeout = options(1);
+    timeout.callTimeout = std::chrono::milliseconds(200);
+    wrappy::ProcessPool pool(timeout);
+
+    auto start = std::chrono::steady_clock::now();
+    BOOST_CHECK_THROW(pool.call("time.sleep", 60).get(), wrappy::WrappyError);
+    BOOST_CHECK(std::chrono::steady_clock::now() - start < std::chrono::seconds(10));
+    BOOST_CHECK_EQUAL(pool.call<int>("len", "abc").get(), 3);
+}
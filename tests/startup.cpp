@@ -0,0 +1,54 @@
+#define BOOST_TEST_MODULE startup
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include <wrappy/wrappy.h>
+
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Must run before anything else in this process uses wrappy
+BOOST_AUTO_TEST_CASE(explicit_config)
+{
+    BOOST_CHECK(!wrappy::initialized());
+    wrappy::flushDeferredDecrefs();
+    BOOST_CHECK(!wrappy::initialized());
+
+    wrappy::Config config;
+    config.isolated = true;
+    config.importSite = false;
+    config.searchPaths = {"/wrappy/first", "/wrappy/second"};
+    config.preImport = {"json", "wrappy_no_such_module"};
+    wrappy::initialize(config);
+
+    BOOST_CHECK(wrappy::initialized());
+    BOOST_CHECK(wrappy::threadsEnabled());
+    BOOST_CHECK_THROW(wrappy::initialize(), wrappy::WrappyError);
+
+    auto path = wrappy::load("sys.path").as<std::vector<std::string>>();
+    BOOST_REQUIRE(path.size() >= 2);
+    BOOST_CHECK_EQUAL(path[0], "/wrappy/first");
+    BOOST_CHECK_EQUAL(path[1], "/wrappy/second");
+
+    BOOST_CHECK_EQUAL(wrappy::load("sys.flags.no_site").num(), 1);
+    BOOST_CHECK_EQUAL(wrappy::load("sys.flags.ignore_environment").num(), 1);
+    BOOST_CHECK(wrappy::call(wrappy::load("sys.modules"), "get", "site").get() == wrappy::None.get());
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (wrappy::startupStats().preImportPending > 0
+        && std::chrono::steady_clock::now() < deadline)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    wrappy::StartupStats stats = wrappy::startupStats();
+    BOOST_CHECK_EQUAL(stats.preImportPending, 0u);
+    BOOST_CHECK_EQUAL(stats.preImported, 1u);
+    BOOST_CHECK_EQUAL(stats.preImportFailed, 1u);
+    BOOST_CHECK(stats.initializeSeconds > 0);
+    BOOST_CHECK(wrappy::call(wrappy::load("sys.modules"), "get", "json").get() != wrappy::None.get());
+}
@@ -32,8 +32,10 @@ BOOST_AUTO_TEST_CASE(builtins)
     args[0] = wrappy::construct(255ll);
     auto longval = wrappy::callWithArgs("hex", args);
 
+    // Python 3 has no separate long type
+    bool python3 = wrappy::load("sys.version_info").attr("major").num() >= 3;
     BOOST_CHECK_EQUAL(intval.str(), "0xff");
-    BOOST_CHECK_EQUAL(longval.str(), "0xffL");
+    BOOST_CHECK_EQUAL(longval.str(), python3 ? "0xff" : "0xffL");
 }
 
 BOOST_AUTO_TEST_CASE(error)
@@ -42,6 +44,156 @@ BOOST_AUTO_TEST_CASE(error)
         wrappy::WrappyError);
 }
 
+BOOST_AUTO_TEST_CASE(python_error)
+{
+    try {
+        wrappy::call("int", "not a number");
+        BOOST_ERROR("no exception thrown");
+    } catch (const wrappy::PythonError& e) {
+        BOOST_CHECK(e.matches(wrappy::load("ValueError")));
+        BOOST_CHECK(!e.matches(wrappy::load("KeyError")));
+        BOOST_CHECK(std::string(e.what()).find("ValueError") != std::string::npos);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(negative_cache)
+{
+    const char* name = "wrappy_test_optional";
+    BOOST_CHECK_THROW(wrappy::load(name), wrappy::WrappyError);
+
+    // Once the module exists, the cached failure hides it until invalidated
+    wrappy::call(wrappy::load("sys").attr("modules"), "__setitem__",
+        name, wrappy::load("math"));
+    BOOST_CHECK_THROW(wrappy::load(name), wrappy::WrappyError);
+
+    wrappy::invalidateCache(name);
+    BOOST_CHECK_EQUAL(wrappy::call("wrappy_test_optional.sqrt", 4.0).floating(), 2.0);
+    wrappy::call(wrappy::load("sys").attr("modules"), "__delitem__", name);
+    wrappy::invalidateCache();
+}
+
+BOOST_AUTO_TEST_CASE(call_metrics)
+{
+    wrappy::metrics::reset();
+    wrappy::metrics::setEnabled(true);
+    for (int i = 0; i < 3; ++i) {
+        wrappy::call("math.sqrt", 4.0);
+    }
+    BOOST_CHECK_THROW(wrappy::call("int", "x"), wrappy::PythonError);
+    wrappy::metrics::setEnabled(false);
+    wrappy::call("math.sqrt", 4.0);
+
+    auto sites = wrappy::metrics::snapshot();
+    BOOST_REQUIRE_EQUAL(sites.size(), 2u);
+    BOOST_CHECK_EQUAL(sites[0].name, "math.sqrt");
+    BOOST_CHECK_EQUAL(sites[0].calls, 3u);
+    BOOST_CHECK_EQUAL(sites[0].errors, 0u);
+    BOOST_CHECK_EQUAL(sites[0].total.count, 3u);
+    BOOST_CHECK(sites[0].total.maxNs > 0);
+    BOOST_CHECK(sites[0].total.percentileNs(0.5) <= sites[0].total.maxNs);
+    BOOST_CHECK_EQUAL(sites[1].name, "int");
+    BOOST_CHECK_EQUAL(sites[1].errors, 1u);
+
+    std::string json = wrappy::metrics::dumpJson();
+    BOOST_CHECK(json.find("\"name\": \"math.sqrt\"") != std::string::npos);
+    BOOST_CHECK(json.find("\"execute\": {\"count\": 3") != std::string::npos);
+    BOOST_CHECK(wrappy::metrics::dumpText().find("math.sqrt") != std::string::npos);
+
+    // Callbacks made from the same lambda expression share their site
+    wrappy::metrics::reset();
+    wrappy::metrics::setEnabled(true);
+    for (int i = 0; i < 3; ++i) {
+        auto callback = wrappy::construct([i]() { return i; });
+        callback();
+    }
+    wrappy::metrics::setEnabled(false);
+    sites = wrappy::metrics::snapshot();
+    BOOST_REQUIRE_EQUAL(sites.size(), 1u);
+    BOOST_CHECK_EQUAL(sites[0].name.compare(0, 10, "<callback "), 0);
+    BOOST_CHECK_EQUAL(sites[0].calls, 3u);
+
+    // The result conversion of a Function is part of the call
+    wrappy::Function<std::vector<int>(std::vector<int>)> sorted("sorted");
+    wrappy::Function<int(int)> str("str");
+    wrappy::metrics::reset();
+    wrappy::metrics::setEnabled(true);
+    sorted(std::vector<int> {3, 1, 2});
+    sorted(std::vector<int> {2, 1});
+    BOOST_CHECK_THROW(str(1), wrappy::WrappyError);
+    wrappy::metrics::setEnabled(false);
+    sites = wrappy::metrics::snapshot();
+    BOOST_REQUIRE_EQUAL(sites.size(), 2u);
+    BOOST_CHECK_EQUAL(sites[0].calls, 2u);
+    BOOST_CHECK_EQUAL(sites[0].phases[wrappy::metrics::Unmarshal].count, 2u);
+    BOOST_CHECK_EQUAL(sites[1].errors, 1u);
+    BOOST_CHECK_EQUAL(sites[0].name, sorted.object().attr("__module__").str() + std::string(".sorted"));
+
+    wrappy::metrics::reset();
+    BOOST_CHECK(wrappy::metrics::snapshot().empty());
+}
+
+BOOST_AUTO_TEST_CASE(resolution_cache)
+{
+    auto random = wrappy::load("random");
+    auto original = wrappy::load("random.random");
+
+    // Rebinding the attribute is not visible until the cache is invalidated
+    wrappy::call("setattr", random, "random", wrappy::load("time.time"));
+    BOOST_CHECK(wrappy::load("random.random").get() == original.get());
+
+    wrappy::invalidateCache("random.random");
+    BOOST_CHECK(wrappy::load("random.random").get() != original.get());
+
+    wrappy::call("setattr", random, "random", original);
+    wrappy::invalidateCache();
+    BOOST_CHECK(wrappy::load("random.random").get() == original.get());
+}
+
+BOOST_AUTO_TEST_CASE(eval_exec)
+{
+    auto three = wrappy::construct(3);
+    BOOST_CHECK_EQUAL(wrappy::eval("x * 2 + 1", {{"x", three}}).num(), 7);
+    BOOST_CHECK_EQUAL(wrappy::eval("sum([x * i for i in range(3)])", {{"x", three}}).num(), 9);
+    BOOST_CHECK(wrappy::eval("abs(-1) == 1").as<bool>());
+
+    auto ns = wrappy::exec("y = x + 1\ndef f():\n    return y\n", {{"x", three}});
+    BOOST_CHECK_EQUAL(wrappy::call(ns, "__getitem__", "y").num(), 4);
+    BOOST_CHECK_EQUAL(wrappy::call(ns, "get", "f")().num(), 4);
+
+    // The second run uses the cached code, so f shares its code object
+    auto again = wrappy::exec("y = x + 1\ndef f():\n    return y\n", {{"x", three}});
+    auto code = [](const wrappy::PythonObject& ns) {
+        return wrappy::call(ns, "get", "f").attr("__code__").get();
+    };
+    BOOST_CHECK(code(ns) == code(again));
+
+    wrappy::setCodeCacheCapacity(0);
+    again = wrappy::exec("y = x + 1\ndef f():\n    return y\n", {{"x", three}});
+    BOOST_CHECK(code(ns) != code(again));
+    wrappy::setCodeCacheCapacity(128);
+
+    try {
+        wrappy::eval("1 +");
+        BOOST_ERROR("no exception thrown");
+    } catch (const wrappy::PythonError& e) {
+        BOOST_CHECK(e.matches(wrappy::load("SyntaxError")));
+    }
+    BOOST_CHECK_THROW(wrappy::eval("undefined"), wrappy::PythonError);
+}
+
+BOOST_AUTO_TEST_CASE(method_cache)
+{
+    wrappy::setMethodCacheCapacity(1);
+
+    auto first = wrappy::call("datetime.date", 2003, 8, 4);
+    auto second = wrappy::call("datetime.date", 2004, 9, 5);
+    BOOST_CHECK_EQUAL(wrappy::call(first, "isoformat").str(), "2003-08-04");
+    BOOST_CHECK_EQUAL(wrappy::call(second, "isoformat").str(), "2004-09-05");
+    BOOST_CHECK_EQUAL(wrappy::call(first, "isoformat").str(), "2003-08-04");
+
+    wrappy::setMethodCacheCapacity(0);
+}
+
 BOOST_AUTO_TEST_CASE(destruction)
 {
 
@@ -6,6 +6,38 @@
 
 #include <wrappy/wrappy.h>
 
+#include <functional>
+#include <type_traits>
+
+namespace {
+
+// sum(args) * scale + *offset
+wrappy::PythonObject scaledSum(
+    const std::vector<wrappy::PythonObject>& args,
+    const std::map<const char*, wrappy::PythonObject>& kwargs,
+    void* offset)
+{
+    long long sum = 0;
+    for (const auto& arg : args) {
+        sum += arg.num();
+    }
+    for (const auto& kv : kwargs) {
+        if (std::string(kv.first) == "scale") {
+            sum *= kv.second.num();
+        }
+    }
+    return wrappy::construct(sum + (offset ? *static_cast<int*>(offset) : 0));
+}
+
+wrappy::PythonObject plainSum(
+    const std::vector<wrappy::PythonObject>& args,
+    const std::map<const char*, wrappy::PythonObject>& kwargs)
+{
+    return scaledSum(args, kwargs, nullptr);
+}
+
+} // end unnamed namespace
+
 BOOST_AUTO_TEST_CASE(stdlib)
 {
     auto datetime = wrappy::call("datetime.datetime", 2003, 8, 4, 12, 30, 45);
@@ -21,3 +53,330 @@ BOOST_AUTO_TEST_CASE(kwargs)
 
     BOOST_CHECK_EQUAL(seconds, 3600);
 }
+
+BOOST_AUTO_TEST_CASE(names)
+{
+    using namespace wrappy::literals;
+
+    auto delta = wrappy::call("datetime.timedelta", 1,
+        std::make_pair("hours"_name, 1), std::make_pair("minutes", 2));
+    BOOST_CHECK_EQUAL(delta.attr("seconds"_name).num(), 3720);
+    BOOST_CHECK_EQUAL(delta.attr("days"_name).num(), 1);
+
+    auto list = wrappy::call("list");
+    wrappy::call(list, "append"_name, 1);
+    list.call("append"_name, 2);
+    wrappy::call(list, "sort"_name, std::make_pair("reverse"_name, true));
+    BOOST_CHECK_EQUAL(wrappy::call("str", list).str(), std::string("[2, 1]"));
+
+    BOOST_CHECK_THROW(wrappy::call(list, "no_such_method"_name), wrappy::WrappyError);
+
+    // Only literals, a reused buffer would hit the entry of its old content
+    static_assert(!std::is_constructible<wrappy::Name, const char*, size_t>::value, "");
+    static_assert(!std::is_constructible<wrappy::Name, char (&)[16]>::value, "");
+}
+
+BOOST_AUTO_TEST_CASE(callbacks)
+{
+    auto plain = wrappy::construct(plainSum);
+    BOOST_CHECK_EQUAL(wrappy::call(plain, "__call__", 1, 2).num(), 3);
+    BOOST_CHECK_EQUAL(wrappy::call(plain, "__call__").num(), 0);
+
+    int offset = 5;
+    auto withData = wrappy::construct(scaledSum, &offset);
+    BOOST_CHECK_EQUAL(wrappy::call(withData, "__call__", 1, 2,
+        std::make_pair("scale", 10)).num(), 35);
+
+    // Capture-less lambdas with the same signatures are still plain callbacks
+    auto lambda = wrappy::construct([](const std::vector<wrappy::PythonObject>& args,
+            const std::map<const char*, wrappy::PythonObject>&) {
+        return wrappy::construct(static_cast<long long>(args.size()));
+    });
+    BOOST_CHECK_EQUAL(wrappy::call(lambda, "__call__", 1, 2, 3).num(), 3);
+
+    auto lambdaWithData = wrappy::construct([](const std::vector<wrappy::PythonObject>& args,
+            const std::map<const char*, wrappy::PythonObject>&, void* userdata) {
+        return wrappy::construct(args[0].num() + *static_cast<int*>(userdata));
+    }, &offset);
+    BOOST_CHECK_EQUAL(wrappy::call(lambdaWithData, "__call__", 1).num(), 6);
+
+    // C++ exceptions come back as python exceptions
+    auto throwing = wrappy::construct([](const std::vector<wrappy::PythonObject>&,
+            const std::map<const char*, wrappy::PythonObject>&) -> wrappy::PythonObject {
+        throw std::runtime_error("lambda failed");
+    });
+    BOOST_CHECK_THROW(wrappy::call(throwing, "__call__"), wrappy::WrappyError);
+    BOOST_CHECK_EQUAL(wrappy::eval("1 + 1").num(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(typed_callbacks)
+{
+    int calls = 0;
+    auto add = wrappy::construct([&calls](int a, double b) {
+        ++calls;
+        return a + b;
+    });
+    BOOST_CHECK_EQUAL(wrappy::call(add, "__call__", 1, 2.5).floating(), 3.5);
+    BOOST_CHECK_EQUAL(calls, 1);
+
+    std::function<std::string(const std::string&)> upper = [](const std::string& s) {
+        return s + "!";
+    };
+    BOOST_CHECK_EQUAL(wrappy::call(wrappy::construct(upper), "__call__", "hi").str(),
+        std::string("hi!"));
+
+    // Borrowed arguments and views, no result
+    double sum = 0;
+    auto accumulate = wrappy::construct([&sum](wrappy::ArrayView<const double> values) {
+        for (double v : values) {
+            sum += v;
+        }
+    });
+    std::vector<double> values {1.0, 2.0, 3.0};
+    wrappy::PythonObject none = wrappy::call(accumulate, "__call__", wrappy::buffer(values));
+    BOOST_CHECK_EQUAL(sum, 6.0);
+    BOOST_CHECK(none.get() == wrappy::None.get());
+
+    // Errors are raised in python, and come back as WrappyErrors
+    BOOST_CHECK_THROW(wrappy::call(add, "__call__", 1), wrappy::WrappyError);
+    BOOST_CHECK_THROW(wrappy::call(add, "__call__", "a", 1), wrappy::WrappyError);
+    BOOST_CHECK_THROW(wrappy::call(add, "__call__", 1, 2, std::make_pair("c", 3)),
+        wrappy::WrappyError);
+    auto throwing = wrappy::construct([]() -> int { throw std::runtime_error("fail"); });
+    BOOST_CHECK_THROW(wrappy::call(throwing, "__call__"), wrappy::WrappyError);
+}
+
+BOOST_AUTO_TEST_CASE(iteration)
+{
+    std::vector<int> values {1, 2, 3, 4, 5, 6, 7};
+    auto list = wrappy::construct(values);
+
+    // Lists are indexed, everything else is iterated
+    for (auto iterable : {list, wrappy::call("tuple", list), wrappy::call("iter", list)}) {
+        long long sum = 0;
+        for (auto item : iterable) {
+            sum += item.num();
+        }
+        BOOST_CHECK_EQUAL(sum, 28);
+    }
+
+    std::vector<double> doubles;
+    for (double d : wrappy::range<double>(wrappy::call("reversed", list), 3)) {
+        doubles.push_back(d);
+    }
+    BOOST_CHECK_EQUAL(doubles.size(), 7u);
+    BOOST_CHECK_EQUAL(doubles.front(), 7.0);
+
+    std::vector<size_t> sizes;
+    for (const auto& chunk : wrappy::chunks(list, 3)) {
+        sizes.push_back(chunk.size());
+    }
+    BOOST_CHECK(sizes == std::vector<size_t>({3, 3, 1}));
+
+    auto empty = wrappy::call("list");
+    BOOST_CHECK(!(begin(empty) != end(empty)));
+    BOOST_CHECK(wrappy::range<int>(empty).begin() == wrappy::range<int>(empty).end());
+
+    BOOST_CHECK_THROW(wrappy::range<int>(wrappy::construct(1)), wrappy::WrappyError);
+    BOOST_CHECK_THROW(for (int i : wrappy::range<int>(wrappy::call("list", "ab"))) { (void)i; },
+        wrappy::WrappyError);
+}
+
+BOOST_AUTO_TEST_CASE(function)
+{
+    wrappy::Function<double(double)> sqrt("math.sqrt");
+    BOOST_CHECK_EQUAL(sqrt(4.0), 2.0);
+    BOOST_CHECK_EQUAL(sqrt(9.0), 3.0);
+
+    wrappy::Function<std::string(int, int)> join("os.path.join");
+    BOOST_CHECK_THROW(join(1, 2), wrappy::WrappyError);
+
+    wrappy::Function<long long(std::string)> len(wrappy::load("len"));
+    BOOST_CHECK_EQUAL(len("four"), 4);
+
+    wrappy::Function<int()> wrongResult("os.getcwd");
+    BOOST_CHECK_THROW(wrongResult(), wrappy::WrappyError);
+}
+
+BOOST_AUTO_TEST_CASE(call_many)
+{
+    std::vector<double> squares = {1.0, 4.0, 9.0};
+    std::vector<double> expected = {1.0, 2.0, 3.0};
+    auto roots = wrappy::callMany<double>("math.sqrt", squares);
+    BOOST_CHECK_EQUAL_COLLECTIONS(roots.begin(), roots.end(), expected.begin(), expected.end());
+    roots = wrappy::callMany<double>("math.sqrt", squares, wrappy::Batch::Map);
+    BOOST_CHECK_EQUAL_COLLECTIONS(roots.begin(), roots.end(), expected.begin(), expected.end());
+
+    std::vector<std::tuple<long long, long long>> pairs = {
+        std::make_tuple(2, 3), std::make_tuple(3, 2), std::make_tuple(10, 0)};
+    std::vector<long long> powers;
+    wrappy::callMany<long long>("pow", pairs, std::back_inserter(powers), wrappy::Batch::Map);
+    std::vector<long long> expectedPowers = {8, 9, 1};
+    BOOST_CHECK_EQUAL_COLLECTIONS(powers.begin(), powers.end(),
+        expectedPowers.begin(), expectedPowers.end());
+
+    std::vector<long long> seen;
+    auto record = wrappy::construct([&](long long x, long long y) { seen.push_back(x * y); });
+    wrappy::callMany<void>(record, pairs, std::back_inserter(powers));
+    std::vector<long long> expectedSeen = {6, 6, 0};
+    BOOST_CHECK_EQUAL_COLLECTIONS(seen.begin(), seen.end(), expectedSeen.begin(), expectedSeen.end());
+    BOOST_CHECK(wrappy::callMany("len", std::vector<std::string>()).empty());
+
+    std::vector<double> negative = {4.0, -1.0};
+    BOOST_CHECK_THROW(wrappy::callMany<double>("math.sqrt", negative), wrappy::PythonError);
+    BOOST_CHECK_THROW(wrappy::callMany<double>("math.sqrt", negative, wrappy::Batch::Map),
+        wrappy::PythonError);
+}
+
+BOOST_AUTO_TEST_CASE(call_overhead)
+{
+    // Runs as the "counters" test against a library built with them
+#ifdef WRAPPY_EXPECT_COUNTERS
+    BOOST_REQUIRE(wrappy::debug::countersEnabled());
+#endif
+    if (!wrappy::debug::countersEnabled()) {
+        BOOST_TEST_MESSAGE("call_overhead skipped, the library has no debug counters");
+        return;
+    }
+
+    wrappy::call("math.sqrt", 4.0); // warm up the name cache
+    wrappy::debug::resetCounters();
+    wrappy::call("math.sqrt", 4.0);
+    auto counters = wrappy::debug::counters();
+
+    // The argument tuple, and one reference to the cached function.
+    // The argument itself is moved into the tuple, so the only other
+    // decrefs dispose of the tuple and the result. Vectorcall needs no
+    // tuple, the argument is disposed of instead.
+    bool vectorcall = wrappy::debug::vectorcallEnabled();
+    BOOST_CHECK_EQUAL(counters.allocations, vectorcall ? 0u : 1u);
+    BOOST_CHECK_EQUAL(counters.increfs, 1u);
+    BOOST_CHECK_EQUAL(counters.decrefs, 3u);
+
+    wrappy::call("datetime.timedelta", std::make_pair("hours", 1));
+    wrappy::debug::resetCounters();
+    wrappy::call("datetime.timedelta", std::make_pair("hours", 1));
+    counters = wrappy::debug::counters();
+
+    // Keyword arguments additionally need the kwargs dict, which takes
+    // its own reference to the value. Vectorcall only needs a tuple of
+    // keyword names.
+    BOOST_CHECK_EQUAL(counters.allocations, vectorcall ? 1u : 2u);
+    BOOST_CHECK_EQUAL(counters.increfs, 1u);
+    BOOST_CHECK_EQUAL(counters.decrefs, vectorcall ? 4u : 5u);
+}
+
+BOOST_AUTO_TEST_CASE(containers)
+{
+    std::vector<std::vector<int>> nested {{1, 2}, {3}};
+    BOOST_CHECK_EQUAL(wrappy::call("str", nested).str(), std::string("[[1, 2], [3]]"));
+
+    auto tuple = std::make_tuple(1, std::string("a"), 2.5, true);
+    BOOST_CHECK_EQUAL(wrappy::call("str", tuple).str(), std::string("(1, 'a', 2.5, True)"));
+
+    std::map<std::string, double> map {{"a", 1.0}, {"b", 2.0}};
+    auto dict = wrappy::construct(map);
+    BOOST_CHECK_EQUAL(wrappy::call("len", dict).num(), 2);
+    BOOST_CHECK_EQUAL(wrappy::call("operator.getitem", dict, "b").floating(), 2.0);
+
+    std::set<size_t> set {1, 2, 2, 3};
+    auto pyset = wrappy::construct(set);
+    BOOST_CHECK_EQUAL(wrappy::call("len", pyset).num(), 3);
+    BOOST_CHECK(wrappy::call("operator.contains", pyset, 2).num());
+
+#if __cplusplus >= 201703L
+    BOOST_CHECK(wrappy::construct(std::optional<int>()).get() == wrappy::None.get());
+    BOOST_CHECK_EQUAL(wrappy::construct(std::optional<int>(3)).num(), 3);
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(streaming)
+{
+    BOOST_CHECK_EQUAL(wrappy::call("sum", wrappy::constructIter(std::vector<int> {1, 2, 3})).num(), 6);
+
+    std::vector<std::string> words {"a", "b", "c"};
+    auto joined = wrappy::call(wrappy::construct(","), "join",
+        wrappy::constructIter(words.begin(), words.end()));
+    BOOST_CHECK_EQUAL(joined.str(), "a,b,c");
+
+    auto chunks = wrappy::call("list", wrappy::constructIter(words, 2));
+    BOOST_CHECK_EQUAL(wrappy::call("str", chunks).str(), "[['a', 'b'], ['c']]");
+
+    // Elements are only produced on demand
+    int produced = 0;
+    auto counter = wrappy::constructIter([&](int& next) {
+        next = produced++;
+        return true;
+    });
+    auto head = wrappy::call("list", wrappy::call("itertools.islice", counter, 3));
+    BOOST_CHECK_EQUAL(wrappy::call("len", head).num(), 3);
+    BOOST_CHECK_EQUAL(produced, 3);
+
+    int remaining = 2;
+    auto failing = wrappy::constructIter([&](int& next) -> bool {
+        if (!remaining--) {
+            throw std::runtime_error("generator failed");
+        }
+        next = remaining;
+        return true;
+    });
+    BOOST_CHECK_THROW(wrappy::call("list", failing), wrappy::PythonError);
+
+    // Python 3 can't decode the second word, the error isn't lost in a chunk
+    if (wrappy::load("sys").attr("version_info").attr("major").num() >= 3) {
+        std::vector<std::string> invalid {"a", "\xff", "c"};
+        try {
+            wrappy::call("next", wrappy::constructIter(invalid, 2));
+            BOOST_ERROR("Expected UnicodeDecodeError");
+        } catch (const wrappy::PythonError& e) {
+            BOOST_CHECK(e.matches(wrappy::load("UnicodeDecodeError")));
+        }
+    }
+
+#if __cplusplus >= 201703L
+    int n = 0;
+    auto optional = wrappy::constructIter([&]() {
+        return n < 4 ? std::optional<int>(n++) : std::nullopt;
+    });
+    BOOST_CHECK_EQUAL(wrappy::call("sum", optional).num(), 6);
+#endif
+}
+
+BOOST_AUTO_TEST_CASE(conversions)
+{
+    auto squares = wrappy::call("map", wrappy::load("float"), std::vector<int> {1, 4, 9});
+    auto v = squares.as<std::vector<double>>();
+    BOOST_CHECK_EQUAL(v.size(), 3u);
+    BOOST_CHECK_EQUAL(v[2], 9.0);
+
+    std::map<std::string, int> m {{"a", 1}, {"b", 2}};
+    auto um = wrappy::construct(m).as<std::unordered_map<std::string, long long>>();
+    BOOST_CHECK_EQUAL(um.at("b"), 2);
+
+    auto t = wrappy::call("divmod", 7, 2).as<std::tuple<int, int>>();
+    BOOST_CHECK_EQUAL(std::get<0>(t), 3);
+    BOOST_CHECK_EQUAL(std::get<1>(t), 1);
+
+    auto items = wrappy::fromPython<std::vector<std::pair<std::string, int>>>(
+        wrappy::call("sorted", wrappy::call(wrappy::construct(m), "items")));
+    BOOST_CHECK_EQUAL(items[1].first, "b");
+
+    BOOST_CHECK_THROW(wrappy::construct("abc").as<double>(), wrappy::WrappyError);
+    BOOST_CHECK_THROW(wrappy::construct(1.5).as<int>(), wrappy::WrappyError);
+    BOOST_CHECK_THROW(wrappy::construct(1ll << 40).as<int>(), wrappy::WrappyError);
+    BOOST_CHECK_THROW(wrappy::construct(-1).as<unsigned int>(), wrappy::WrappyError);
+
+    // Beyond long long
+    auto max = wrappy::eval("2**64 - 1");
+    BOOST_CHECK_EQUAL(max.as<unsigned long long>(), 18446744073709551615ull);
+    BOOST_CHECK_EQUAL(wrappy::construct(18446744073709551615ull).as<unsigned long long>(),
+        18446744073709551615ull);
+    if (sizeof(unsigned long) == 8) {
+        BOOST_CHECK_EQUAL(wrappy::eval("2**63").as<unsigned long>(), 1ull << 63);
+    }
+    BOOST_CHECK_THROW(wrappy::eval("2**64").as<unsigned long long>(), wrappy::WrappyError);
+    BOOST_CHECK_THROW(wrappy::construct(-1).as<unsigned long long>(), wrappy::WrappyError);
+    BOOST_CHECK_THROW(max.as<long long>(), wrappy::WrappyError);
+    BOOST_CHECK_THROW(wrappy::construct(1).as<std::vector<int>>(), wrappy::WrappyError);
+    BOOST_CHECK_THROW(wrappy::call("divmod", 7, 2).as<std::tuple<int>>(), wrappy::WrappyError);
+}
@@ -0,0 +1,112 @@
+#define BOOST_TEST_MODULE threads
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include <wrappy/wrappy.h>
+
+#include <thread>
+
+namespace {
+
+struct ThreadedMode {
+    ThreadedMode() { wrappy::enableThreads(); }
+};
+
+wrappy::PythonObject releasingCallback(
+    const std::vector<wrappy::PythonObject>&,
+    const std::map<const char*, wrappy::PythonObject>&)
+{
+    // Another thread can only make progress while we don't hold the GIL
+    double res;
+    {
+        wrappy::GilRelease release;
+        std::thread worker([&]() { res = wrappy::call("math.sqrt", 16.0).floating(); });
+        worker.join();
+    }
+    return wrappy::construct(res);
+}
+
+} // end unnamed namespace
+
+BOOST_GLOBAL_FIXTURE(ThreadedMode);
+
+BOOST_AUTO_TEST_CASE(concurrent_calls)
+{
+    BOOST_CHECK(wrappy::threadsEnabled());
+
+    wrappy::Function<double(double)> sqrt("math.sqrt");
+    std::vector<std::thread> threads;
+    std::vector<double> sums(8);
+    for (size_t t = 0; t < sums.size(); ++t) {
+        threads.emplace_back([&, t]() {
+            for (int i = 0; i < 1000; ++i) {
+                sums[t] += sqrt(4.0) + wrappy::call("math.sqrt", 9.0).floating();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    for (double sum : sums) {
+        BOOST_CHECK_EQUAL(sum, 5000.0);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(shared_objects)
+{
+    auto list = wrappy::construct(std::vector<int> {1, 2, 3});
+    std::vector<std::thread> threads;
+    for (int t = 0; t < 8; ++t) {
+        threads.emplace_back([&]() {
+            for (int i = 0; i < 1000; ++i) {
+                wrappy::PythonObject copy = list;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    // One reference held by `list`, one by the argument tuple
+    wrappy::GilAcquire gil;
+    BOOST_CHECK_EQUAL(wrappy::call("sys.getrefcount", list).num(), 2);
+}
+
+BOOST_AUTO_TEST_CASE(release_in_callback)
+{
+    auto callback = wrappy::construct(&releasingCallback);
+    BOOST_CHECK_EQUAL(callback().floating(), 4.0);
+}
+
+BOOST_AUTO_TEST_CASE(deferred_decref)
+{
+    wrappy::setDeferredDecref(true);
+
+    auto list = wrappy::construct(std::vector<int> {1, 2, 3});
+    std::vector<wrappy::PythonObject> copies;
+    {
+        wrappy::GilAcquire gil;
+        copies.assign(100, list);
+    }
+
+    // Destroyed without holding the GIL
+    std::thread worker([&]() { copies.clear(); });
+    worker.join();
+
+    auto stats = wrappy::deferredDecrefStats();
+    BOOST_CHECK_EQUAL(stats.depth, 100u);
+    BOOST_CHECK_EQUAL(stats.deferred, 100u);
+
+    wrappy::flushDeferredDecrefs();
+    stats = wrappy::deferredDecrefStats();
+    BOOST_CHECK_EQUAL(stats.depth, 0u);
+    BOOST_CHECK_EQUAL(stats.maxDepth, 100u);
+    BOOST_CHECK_EQUAL(stats.drains, 1u);
+
+    wrappy::GilAcquire gil;
+    BOOST_CHECK_EQUAL(wrappy::call("sys.getrefcount", list).num(), 2);
+    wrappy::setDeferredDecref(false);
+}
@@ -0,0 +1,112 @@
+#define BOOST_TEST_MODULE trace
+#define BOOST_TEST_DYN_LINK
+#define BOOST_TEST_MAIN
+
+#include <boost/test/unit_test.hpp>
+
+#include <wrappy/wrappy.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+namespace {
+
+struct ThreadedMode {
+    ThreadedMode() { wrappy::enableThreads(); }
+};
+
+size_t count(const std::string& str, const std::string& part)
+{
+    size_t res = 0;
+    for (size_t pos = str.find(part); pos != std::string::npos; pos = str.find(part, pos + 1)) {
+        ++res;
+    }
+    return res;
+}
+
+} // end unnamed namespace
+
+BOOST_GLOBAL_FIXTURE(ThreadedMode);
+
+BOOST_AUTO_TEST_CASE(events)
+{
+    wrappy::trace::start();
+    BOOST_CHECK(wrappy::trace::enabled());
+    wrappy::call("math.sqrt", 4.0);
+    auto callback = wrappy::construct([](double x) { return x * 2; });
+    wrappy::call("list", wrappy::call("map", callback, std::vector<double> {1.0, 2.0}));
+    for (const auto& item : wrappy::call("iter", std::vector<int> {1, 2, 3})) {
+        (void)item;
+    }
+    wrappy::trace::stop();
+    wrappy::call("math.sqrt", 9.0);
+
+    std::string json = wrappy::trace::dumpJson();
+    BOOST_CHECK_EQUAL(count(json, "\"name\": \"math.sqrt\", \"cat\": \"call\", \"ph\": \"X\""), 1u);
+    BOOST_CHECK_EQUAL(count(json, "\"cat\": \"load\""), 4u);
+    BOOST_CHECK_EQUAL(count(json, "\"cat\": \"iterate\""), 4u);
+    BOOST_CHECK(json.find("\"cat\": \"callback\"") != std::string::npos);
+    BOOST_CHECK_EQUAL(count(json, "\"cat\": \"python\""), 0u);
+
+    auto stats = wrappy::trace::stats();
+    BOOST_CHECK_EQUAL(stats.events, count(json, "\"ph\": \"X\""));
+    BOOST_CHECK_EQUAL(stats.dropped, 0u);
+    BOOST_CHECK_EQUAL(stats.threads, 1u);
+
+    // A new trace starts empty
+    wrappy::trace::start();
+    wrappy::trace::stop();
+    BOOST_CHECK_EQUAL(wrappy::trace::stats().events, 0u);
+    BOOST_CHECK_EQUAL(count(wrappy::trace::dumpJson(), "\"ph\""), 0u);
+}
+
+BOOST_AUTO_TEST_CASE(python_frames)
+{
+    auto ns = wrappy::exec(
+        "def inner(x):\n"
+        "    return x + 1\n"
+        "def outer(x):\n"
+        "    return inner(x) * 2\n");
+    auto outer = wrappy::call(ns, "__getitem__", "outer");
+
+    wrappy::trace::Options options;
+    options.pythonFrames = true;
+    wrappy::trace::start(options);
+    BOOST_CHECK_EQUAL(wrappy::call(outer, "__call__", 1).num(), 4);
+    std::thread thread([&]() { wrappy::call(outer, "__call__", 2); });
+    thread.join();
+    wrappy::trace::stop();
+    wrappy::call(outer, "__call__", 3);
+
+    std::string json = wrappy::trace::dumpJson();
+    BOOST_CHECK_EQUAL(count(json, "\"name\": \"inner\", \"cat\": \"python\""), 2u);
+    BOOST_CHECK_EQUAL(count(json, "\"name\": \"outer\", \"cat\": \"python\""), 2u);
+    BOOST_CHECK(json.find("\"args\": {\"location\": \"<wrappy>:1\"}") != std::string::npos);
+    BOOST_CHECK_EQUAL(wrappy::trace::stats().threads, 2u);
+}
+
+BOOST_AUTO_TEST_CASE(buffer_limit)
+{
+    wrappy::trace::Options options;
+    options.bufferBytes = 1;
+    wrappy::trace::start(options);
+    for (int i = 0; i < 10000; ++i) {
+        wrappy::call("math.sqrt", 4.0);
+    }
+    wrappy::trace::stop();
+
+    auto stats = wrappy::trace::stats();
+    BOOST_CHECK(stats.events > 0u);
+    BOOST_CHECK(stats.dropped > 0u);
+
+    wrappy::trace::writeJson("trace_test.json");
+    std::ifstream file("trace_test.json");
+    std::stringstream contents;
+    contents << file.rdbuf();
+    BOOST_CHECK_EQUAL(contents.str(), wrappy::trace::dumpJson());
+    std::remove("trace_test.json");
+    BOOST_CHECK_THROW(wrappy::trace::writeJson("/nonexistent/trace.json"), wrappy::WrappyError);
+}
@@ -0,0 +1,418 @@
+// Python header must be included first since they insist on
+// unconditionally defining some system macros
+// (http://bugs.python.org/issue1045893, still broken in python3.4)
+#include <Python.h>
+#include "python_compat.h"
+#if PY_VERSION_HEX < 0x03090000
+#include <frameobject.h>
+#endif
+
+#include <wrappy/wrappy.h>
+#include <wrappy/trace.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include <unistd.h>
+
+namespace wrappy {
+namespace detail {
+
+std::atomic<bool> traceEnabled(false);
+
+} // end namespace detail
+} // end namespace wrappy
+
+namespace {
+
+using namespace wrappy;
+
+std::atomic<bool>& s_Enabled = detail::traceEnabled;
+std::atomic<bool> s_PythonFrames(false);
+std::atomic<size_t> s_BufferBytes(0);
+std::atomic<unsigned> s_Session(0); // incremented by every start()
+std::atomic<unsigned long long> s_Origin(0);
+
+unsigned long long now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Followed by the name and location, padded to a multiple of 8 bytes
+struct Event {
+    unsigned long long start;
+    unsigned long long duration;
+    const char* category; // string literal
+    uint32_t nameSize;
+    uint32_t locationSize;
+};
+
+const size_t s_MaxName = 1024;
+
+struct Chunk {
+    static const size_t Size = 64 << 10;
+
+    Chunk() : used(0), next(nullptr) { }
+
+    std::atomic<size_t> used; // published after the events are written
+    std::atomic<Chunk*> next;
+    char data[Size];
+};
+
+// The events of one thread. Only that thread appends, readers see the
+// events published so far. Chunks are reused by the next trace, but never
+// freed, so readers need no lock.
+class ThreadBuffer {
+public:
+    explicit ThreadBuffer(size_t tid)
+      : tid_(tid)
+      , session_(0)
+      , first_(new Chunk())
+      , current_(first_)
+      , bytes_(Chunk::Size)
+      , events_(0)
+      , dropped_(0)
+    { }
+
+    void append(const char* category, const char* name, size_t nameSize,
+        const char* location, size_t locationSize,
+        unsigned long long start, unsigned long long end)
+    {
+        unsigned session = s_Session.load(std::memory_order_acquire);
+        if (session != session_.load(std::memory_order_relaxed)) {
+            reset(session);
+        }
+        unsigned long long origin = s_Origin.load(std::memory_order_relaxed);
+        if (start < origin) {
+            return; // started during the previous trace
+        }
+
+        nameSize = std::min(nameSize, s_MaxName);
+        locationSize = std::min(locationSize, s_MaxName);
+        size_t size = (sizeof(Event) + nameSize + locationSize + 7) & ~size_t(7);
+        size_t used = current_->used.load(std::memory_order_relaxed);
+        if (used + size > Chunk::Size) {
+            if (!next()) {
+                dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                return;
+            }
+            used = 0;
+        }
+
+        char* dst = current_->data + used;
+        Event event = {start - origin, end - start,
+            category, uint32_t(nameSize), uint32_t(locationSize)};
+        std::memcpy(dst, &event, sizeof(Event));
+        std::memcpy(dst + sizeof(Event), name, nameSize);
+        std::memcpy(dst + sizeof(Event) + nameSize, location, locationSize);
+        current_->used.store(used + size, std::memory_order_release);
+        events_.store(events_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    bool current() const
+    {
+        unsigned session = s_Session.load(std::memory_order_acquire);
+        return session && session_.load(std::memory_order_acquire) == session;
+    }
+
+    // Calls f(event, name, location) for every event published so far
+    template<typename F>
+    void forEach(F f) const
+    {
+        for (Chunk* chunk = first_; chunk; chunk = chunk->next.load(std::memory_order_acquire)) {
+            size_t used = chunk->used.load(std::memory_order_acquire);
+            for (size_t offset = 0; offset < used; ) {
+                Event event;
+                std::memcpy(&event, chunk->data + offset, sizeof(Event));
+                const char* name = chunk->data + offset + sizeof(Event);
+                f(event, std::string(name, event.nameSize),
+                    std::string(name + event.nameSize, event.locationSize));
+                offset += (sizeof(Event) + event.nameSize + event.locationSize + 7) & ~size_t(7);
+            }
+        }
+    }
+
+    size_t tid() const { return tid_; }
+    unsigned long long events() const { return events_.load(std::memory_order_relaxed); }
+    unsigned long long dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    // Moves on to the next chunk, within the size limit
+    bool next()
+    {
+        Chunk* chunk = current_->next.load(std::memory_order_relaxed);
+        if (!chunk) {
+            if (bytes_ + Chunk::Size > s_BufferBytes.load(std::memory_order_relaxed)) {
+                return false;
+            }
+            chunk = new Chunk();
+            current_->next.store(chunk, std::memory_order_release);
+        }
+        bytes_ += Chunk::Size;
+        current_ = chunk;
+        return true;
+    }
+
+    // Readers skip the buffer until it belongs to the new trace
+    void reset(unsigned session)
+    {
+        for (Chunk* chunk = first_; chunk; chunk = chunk->next.load(std::memory_order_relaxed)) {
+            chunk->used.store(0, std::memory_order_relaxed);
+        }
+        current_ = first_;
+        bytes_ = Chunk::Size;
+        events_.store(0, std::memory_order_relaxed);
+        dropped_.store(0, std::memory_order_relaxed);
+        session_.store(session, std::memory_order_release);
+    }
+
+    const size_t tid_;
+    std::atomic<unsigned> session_;
+    Chunk* const first_;
+    Chunk* current_;
+    size_t bytes_;
+    std::atomic<unsigned long long> events_;
+    std::atomic<unsigned long long> dropped_;
+};
+
+// Guards the lists below. Buffers are never destroyed, a thread that exits
+// leaves its events to the next thread.
+std::mutex s_Mutex;
+std::vector<ThreadBuffer*>& s_Buffers = *new std::vector<ThreadBuffer*>();
+std::vector<ThreadBuffer*>& s_FreeBuffers = *new std::vector<ThreadBuffer*>();
+
+class BufferHolder {
+public:
+    BufferHolder() : buffer_(nullptr) { }
+
+    ~BufferHolder()
+    {
+        if (buffer_) {
+            std::lock_guard<std::mutex> lock(s_Mutex);
+            s_FreeBuffers.push_back(buffer_);
+        }
+    }
+
+    ThreadBuffer& get()
+    {
+        if (!buffer_) {
+            std::lock_guard<std::mutex> lock(s_Mutex);
+            if (!s_FreeBuffers.empty()) {
+                buffer_ = s_FreeBuffers.back();
+                s_FreeBuffers.pop_back();
+            } else {
+                buffer_ = new ThreadBuffer(s_Buffers.size() + 1);
+                s_Buffers.push_back(buffer_);
+            }
+        }
+        return *buffer_;
+    }
+
+private:
+    ThreadBuffer* buffer_;
+};
+
+thread_local BufferHolder t_Buffer;
+
+//
+// Python frames
+//
+
+thread_local unsigned t_Hooked = 0; // the trace the profile hook belongs to
+thread_local std::vector<unsigned long long> t_Frames; // start times
+
+std::string codeString(PyObject* str)
+{
+    const char* res = str ? compat::asString(str) : nullptr;
+    if (!res) {
+        PyErr_Clear();
+        return "?";
+    }
+    return res;
+}
+
+void recordFrame(PyFrameObject* frame, unsigned long long start)
+{
+#if PY_VERSION_HEX >= 0x03090000
+    PythonObject owner(PythonObject::owning {}, reinterpret_cast<PyObject*>(PyFrame_GetCode(frame)));
+    PyCodeObject* code = reinterpret_cast<PyCodeObject*>(owner.get());
+#else
+    PyCodeObject* code = frame->f_code;
+#endif
+#if PY_VERSION_HEX >= 0x030B0000
+    std::string name = codeString(code->co_qualname);
+#else
+    std::string name = codeString(code->co_name);
+#endif
+    std::string location = codeString(code->co_filename) + ":" + std::to_string(code->co_firstlineno);
+    t_Buffer.get().append("python", name.data(), name.size(),
+        location.data(), location.size(), start, now());
+}
+
+int profile(PyObject*, PyFrameObject* frame, int what, PyObject*)
+{
+    // Removes itself once the trace is over
+    if (!s_Enabled.load(std::memory_order_relaxed)
+        || t_Hooked != s_Session.load(std::memory_order_relaxed)) {
+        PyEval_SetProfile(nullptr, nullptr);
+        t_Hooked = 0;
+        t_Frames.clear();
+        return 0;
+    }
+
+    // Frames that started before the hook return with an empty stack
+    if (what == PyTrace_CALL) {
+        t_Frames.push_back(now());
+    } else if (what == PyTrace_RETURN && !t_Frames.empty()) {
+        unsigned long long start = t_Frames.back();
+        t_Frames.pop_back();
+
+        // The frame may return with an exception set
+        PyObject *type, *value, *traceback;
+        PyErr_Fetch(&type, &value, &traceback);
+        recordFrame(frame, start);
+        PyErr_Restore(type, value, traceback);
+    }
+    return 0;
+}
+
+// Called with the GIL held
+void installHook()
+{
+    unsigned session = s_Session.load(std::memory_order_relaxed);
+    if (t_Hooked != session) {
+        t_Frames.clear();
+        t_Hooked = session;
+        PyEval_SetProfile(profile, nullptr);
+    }
+}
+
+} // end unnamed namespace
+
+namespace wrappy {
+namespace trace {
+
+void start(const Options& options)
+{
+    s_Enabled = false;
+    s_PythonFrames = options.pythonFrames;
+    s_BufferBytes = options.bufferBytes;
+    s_Origin = now();
+    ++s_Session;
+    s_Enabled = true;
+
+    if (options.pythonFrames) {
+        detail::AutoGil gil;
+        installHook();
+    }
+}
+
+void stop()
+{
+    s_Enabled = false;
+}
+
+bool enabled()
+{
+    return s_Enabled;
+}
+
+Stats stats()
+{
+    Stats res = {0, 0, 0};
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    for (const ThreadBuffer* buffer : s_Buffers) {
+        if (buffer->current() && buffer->events()) {
+            res.events += buffer->events();
+            res.dropped += buffer->dropped();
+            ++res.threads;
+        }
+    }
+    return res;
+}
+
+std::string dumpJson()
+{
+    std::ostringstream out;
+    out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+
+    const char* separator = "\n";
+    char numbers[128];
+    long pid = getpid();
+    std::lock_guard<std::mutex> lock(s_Mutex);
+    for (const ThreadBuffer* buffer : s_Buffers) {
+        if (!buffer->current()) {
+            continue;
+        }
+        buffer->forEach([&](const Event& event, const std::string& name, const std::string& location) {
+            // Microseconds, with nanosecond precision
+            std::snprintf(numbers, sizeof(numbers),
+                "\"ts\": %llu.%03llu, \"dur\": %llu.%03llu, \"pid\": %ld, \"tid\": %zu",
+                event.start / 1000, event.start % 1000, event.duration / 1000, event.duration % 1000,
+                pid, buffer->tid());
+            out << separator << "{\"name\": \"" << detail::escapeJson(name)
+                << "\", \"cat\": \"" << event.category << "\", \"ph\": \"X\", " << numbers;
+            if (!location.empty()) {
+                out << ", \"args\": {\"location\": \"" << detail::escapeJson(location) << "\"}";
+            }
+            out << "}";
+            separator = ",\n";
+        });
+    }
+    out << "\n]}\n";
+    return out.str();
+}
+
+void writeJson(const std::string& path)
+{
+    std::ofstream file(path.c_str());
+    file << dumpJson();
+    if (!file) {
+        throw WrappyError("Wrappy: Couldn't write trace to " + path + ".");
+    }
+}
+
+} // end namespace trace
+
+namespace detail {
+
+unsigned long long traceClock()
+{
+    if (!s_Enabled.load(std::memory_order_relaxed)) {
+        return 0;
+    }
+    if (s_PythonFrames.load(std::memory_order_relaxed)) {
+        installHook();
+    }
+    return now();
+}
+
+void recordTrace(const char* category, const char* name, size_t size,
+    unsigned long long start, unsigned long long end)
+{
+    if (s_Enabled.load(std::memory_order_relaxed)) {
+        t_Buffer.get().append(category, name, size, "", 0, start, end);
+    }
+}
+
+void TraceScope::finish()
+{
+    unsigned long long end = now();
+    if (name_) {
+        recordTrace(category_, name_->data(), name_->size(), start_, end);
+    } else {
+        recordTrace(category_, cname_, std::strlen(cname_), start_, end);
+    }
+}
+
+} // end namespace detail
+} // end namespace wrappy
@@ -0,0 +1,7 @@
+#include <wrappy/process_pool.h>
+
+// The worker processes of wrappy::ProcessPool
+int main(int argc, char** argv)
+{
+    return wrappy::ProcessPool::workerMain(argc, argv);
+}
@@ -2,16 +2,34 @@
 // unconditionally defining some system macros
 // (http://bugs.python.org/issue1045893, still broken in python3.4)
 #include <Python.h>
+#include "python_compat.h"
 
 #include <wrappy/wrappy.h>
+#include <wrappy/interpreter_pool.h>
+#include <wrappy/metrics.h>
+#include <wrappy/memory.h>
+#include <wrappy/trace.h>
+#include <wrappy/detail/lru_cache.hpp>
 
 #include <iostream>
+#include <atomic>
+#include <chrono>
 #include <mutex>
+#include <thread>
 #include <cstdio>
+#include <cstdlib>
+
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
 
 namespace wrappy {
 
-PythonObject None, True, False;
+// The singletons are static objects inside libpython, so they can be
+// referenced before the interpreter is initialized.
+PythonObject None(PythonObject::borrowed {}, Py_None);
+PythonObject True(PythonObject::borrowed {}, Py_True);
+PythonObject False(PythonObject::borrowed {}, Py_False);
 
 } // end namespace wrappy
 
@@ -19,43 +37,385 @@ namespace {
 
 using namespace wrappy;
 
-PyObject *s_EmptyTuple;
-PyObject *s_EmptyDict;
+#ifdef WRAPPY_DEBUG_COUNTERS
+std::atomic<unsigned long long> s_Allocations(0);
+std::atomic<unsigned long long> s_Increfs(0);
+std::atomic<unsigned long long> s_Decrefs(0);
+# define WRAPPY_COUNT(counter, n) ((counter) += (n))
+#else
+# define WRAPPY_COUNT(counter, n) ((void)0)
+#endif
+
+// Reference counting that is visible to the debug counters
+inline void incref(PyObject* obj)
+{
+    if (obj) {
+        WRAPPY_COUNT(s_Increfs, 1);
+        Py_INCREF(obj);
+    }
+}
+
+inline void decref(PyObject* obj)
+{
+    if (obj) {
+        WRAPPY_COUNT(s_Decrefs, 1);
+        Py_DECREF(obj);
+    }
+}
+
+// Threaded mode, see enableThreads()
+std::atomic<bool> s_ThreadsEnabled(false);
+PyThreadState* s_MainThreadState = nullptr;
+
+// Set while the current thread holds the GIL of a sub-interpreter,
+// see InterpreterPool
+thread_local wrappy::detail::InterpreterContext* t_SubinterpreterContext = nullptr;
+
+inline bool threaded()
+{
+    return s_ThreadsEnabled.load(std::memory_order_relaxed);
+}
+
+bool holdsGil()
+{
+    if (t_SubinterpreterContext) {
+        return true;
+    }
+#if PY_VERSION_HEX >= 0x03040000
+    return PyGILState_Check();
+#else
+    // The thread state of the thread holding the GIL is current
+    PyThreadState* current = _PyThreadState_Current;
+    return current && current == PyGILState_GetThisThreadState();
+#endif
+}
+
+// Deferred decrefs, see setDeferredDecref(). Objects are pushed onto
+// a lock-free stack by any thread, and the whole stack is taken over
+// at once by a thread holding the GIL, so there is no ABA problem.
+struct DeferredDecref {
+    PyObject* obj;
+    DeferredDecref* next;
+};
+
+std::atomic<bool> s_DeferDecrefs(false);
+std::atomic<DeferredDecref*> s_DeferredHead(nullptr);
+std::atomic<size_t> s_DeferredDepth(0);
+std::atomic<size_t> s_DeferredMaxDepth(0);
+std::atomic<unsigned long long> s_DeferredTotal(0);
+std::atomic<unsigned long long> s_DeferredDrains(0);
+
+void deferDecref(PyObject* obj)
+{
+    // Counted before the node is visible, so that a concurrent drain never
+    // subtracts more than was added
+    ++s_DeferredTotal;
+    size_t depth = ++s_DeferredDepth;
+    size_t max = s_DeferredMaxDepth.load(std::memory_order_relaxed);
+    while (depth > max && !s_DeferredMaxDepth.compare_exchange_weak(max, depth))
+    { }
+
+    auto node = new DeferredDecref {obj, s_DeferredHead.load(std::memory_order_relaxed)};
+    while (!s_DeferredHead.compare_exchange_weak(node->next, node,
+        std::memory_order_release, std::memory_order_relaxed))
+    { }
+}
+
+// Must be called with the GIL held
+void drainDeferredDecrefs()
+{
+    if (!s_DeferredHead.load(std::memory_order_relaxed)) {
+        return;
+    }
+
+    DeferredDecref* node = s_DeferredHead.exchange(nullptr, std::memory_order_acquire);
+    size_t count = 0;
+    while (node) {
+        decref(node->obj);
+        DeferredDecref* next = node->next;
+        delete node;
+        node = next;
+        ++count;
+    }
+
+    s_DeferredDepth -= count;
+    if (count) {
+        ++s_DeferredDrains;
+    }
+}
+
+// Resolution cache for callWithArgs(from, name), keyed by the identity of
+// `from` and the (dot-prefixed) attribute name. Every entry keeps `from`
+// alive, so the address in the key can not be reused by another object
+// while the entry exists.
+struct MethodKey {
+    PyObject* object;
+    std::string name;
+
+    bool operator==(const MethodKey& other) const {
+        return object == other.object && name == other.name;
+    }
+};
+
+struct MethodKeyHash {
+    size_t operator()(const MethodKey& key) const {
+        return std::hash<PyObject*>()(key.object) ^ std::hash<std::string>()(key.name);
+    }
+};
+
+struct MethodEntry {
+    PythonObject owner;
+    PythonObject method;
+};
+
+// Compiled code for eval() and exec(), keyed by the compile mode
+// (Py_eval_input or Py_file_input) and the hash of the source text, so
+// that a lookup doesn't copy the source. The entry holds the source to
+// tell hash collisions apart.
+struct CodeKey {
+    int mode;
+    size_t hash;
+
+    bool operator==(const CodeKey& other) const {
+        return mode == other.mode && hash == other.hash;
+    }
+};
+
+struct CodeKeyHash {
+    size_t operator()(const CodeKey& key) const {
+        return key.hash ^ static_cast<size_t>(key.mode);
+    }
+};
+
+struct CodeEntry {
+    std::string source;
+    PythonObject code;
+};
+
+// Metrics name of a function object. The weak reference tells whether the
+// address of the key still belongs to the same function.
+struct CallSite {
+    PythonObject function;
+    std::string name;
+};
+
+} // end unnamed namespace
+
+namespace wrappy {
+namespace detail {
+
+// Per-interpreter state. The main interpreter uses s_MainContext, threads
+// running inside a sub-interpreter of an InterpreterPool use their own.
+struct InterpreterContext {
+    InterpreterContext(size_t nameCapacity, size_t methodCapacity, size_t missingCapacity,
+        size_t codeCapacity)
+      : names(nameCapacity)
+      , methods(methodCapacity)
+      , missing(missingCapacity)
+      , code(codeCapacity)
+      , sites(nameCapacity)
+    { }
+
+    // Resolution cache for load(), keyed by the fully qualified name.
+    LruCache<std::string, PythonObject> names;
+    LruCache<MethodKey, MethodEntry, MethodKeyHash> methods;
+
+    // Names that load() couldn't find, with the error message. Saves
+    // running the import machinery again for optional modules.
+    LruCache<std::string, std::string> missing;
+
+    // Code objects compiled by eval() and exec()
+    LruCache<CodeKey, CodeEntry, CodeKeyHash> code;
+
+    // Interned strings of Names, keyed by the address of their characters
+    std::unordered_map<const char*, PythonObject> interned;
+
+    // Call site names of functions called while metrics are enabled
+    LruCache<PyObject*, CallSite> sites;
+
+#ifdef WRAPPY_HEAP_TYPES
+    // wrappy's python types in this interpreter, keyed by their spec
+    std::unordered_map<PyType_Spec*, PythonObject> types;
+#endif
+};
+
+// Ready the python types, defined next to the types
+void readyBufferType();
+void readyStreamType();
+
+#ifdef WRAPPY_HEAP_TYPES
+// The type created from spec for the current interpreter, borrowed.
+// Must be called with the GIL held.
+PyTypeObject* interpreterType(PyType_Spec* spec);
+#endif
+
+} // end namespace detail
+} // end namespace wrappy
+
+namespace {
+
+detail::InterpreterContext s_MainContext(256, 0, 256, 128);
 
-__attribute__((constructor))
-void wrappyInitialize()
+detail::InterpreterContext& context()
 {
-    // Initialize python interpreter.
-    // The module search path is initialized as following:
-    // Python looks at PATH to find an executable called "python"
-    // The name that is searched can be changed by calling Py_SetProgramName()
-    // before Py_Initialize(). The folder where this executable resides is
-    // python-home, which can be overwritten at runtime by setting $PYTHONHOME.
-    // The default module search path is then
-    //
-    //     <python-home>/../lib/<python-version>/
-    //
-    // All entries from $PYTHONPATH are pre-pended to the module search path
+    return t_SubinterpreterContext ? *t_SubinterpreterContext : s_MainContext;
+}
+
+// Interpreter startup, see initialize()
+std::once_flag s_InitializeOnce;
+std::atomic<bool> s_Initialized(false);
+bool s_OwnsInterpreter = false;
+
+std::mutex s_StartupMutex;
+StartupStats s_StartupStats = {};
+std::thread* s_PreImportThread = nullptr; // never destroyed, see wrappyFinalize()
+
+double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+void startInterpreter(const Config& config)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    // An application embedding python itself keeps ownership of it
+    s_OwnsInterpreter = !Py_IsInitialized();
+    if (s_OwnsInterpreter) {
+        // The module search path is initialized as following:
+        // Python looks at PATH to find an executable called "python"
+        // The name that is searched can be changed by calling Py_SetProgramName()
+        // before Py_Initialize(). The folder where this executable resides is
+        // python-home, which can be overwritten at runtime by setting $PYTHONHOME.
+        // The default module search path is then
+        //
+        //     <python-home>/../lib/<python-version>/
+        //
+        // All entries from $PYTHONPATH are pre-pended to the module search path,
+        // unless config.isolated is set.
+
+        // Setting a dummy value since many libraries require sys.argv[0] to exist
+#if PY_VERSION_HEX >= 0x03080000
+        wchar_t* dummy_args[] = {const_cast<wchar_t*>(L"wrappy"), nullptr};
+        PyConfig pyConfig;
+        if (config.isolated) {
+            PyConfig_InitIsolatedConfig(&pyConfig);
+        } else {
+            PyConfig_InitPythonConfig(&pyConfig);
+        }
+        pyConfig.parse_argv = 0;
+        pyConfig.site_import = config.importSite;
+        PyStatus status = PyConfig_SetArgv(&pyConfig, 1, dummy_args);
+        if (!PyStatus_Exception(status)) {
+            status = Py_InitializeFromConfig(&pyConfig);
+        }
+        PyConfig_Clear(&pyConfig);
+        if (PyStatus_Exception(status)) {
+            Py_ExitStatusException(status);
+        }
+#else
+        if (config.isolated) {
+            Py_IgnoreEnvironmentFlag = 1;
+            Py_NoUserSiteDirectory = 1;
+#if PY_VERSION_HEX >= 0x03040000
+            Py_IsolatedFlag = 1;
+#endif
+        }
+        Py_NoSiteFlag = !config.importSite;
+        Py_Initialize();
+
+#ifdef WRAPPY_PYTHON3
+        wchar_t* dummy_args[] = {const_cast<wchar_t*>(L"wrappy"), nullptr};
+#else
+        char* dummy_args[] = {const_cast<char*>("wrappy"), nullptr};
+#endif
+        PySys_SetArgvEx(1, dummy_args, 0);
+#endif
+    }
 
-    Py_Initialize();
+    // Before python 3.12 the types are static and shared by all interpreters,
+    // so they are readied here rather than by whichever sub-interpreter
+    // happens to use them first
+    detail::readyBufferType();
+    detail::readyStreamType();
+
+    // In the given order, in front of everything else
+    std::string pathString("path");
+    PyObject* syspath = PySys_GetObject(&pathString[0]); // Borrowed reference
+    for (size_t i = 0; i < config.searchPaths.size(); ++i) {
+        PythonObject path(PythonObject::owning {},
+            compat::fromString(config.searchPaths[i].c_str()));
+        if (!path || PyList_Insert(syspath, i, path.get()) < 0) {
+            PyErr_Clear();
+        }
+    }
 
-    // Setting a dummy value since many libraries require sys.argv[0] to exist
-    char* dummy_args[] = {const_cast<char*>("wrappy"), nullptr};
-    PySys_SetArgvEx(1, dummy_args, 0);
+    std::lock_guard<std::mutex> lock(s_StartupMutex);
+    s_StartupStats.initializeSeconds = secondsSince(start);
+    s_StartupStats.preImportPending = config.preImport.size();
+    s_Initialized = true;
+}
 
-    wrappy::None  = PythonObject(PythonObject::borrowed{}, Py_None);
-    wrappy::True  = PythonObject(PythonObject::borrowed{}, Py_True);
-    wrappy::False = PythonObject(PythonObject::borrowed{}, Py_False);
+void preImport(std::vector<std::string> modules)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (const std::string& name : modules) {
+        bool imported;
+        {
+            // Released between modules, so other threads aren't held up
+            detail::AutoGil gil;
+            PythonObject module(PythonObject::owning {}, PyImport_ImportModule(name.c_str()));
+            imported = static_cast<bool>(module);
+            PyErr_Clear();
+        }
 
-    s_EmptyTuple = Py_BuildValue("()");
-    s_EmptyDict  = Py_BuildValue("{}");
+        std::lock_guard<std::mutex> lock(s_StartupMutex);
+        --s_StartupStats.preImportPending;
+        ++(imported ? s_StartupStats.preImported : s_StartupStats.preImportFailed);
+        s_StartupStats.preImportSeconds = secondsSince(start);
+    }
 }
 
+void ensureInitialized()
+{
+    if (!s_Initialized.load(std::memory_order_acquire)) {
+        std::call_once(s_InitializeOnce, []() { startInterpreter(Config()); });
+    }
+}
 
 __attribute__((destructor))
 void wrappyFinalize()
 {
-    Py_Finalize();
+    if (!s_Initialized) {
+        return;
+    }
+
+    // The importer needs the GIL to finish
+    if (s_PreImportThread) {
+        s_PreImportThread->join();
+    }
+
+    // Py_Finalize() must be called with the GIL held by the main thread
+    if (s_MainThreadState) {
+        PyEval_RestoreThread(s_MainThreadState);
+        s_ThreadsEnabled = false;
+    }
+    drainDeferredDecrefs();
+
+    // The caches hold references, which must be dropped while the
+    // interpreter still exists.
+    s_MainContext.names.clear();
+    s_MainContext.methods.clear();
+    s_MainContext.missing.clear();
+    s_MainContext.interned.clear();
+    s_MainContext.code.clear();
+    s_MainContext.sites.clear();
+#ifdef WRAPPY_HEAP_TYPES
+    s_MainContext.types.clear();
+#endif
+    if (s_OwnsInterpreter) {
+        Py_Finalize();
+    }
 }
 
 PythonObject loadBuiltin(const std::string& name)
@@ -78,6 +438,15 @@ PythonObject loadModule(const std::string& name, size_t& dot)
         std::string prefix = name.substr(0, dot);
         module = PythonObject(PythonObject::owning {},
             PyImport_ImportModule(prefix.c_str()));
+
+        if (!module) {
+            // An ImportError just means that prefix was not a module,
+            // anything else is a genuine error in the module itself.
+            if (!PyErr_ExceptionMatches(PyExc_ImportError)) {
+                detail::throwPythonError("Wrappy: Exception while importing " + prefix);
+            }
+            PyErr_Clear();
+        }
     }
 
     return module;
@@ -94,6 +463,10 @@ PythonObject loadObject(PythonObject module, const std::string& name)
         size_t next_dot = name.find('.', suffixDot+1);
         auto attr = name.substr(suffixDot+1, next_dot - (suffixDot+1));
         object = PythonObject(PythonObject::owning {}, PyObject_GetAttrString(object.get(), attr.c_str()));
+        if (!object) {
+            PyErr_Clear();
+            break;
+        }
         suffixDot = next_dot;
     }
 
@@ -104,10 +477,6 @@ PythonObject loadObject(PythonObject module, const std::string& name)
 
 namespace wrappy {
 
-PythonObject::PythonObject()
-    : obj_(nullptr)
-{ }
-
 PythonObject::PythonObject(owning, PyObject* value)
     : obj_(value)
 { }
@@ -115,18 +484,37 @@ PythonObject::PythonObject(owning, PyObject* value)
 PythonObject::PythonObject(borrowed, PyObject* value)
     : obj_(value)
 {
-    Py_XINCREF(obj_);
+    if (obj_ && threaded()) {
+        detail::AutoGil gil;
+        incref(obj_);
+    } else {
+        incref(obj_);
+    }
 }
 
 PythonObject::~PythonObject()
 {
-    Py_XDECREF(obj_);
+    if (obj_ && threaded()) {
+        if (s_DeferDecrefs.load(std::memory_order_relaxed) && !holdsGil()) {
+            deferDecref(obj_);
+            return;
+        }
+        detail::AutoGil gil;
+        decref(obj_);
+    } else {
+        decref(obj_);
+    }
 }
 
 PythonObject::PythonObject(const PythonObject& other)
     : obj_(other.obj_)
 {
-    Py_XINCREF(obj_);
+    if (obj_ && threaded()) {
+        detail::AutoGil gil;
+        incref(obj_);
+    } else {
+        incref(obj_);
+    }
 }
 
 PyObject* PythonObject::release()
@@ -164,22 +552,38 @@ PyObject* PythonObject::get() const
 
 PythonObject PythonObject::attr(const std::string& name) const
 {
+    detail::AutoGil gil;
     return PythonObject(owning{}, PyObject_GetAttrString(obj_, name.c_str()));
 }
 
+PythonObject PythonObject::attr(const Name& name) const
+{
+    detail::AutoGil gil;
+    return PythonObject(owning{}, PyObject_GetAttr(obj_, detail::internedName(name)));
+}
+
 long long PythonObject::num() const
 {
+    detail::AutoGil gil;
+#ifdef WRAPPY_PYTHON3
+    // Python 3 doesn't truncate floats implicitly
+    if (PyFloat_Check(obj_)) {
+        return static_cast<long long>(PyFloat_AS_DOUBLE(obj_));
+    }
+#endif
     return PyLong_AsLongLong(obj_);
 }
 
 double PythonObject::floating() const
 {
+    detail::AutoGil gil;
     return PyFloat_AsDouble(obj_);
 }
 
 const char* PythonObject::str() const
 {
-    return PyString_AsString(obj_);
+    detail::AutoGil gil;
+    return compat::asString(obj_);
 }
 
 PythonObject::operator bool() const
@@ -189,53 +593,108 @@ PythonObject::operator bool() const
 
 PythonObject PythonObject::operator()() const
 {
-    return PythonObject(owning{}, PyObject_Call(obj_, s_EmptyTuple, s_EmptyDict));
+    detail::AutoGil gil;
+    return PythonObject(owning{}, PyObject_CallObject(obj_, nullptr));
 }
 
 
+PythonObject construct(bool b)
+{
+    return b ? True : False;
+}
+
+PythonObject construct(int i)
+{
+    detail::AutoGil gil;
+    return PythonObject(PythonObject::owning {}, compat::fromLong(i));
+}
+
+PythonObject construct(unsigned int i)
+{
+    detail::AutoGil gil;
+    return PythonObject(PythonObject::owning {}, PyLong_FromUnsignedLong(i));
+}
+
+PythonObject construct(long l)
+{
+    detail::AutoGil gil;
+    return PythonObject(PythonObject::owning {}, compat::fromLong(l));
+}
+
+PythonObject construct(unsigned long l)
+{
+    detail::AutoGil gil;
+    return PythonObject(PythonObject::owning {}, PyLong_FromUnsignedLong(l));
+}
+
 PythonObject construct(long long ll)
 {
+    detail::AutoGil gil;
     return PythonObject(PythonObject::owning {}, PyLong_FromLongLong(ll));
 }
 
-PythonObject construct(int i)
+PythonObject construct(unsigned long long ll)
+{
+    detail::AutoGil gil;
+    return PythonObject(PythonObject::owning {}, PyLong_FromUnsignedLongLong(ll));
+}
+
+PythonObject construct(float f)
 {
-    return PythonObject(PythonObject::owning {}, PyInt_FromLong(i));
+    detail::AutoGil gil;
+    return PythonObject(PythonObject::owning {}, PyFloat_FromDouble(f));
 }
 
 PythonObject construct(double d)
 {
+    detail::AutoGil gil;
     return PythonObject(PythonObject::owning {}, PyFloat_FromDouble(d));
 }
 
+PythonObject construct(const char* str)
+{
+    detail::AutoGil gil;
+    return PythonObject(PythonObject::owning {}, compat::fromString(str));
+}
+
 PythonObject construct(const std::string& str)
 {
-    return PythonObject(PythonObject::owning {}, PyString_FromString(str.c_str()));
+    detail::AutoGil gil;
+    return PythonObject(PythonObject::owning {},
+        compat::fromString(str.data(), str.size()));
 }
 
 PythonObject construct(const std::vector<PythonObject>& v)
 {
+    detail::AutoGil gil;
+    WRAPPY_COUNT(s_Allocations, 1);
     PythonObject list(PythonObject::owning {}, PyList_New(v.size()));
     for (size_t i = 0; i < v.size(); ++i) {
         PyObject* item = v.at(i).get();
-        Py_XINCREF(item); // PyList_SetItem steals a reference
+        incref(item); // PyList_SetItem steals a reference
         PyList_SetItem(list.get(), i, item);
     }
     return list;
 }
 
-PythonObject construct(PythonObject object)
+PythonObject construct(const PythonObject& object)
 {
     return object;
 }
 
+PythonObject construct(PythonObject&& object)
+{
+    return std::move(object);
+}
+
 void addModuleSearchPath(const std::string& path)
 {
+    detail::AutoGil gil;
     std::string pathString("path");
     auto syspath = PySys_GetObject(&pathString[0]); // Borrowed reference
 
     PythonObject pypath(PythonObject::owning {},
-        PyString_FromString(path.c_str()));
+        compat::fromString(path.c_str()));
 
     if (!pypath) {
         throw WrappyError("Wrappy: Can't allocate memory for string.");
@@ -245,67 +704,329 @@ void addModuleSearchPath(const std::string& path)
     if (pos < 0) {
         throw WrappyError("Wrappy: Couldn't add " + path + " to sys.path");
     }
+
+    // Missing modules might be found now
+    context().missing.clear();
+}
+
+// Takes ownership of the result of a call, and turns python exceptions
+// into WrappyErrors
+PythonObject checkedResult(PyObject* result)
+{
+    PythonObject res(PythonObject::owning{}, result);
+
+    if (PyErr_Occurred()) {
+        detail::throwPythonError("Wrappy: Exception during call to python function");
+    }
+
+    if (!res) {
+        throw WrappyError("Wrappy: Error calling function");
+    }
+
+    return res;
+}
+
+// Times the phases of one call while metrics are enabled, see
+// <wrappy/metrics.h>. A call that doesn't reach done() counts as failed.
+// While memory tracking is enabled, allocations during the call are
+// attributed to its site, see <wrappy/memory.h>, and while tracing, the
+// call is an event of the given category, see <wrappy/trace.h>.
+class CallTimer {
+public:
+    // Argument conversion that started before the timer counts as marshalling
+    explicit CallTimer(unsigned long long convertStart = 0, const char* category = "call")
+      : last_(detail::metricsClock())
+      , phases_()
+      , done_(false)
+      , memory_(&site)
+      , trace_(category, &site)
+    {
+        if (last_ && convertStart) {
+            phases_[metrics::Marshal] = last_ - convertStart;
+        }
+    }
+
+    ~CallTimer()
+    {
+        if (last_ && !done_) {
+            try {
+                detail::recordCall(site, phases_, true);
+            } catch (...) { }
+        }
+    }
+
+    CallTimer(const CallTimer&) = delete;
+    CallTimer& operator=(const CallTimer&) = delete;
+
+    // True if the site has to be set
+    explicit operator bool() const { return last_ != 0 || memory_.active() || trace_.active(); }
+
+    // Adds the time since the end of the previous phase to phase
+    void end(metrics::Phase phase)
+    {
+        if (last_) {
+            unsigned long long now = detail::metricsClock();
+            if (now) {
+                phases_[phase] += now - last_;
+                last_ = now;
+            }
+        }
+    }
+
+    void done()
+    {
+        if (last_) {
+            done_ = true;
+            detail::recordCall(site, phases_, false);
+        }
+    }
+
+    std::string site; // only needs to be set while the timer is active
+
+private:
+    unsigned long long last_;
+    unsigned long long phases_[metrics::PhaseCount];
+    bool done_;
+    detail::MemoryScope memory_;
+    detail::TraceScope trace_;
+};
+
+// Ends the execution of a call and takes over its result
+PythonObject finishCall(PyObject* result, CallTimer& timer)
+{
+    timer.end(metrics::Execute);
+    PythonObject res = checkedResult(result);
+    timer.end(metrics::Unmarshal);
+    timer.done();
+    return res;
+}
+
+// "<module>.<qualified name>" of a function, or its type name
+std::string describeFunction(PyObject* function)
+{
+    std::string site = Py_TYPE(function)->tp_name;
+    PythonObject name(PythonObject::owning {}, PyObject_GetAttrString(function, "__qualname__"));
+    if (!name) {
+        PyErr_Clear();
+        name = PythonObject(PythonObject::owning {}, PyObject_GetAttrString(function, "__name__"));
+    }
+    PythonObject module(PythonObject::owning {}, PyObject_GetAttrString(function, "__module__"));
+    PyErr_Clear();
+
+    const char* str = name ? compat::asString(name.get()) : nullptr;
+    if (str) {
+        site = str;
+        const char* prefix = module ? compat::asString(module.get()) : nullptr;
+        if (prefix) {
+            site = std::string(prefix) + "." + site;
+        }
+    }
+    PyErr_Clear();
+    return site;
+}
+
+// describeFunction(), cached per function object. Functions that can't be
+// weakly referenced are described again on every call.
+std::string callSiteName(PyObject* function)
+{
+    auto& sites = context().sites;
+    CallSite* cached = sites.find(function);
+    if (cached && compat::refersTo(cached->function.get(), function)) {
+        return cached->name;
+    }
+
+    std::string name = describeFunction(function);
+    PythonObject ref(PythonObject::owning {}, PyWeakref_NewRef(function, nullptr));
+    if (ref) {
+        sites.insert(function, CallSite {std::move(ref), name});
+    } else {
+        PyErr_Clear();
+    }
+    return name;
+}
+
+// "<type>.<method>" for calls of a method of from
+std::string callSiteName(const PythonObject& from, const std::string& functionName)
+{
+    std::string site = Py_TYPE(from.get())->tp_name;
+    return functionName[0] == '.' ? site + functionName : site + "." + functionName;
+}
+
+#ifdef WRAPPY_VECTORCALL
+// Argument array for PyObject_Vectorcall(). Slot 0 is reserved, which lets
+// python prepend `self` when calling bound methods without copying the
+// arguments (PY_VECTORCALL_ARGUMENTS_OFFSET). Small calls don't allocate.
+class VectorcallArguments {
+public:
+    explicit VectorcallArguments(size_t size)
+      : args_(size + 1 <= Inline ? inline_ : new PyObject*[size + 1])
+    {
+        args_[0] = nullptr;
+    }
+
+    ~VectorcallArguments()
+    {
+        if (args_ != inline_) {
+            delete[] args_;
+        }
+    }
+
+    VectorcallArguments(const VectorcallArguments&) = delete;
+    VectorcallArguments& operator=(const VectorcallArguments&) = delete;
+
+    // Borrowed references, the caller keeps the arguments alive
+    PyObject*& operator[](size_t i) { return args_[i + 1]; }
+
+    // Returns a new reference, or NULL with an exception set
+    PyObject* call(PyObject* function, size_t positional, PyObject* kwnames)
+    {
+        return PyObject_Vectorcall(function, args_ + 1,
+            positional | PY_VECTORCALL_ARGUMENTS_OFFSET, kwnames);
+    }
+
+    // Calls the method `name` of the first argument, without creating
+    // a bound method object
+    PyObject* callMethod(PyObject* name, size_t positional, PyObject* kwnames)
+    {
+        return PyObject_VectorcallMethod(name, args_ + 1,
+            positional | PY_VECTORCALL_ARGUMENTS_OFFSET, kwnames);
+    }
+
+private:
+    static const size_t Inline = 8;
+    PyObject* inline_[Inline];
+    PyObject** args_;
+};
+
+// Tuple of keyword names for vectorcall, python accepts NULL if there are none
+PythonObject keywordNames(size_t size)
+{
+    PythonObject names;
+    if (size) {
+        WRAPPY_COUNT(s_Allocations, 1);
+        names = PythonObject(PythonObject::owning {}, PyTuple_New(size));
+        if (!names) {
+            detail::throwPythonError("Wrappy: Couldn't create python tuple.");
+        }
+    }
+    return names;
+}
+
+void setKeywordName(PythonObject& names, size_t index, const char* name)
+{
+    PyObject* str = PyUnicode_InternFromString(name);
+    if (!str) {
+        detail::throwPythonError("Wrappy: Couldn't create keyword name.");
+    }
+    PyTuple_SET_ITEM(names.get(), index, str); // steals the reference
 }
 
+void setKeywordName(PythonObject& names, size_t index, const detail::Argument& arg)
+{
+    if (!arg.name) {
+        setKeywordName(names, index, arg.keyword);
+        return;
+    }
+    incref(arg.name);
+    PyTuple_SET_ITEM(names.get(), index, arg.name); // steals the reference
+}
+
+// Puts the positional arguments into stack from index `first` on, followed
+// by the values of the keyword arguments. Returns the keyword names.
+PythonObject packVectorcall(VectorcallArguments& stack, size_t first,
+    detail::Argument* args, size_t size, size_t positional)
+{
+    PythonObject kwnames = keywordNames(size - positional);
+    size_t index = first, keyword = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (!args[i].keyword) {
+            stack[index++] = args[i].value.get();
+        } else {
+            setKeywordName(kwnames, keyword, args[i]);
+            stack[first + positional + keyword++] = args[i].value.get();
+        }
+    }
+    return kwnames;
+}
+#endif
+
 // Doesn't perform checks on the return value (input is still checked)
 PythonObject callFunctionWithArgs(
     PythonObject function,
     const std::vector<PythonObject>& args,
-    const std::vector<std::pair<std::string, PythonObject>>& kwargs)
+    const std::vector<std::pair<std::string, PythonObject>>& kwargs,
+    CallTimer& timer)
 {
     if (!PyCallable_Check(function.get())) {
         throw WrappyError("Wrappy: Supplied object isn't callable.");
     }
 
+#ifdef WRAPPY_VECTORCALL
+    VectorcallArguments stack(args.size() + kwargs.size());
+    PythonObject kwnames = keywordNames(kwargs.size());
+    for (size_t i = 0; i < args.size(); ++i) {
+        stack[i] = args[i].get();
+    }
+    for (size_t i = 0; i < kwargs.size(); ++i) {
+        setKeywordName(kwnames, i, kwargs[i].first.c_str());
+        stack[args.size() + i] = kwargs[i].second.get();
+    }
+    timer.end(metrics::Marshal);
+    return finishCall(stack.call(function.get(), args.size(), kwnames.get()), timer);
+#else
     // Build tuple
     size_t sz = args.size();
+    WRAPPY_COUNT(s_Allocations, 1);
     PythonObject tuple(PythonObject::owning {}, PyTuple_New(sz));
     if (!tuple) {
-        PyErr_Print();
-        throw WrappyError("Wrappy: Couldn't create python tuple.");
+        detail::throwPythonError("Wrappy: Couldn't create python tuple.");
     }
 
     for (size_t i = 0; i < sz; ++i) {
         PyObject* arg = args.at(i).get();
-        Py_XINCREF(arg); // PyTuple_SetItem steals a reference
+        incref(arg); // PyTuple_SetItem steals a reference
         PyTuple_SetItem(tuple.get(), i, arg);
     }
 
-    // Build kwargs dict
-    PythonObject dict(PythonObject::owning {}, PyDict_New());
-    if (!dict) {
-        PyErr_Print();
-        throw WrappyError("Wrappy: Couldn't create python dictionary.");
+    // Build kwargs dict, python accepts NULL if there are none
+    PythonObject dict;
+    if (!kwargs.empty()) {
+        WRAPPY_COUNT(s_Allocations, 1);
+        dict = PythonObject(PythonObject::owning {}, PyDict_New());
+        if (!dict) {
+            detail::throwPythonError("Wrappy: Couldn't create python dictionary.");
+        }
     }
 
     for (const auto& kv : kwargs) {
         PyDict_SetItemString(dict.get(), kv.first.c_str(), kv.second.get());
     }
 
-    PythonObject res(PythonObject::owning{},
-        PyObject_Call(function.get(), tuple.get(), dict.get()));
-
-    if (PyErr_Occurred()) {
-        PyErr_Print();
-        PyErr_Clear(); // TODO add string to exception, make custom exception class
-        throw WrappyError("Wrappy: Exception during call to python function");
-    }
-
-    if (!res) {
-        throw WrappyError("Wrappy: Error calling function");
-    }
-
-    return res;
+    timer.end(metrics::Marshal);
+    return finishCall(PyObject_Call(function.get(), tuple.get(), dict.get()), timer);
+#endif
 }
 
 PythonObject load(
     const std::string& name)
 {
+    detail::AutoGil gil;
+    detail::TraceScope trace("load", &name);
+    if (PythonObject* cached = context().names.find(name)) {
+        return *cached;
+    }
+    if (std::string* error = context().missing.find(name)) {
+        throw WrappyError(*error);
+    }
+
     size_t cutoff;
     PythonObject module = loadModule(name, cutoff);
     PythonObject object;
 
-    if (module) {
+    if (module && cutoff == std::string::npos) {
+        // The whole name is a module
+        object = module;
+    } else if (module) {
         object = loadObject(module, name.substr(cutoff));
     } else {
         // No proper prefix was a valid module, but maybe it's a built-in
@@ -319,12 +1040,14 @@ PythonObject load(
                 name.substr(cutoff) + " in module " +
                 name.substr(0,cutoff) + " failed.";
         } else {
-            error_message = "Wrappy: Lookup of function " + name + "failed.";
+            error_message = "Wrappy: Lookup of function " + name + " failed.";
         }
 
+        context().missing.insert(name, error_message);
         throw WrappyError(error_message);
     }
 
+    context().names.insert(name, object);
     return object;
 }
 
@@ -333,16 +1056,18 @@ PythonObject callWithArgs(
     const std::vector<PythonObject>& args,
     const std::vector<std::pair<std::string, PythonObject>>& kwargs)
 {
+    detail::AutoGil gil;
+    CallTimer timer;
+    if (timer) {
+        timer.site = name;
+    }
     PythonObject function = load(name);
-    return callFunctionWithArgs(function, args, kwargs);
+    timer.end(metrics::Lookup);
+    return callFunctionWithArgs(function, args, kwargs, timer);
 }
 
-// Call a python function with arguments args and keyword arguments kwargs
-PythonObject callWithArgs(
-    PythonObject from,
-    const std::string& functionName,
-    const std::vector<PythonObject>& args,
-    const std::vector<std::pair<std::string, PythonObject>>& kwargs)
+// Resolves the attribute chain functionName relative to from
+PythonObject loadMethod(const PythonObject& from, const std::string& functionName)
 {
     std::string name;
     if (functionName[0] == '.') {
@@ -351,6 +1076,11 @@ PythonObject callWithArgs(
         name = "." + functionName;
     }
 
+    MethodKey key {from.get(), name};
+    if (MethodEntry* cached = context().methods.find(key)) {
+        return cached->method;
+    }
+
     PythonObject function = loadObject(from, name);
 
     if (!function) {
@@ -358,48 +1088,1052 @@ PythonObject callWithArgs(
             "Lookup of function " + functionName + " failed.");
     }
 
-    return callFunctionWithArgs(function, args, kwargs);
+    context().methods.insert(key, MethodEntry {from, function});
+    return function;
 }
 
-//
-// PythonIterator implementation
-//
-
-PythonIterator::PythonIterator(bool stopped, PythonObject iter):
-  stopped_(stopped),
-  iter_(iter)
-{}
-
-PythonIterator begin(PythonObject obj)
+// Call a python function with arguments args and keyword arguments kwargs
+PythonObject callWithArgs(
+    PythonObject from,
+    const std::string& functionName,
+    const std::vector<PythonObject>& args,
+    const std::vector<std::pair<std::string, PythonObject>>& kwargs)
 {
-    PythonObject pyIter(PythonObject::owning{}, PyObject_GetIter(obj.get()));
-    PythonIterator iter(false, pyIter);
-    // Move iterator to first position in list to
-    // initialize obj_
-    return ++iter;
+    detail::AutoGil gil;
+    CallTimer timer;
+    if (timer) {
+        timer.site = callSiteName(from, functionName);
+    }
+    PythonObject function = loadMethod(from, functionName);
+    timer.end(metrics::Lookup);
+    return callFunctionWithArgs(function, args, kwargs, timer);
 }
 
-PythonIterator end(PythonObject)
-{
-    return PythonIterator(true, PythonObject());
-}
+namespace {
 
-PythonIterator& PythonIterator::operator++()
+// Compiles source, or returns the code object cached for it
+PythonObject compiledCode(const std::string& source, int mode)
 {
-    auto next = iter_.attr("next"); // Change this to __next__ if switching to python 3
+    CodeKey key {mode, std::hash<std::string>()(source)};
+    CodeEntry* cached = context().code.find(key);
+    if (cached && cached->source == source) {
+        return cached->code;
+    }
 
-    // Can't use the normal "call" because we want to actually
-    // handle the exception
-    obj_ = PythonObject(PythonObject::owning{},
-        PyObject_Call(next.get(), s_EmptyTuple, s_EmptyDict));
+    PythonObject code(PythonObject::owning {},
+        Py_CompileString(source.c_str(), "<wrappy>", mode));
+    if (!code) {
+        detail::throwPythonError("Wrappy: Couldn't compile python code.");
+    }
+    context().code.insert(key, CodeEntry {source, code});
+    return code;
+}
 
-    if (PyErr_Occurred() && PyErr_ExceptionMatches(PyExc_StopIteration) ) {
-        stopped_ = true;
+// Runs the code compiled from source in a fresh namespace holding the
+// builtins and locals, and returns the result and the namespace
+PythonObject runCode(const std::string& source, int mode,
+    const std::vector<std::pair<std::string, PythonObject>>& locals,
+    PythonObject& globals)
+{
+    CallTimer timer;
+    if (timer) {
+        timer.site = mode == Py_eval_input ? "<eval>" : "<exec>";
+    }
+    PythonObject code = compiledCode(source, mode);
+    timer.end(metrics::Lookup);
+
+    // One dict for globals and locals, so that lambdas and comprehensions
+    // in the code see the locals as well
+    WRAPPY_COUNT(s_Allocations, 1);
+    globals = PythonObject(PythonObject::owning {}, PyDict_New());
+    if (!globals) {
+        detail::throwPythonError("Wrappy: Couldn't create python dictionary.");
+    }
+    if (PyDict_SetItemString(globals.get(), "__builtins__", PyEval_GetBuiltins()) < 0) {
+        detail::throwPythonError("Wrappy: Couldn't create python dictionary.");
+    }
+    for (const auto& local : locals) {
+        if (PyDict_SetItemString(globals.get(), local.first.c_str(), local.second.get()) < 0) {
+            detail::throwPythonError("Wrappy: Couldn't create python dictionary.");
+        }
+    }
+    timer.end(metrics::Marshal);
+
+    return finishCall(compat::evalCode(code.get(), globals.get(), globals.get()), timer);
+}
+
+} // end unnamed namespace
+
+PythonObject eval(
+    const std::string& expression,
+    const std::vector<std::pair<std::string, PythonObject>>& locals)
+{
+    detail::AutoGil gil;
+    PythonObject globals;
+    return runCode(expression, Py_eval_input, locals, globals);
+}
+
+PythonObject exec(
+    const std::string& code,
+    const std::vector<std::pair<std::string, PythonObject>>& locals)
+{
+    detail::AutoGil gil;
+    PythonObject globals;
+    runCode(code, Py_file_input, locals, globals);
+    return globals;
+}
+
+namespace {
+
+size_t countPositional(const detail::Argument* args, size_t size)
+{
+    size_t positional = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (!args[i].keyword) {
+            ++positional;
+        }
+    }
+    return positional;
+}
+
+PythonObject callWithArgumentArray(
+    const PythonObject& function, detail::Argument* args, size_t size, CallTimer& timer)
+{
+    if (!PyCallable_Check(function.get())) {
+        throw WrappyError("Wrappy: Supplied object isn't callable.");
+    }
+
+    size_t positional = countPositional(args, size);
+
+#ifdef WRAPPY_VECTORCALL
+    VectorcallArguments stack(size);
+    PythonObject kwnames = packVectorcall(stack, 0, args, size, positional);
+    timer.end(metrics::Marshal);
+    return finishCall(stack.call(function.get(), positional, kwnames.get()), timer);
+#else
+    WRAPPY_COUNT(s_Allocations, 1);
+    PythonObject tuple(PythonObject::owning {}, PyTuple_New(positional));
+    if (!tuple) {
+        detail::throwPythonError("Wrappy: Couldn't create python tuple.");
+    }
+
+    // Python accepts NULL instead of an empty kwargs dict
+    PythonObject dict;
+    if (positional != size) {
+        WRAPPY_COUNT(s_Allocations, 1);
+        dict = PythonObject(PythonObject::owning {}, PyDict_New());
+        if (!dict) {
+            detail::throwPythonError("Wrappy: Couldn't create python dictionary.");
+        }
+    }
+
+    size_t index = 0;
+    for (size_t i = 0; i < size; ++i) {
+        if (!args[i].keyword) {
+            // PyTuple_SetItem steals the reference held by the argument
+            PyTuple_SET_ITEM(tuple.get(), index++, args[i].value.release());
+        } else if (args[i].name) {
+            PyDict_SetItem(dict.get(), args[i].name, args[i].value.get());
+        } else {
+            PyDict_SetItemString(dict.get(), args[i].keyword, args[i].value.get());
+        }
+    }
+
+    timer.end(metrics::Marshal);
+    return finishCall(PyObject_Call(function.get(), tuple.get(), dict.get()), timer);
+#endif
+}
+
+} // end unnamed namespace
+
+namespace detail {
+
+PythonObject callWithArguments(
+    const PythonObject& function, Argument* args, size_t size,
+    unsigned long long convertStart)
+{
+    AutoGil gil;
+    CallTimer timer(convertStart);
+    if (timer && function) {
+        timer.site = callSiteName(function.get());
+    }
+    return callWithArgumentArray(function, args, size, timer);
+}
+
+PythonObject callWithArguments(
+    const std::string& name, Argument* args, size_t size,
+    unsigned long long convertStart)
+{
+    AutoGil gil;
+    CallTimer timer(convertStart);
+    if (timer) {
+        timer.site = name;
+    }
+    PythonObject function = load(name);
+    timer.end(metrics::Lookup);
+    return callWithArgumentArray(function, args, size, timer);
+}
+
+PythonObject callWithArguments(
+    const PythonObject& from,
+    const std::string& functionName,
+    Argument* args,
+    size_t size,
+    unsigned long long convertStart)
+{
+    AutoGil gil;
+    CallTimer timer(convertStart);
+    if (timer) {
+        timer.site = callSiteName(from, functionName);
+    }
+    PythonObject function = loadMethod(from, functionName);
+    timer.end(metrics::Lookup);
+    return callWithArgumentArray(function, args, size, timer);
+}
+
+PythonObject callWithArguments(
+    const PythonObject& from,
+    const Name& method,
+    Argument* args,
+    size_t size,
+    unsigned long long convertStart)
+{
+    AutoGil gil;
+    CallTimer timer(convertStart);
+    if (timer) {
+        timer.site = callSiteName(from, method.c_str());
+    }
+    PyObject* name = internedName(method);
+
+#ifdef WRAPPY_VECTORCALL
+    // `from` goes first, as self
+    size_t positional = countPositional(args, size);
+    VectorcallArguments stack(size + 1);
+    stack[0] = from.get();
+    PythonObject kwnames = packVectorcall(stack, 1, args, size, positional);
+    timer.end(metrics::Marshal);
+    return finishCall(stack.callMethod(name, positional + 1, kwnames.get()), timer);
+#else
+    PythonObject function(PythonObject::owning {}, PyObject_GetAttr(from.get(), name));
+    if (!function) {
+        detail::throwPythonError(
+            std::string("Wrappy: Lookup of function ") + method.c_str() + " failed.");
+    }
+    timer.end(metrics::Lookup);
+    return callWithArgumentArray(function, args, size, timer);
+#endif
+}
+
+PyObject* internedName(const Name& name)
+{
+    auto& interned = context().interned;
+    auto it = interned.find(name.c_str());
+    if (it != interned.end()) {
+        return it->second.get();
+    }
+
+    WRAPPY_COUNT(s_Allocations, 1);
+    PythonObject str(PythonObject::owning {}, compat::internString(name.c_str(), name.size()));
+    if (!str) {
+        detail::throwPythonError("Wrappy: Couldn't create name.");
+    }
+    PyObject* res = str.get();
+    interned.emplace(name.c_str(), std::move(str));
+    return res;
+}
+
+} // end namespace detail
+
+void setNameCacheCapacity(size_t capacity)
+{
+    detail::AutoGil gil;
+    context().names.setCapacity(capacity);
+}
+
+void setMethodCacheCapacity(size_t capacity)
+{
+    detail::AutoGil gil;
+    context().methods.setCapacity(capacity);
+}
+
+void setNegativeCacheCapacity(size_t capacity)
+{
+    detail::AutoGil gil;
+    context().missing.setCapacity(capacity);
+}
+
+void setCodeCacheCapacity(size_t capacity)
+{
+    detail::AutoGil gil;
+    context().code.setCapacity(capacity);
+}
+
+void invalidateCache()
+{
+    detail::AutoGil gil;
+    context().names.clear();
+    context().methods.clear();
+    context().missing.clear();
+}
+
+void invalidateCache(const std::string& name)
+{
+    detail::AutoGil gil;
+    context().names.erase(name);
+    context().missing.erase(name);
+
+    // Method cache keys are stored with a leading dot
+    std::string attr = name[0] == '.' ? name : "." + name;
+    context().methods.eraseIf([&](const MethodKey& key, const MethodEntry&) {
+        return key.name == attr;
+    });
+}
+
+//
+// PythonError implementation
+//
+
+struct PythonError::State {
+    std::string context;
+    PythonObject type;
+    PythonObject value;
+    PythonObject traceback;
+
+    std::once_flag formatted;
+    std::string message;
+};
+
+namespace {
+
+// The context followed by the output of traceback.format_exception(),
+// or just the context if that fails
+std::string formatException(const PythonError& error, const std::string& context)
+{
+    detail::AutoGil gil;
+    std::string message = context;
+
+    PyObject* value = error.value() ? error.value().get() : Py_None;
+    PyObject* traceback = error.traceback() ? error.traceback().get() : Py_None;
+    PythonObject module(PythonObject::owning {}, PyImport_ImportModule("traceback"));
+    PythonObject lines;
+    if (module) {
+        lines = PythonObject(PythonObject::owning {}, PyObject_CallMethod(module.get(),
+            const_cast<char*>("format_exception"), const_cast<char*>("OOO"),
+            error.type().get(), value, traceback));
+    }
+
+    if (lines && PyList_Check(lines.get())) {
+        message += "\n";
+        for (Py_ssize_t i = 0; i < PyList_GET_SIZE(lines.get()); ++i) {
+            const char* line;
+            Py_ssize_t size;
+            if (compat::asStringAndSize(PyList_GET_ITEM(lines.get(), i), &line, &size) == 0) {
+                message.append(line, size);
+            }
+        }
+        if (message.back() == '\n') {
+            message.pop_back();
+        }
+    }
+    PyErr_Clear();
+    return message;
+}
+
+} // end unnamed namespace
+
+PythonError::PythonError(const std::string& context,
+    PythonObject type, PythonObject value, PythonObject traceback)
+  : WrappyError(context)
+  , state_(std::make_shared<State>())
+{
+    state_->context = context;
+    state_->type = std::move(type);
+    state_->value = std::move(value);
+    state_->traceback = std::move(traceback);
+}
+
+const PythonObject& PythonError::type() const
+{
+    return state_->type;
+}
+
+const PythonObject& PythonError::value() const
+{
+    return state_->value;
+}
+
+const PythonObject& PythonError::traceback() const
+{
+    return state_->traceback;
+}
+
+bool PythonError::matches(const PythonObject& cls) const
+{
+    detail::AutoGil gil;
+    PyObject* exception = state_->value ? state_->value.get() : state_->type.get();
+    return cls && PyErr_GivenExceptionMatches(exception, cls.get());
+}
+
+const char* PythonError::what() const noexcept
+{
+    try {
+        std::call_once(state_->formatted, [this]() {
+            state_->message = formatException(*this, state_->context);
+        });
+        return state_->message.c_str();
+    } catch (...) {
+        return WrappyError::what();
+    }
+}
+
+namespace detail {
+
+void throwPythonError(const std::string& context)
+{
+    PyObject *type, *value, *traceback;
+    PyErr_Fetch(&type, &value, &traceback);
+    if (!type) {
+        throw WrappyError(context);
+    }
+    PyErr_NormalizeException(&type, &value, &traceback);
+
+    throw PythonError(context,
+        PythonObject(PythonObject::owning {}, type),
+        PythonObject(PythonObject::owning {}, value),
+        PythonObject(PythonObject::owning {}, traceback));
+}
+
+} // end namespace detail
+
+//
+// Threading support
+//
+
+namespace detail {
+
+int acquireAutoGil()
+{
+    ensureInitialized();
+
+    // Sub-interpreter threads always hold their GIL while running python code
+    if (!threaded() || t_SubinterpreterContext) {
+        return -1;
+    }
+    PyGILState_STATE state = PyGILState_Ensure();
+    drainDeferredDecrefs();
+    return state;
+}
+
+void releaseAutoGil(int state)
+{
+    if (state >= 0) {
+        PyGILState_Release(static_cast<PyGILState_STATE>(state));
+    }
+}
+
+InterpreterContext* createInterpreterContext()
+{
+    return new InterpreterContext(s_MainContext.names.capacity(),
+        s_MainContext.methods.capacity(), s_MainContext.missing.capacity(),
+        s_MainContext.code.capacity());
+}
+
+void destroyInterpreterContext(InterpreterContext* context)
+{
+    delete context;
+}
+
+#ifdef WRAPPY_HEAP_TYPES
+PyTypeObject* interpreterType(PyType_Spec* spec)
+{
+    PythonObject& type = context().types[spec];
+    if (!type) {
+        type = PythonObject(PythonObject::owning {}, PyType_FromSpec(spec));
+        if (!type) {
+            context().types.erase(spec);
+            detail::throwPythonError(std::string("Wrappy: Couldn't create type ") + spec->name + ".");
+        }
+    }
+    return reinterpret_cast<PyTypeObject*>(type.get());
+}
+#endif
+
+InterpreterContext* enterInterpreterContext(InterpreterContext* context)
+{
+    InterpreterContext* previous = t_SubinterpreterContext;
+    t_SubinterpreterContext = context;
+    return previous;
+}
+
+} // end namespace detail
+
+void enableThreads()
+{
+    ensureInitialized();
+    if (threaded()) {
+        return;
+    }
+
+#if PY_VERSION_HEX < 0x03070000
+    // Creates the GIL, and acquires it for the current thread.
+    // Newer versions always create it in Py_Initialize().
+    PyEval_InitThreads();
+#endif
+    s_ThreadsEnabled = true;
+    s_MainThreadState = PyEval_SaveThread();
+}
+
+bool threadsEnabled()
+{
+    return threaded();
+}
+
+void initialize(const Config& config)
+{
+    bool started = false;
+    std::call_once(s_InitializeOnce, [&]() {
+        startInterpreter(config);
+        started = true;
+    });
+    if (!started) {
+        throw WrappyError("Wrappy: The interpreter is already initialized.");
+    }
+
+    if (config.trackMemory) {
+        memory::setEnabled(true);
+    }
+    if (!config.preImport.empty()) {
+        enableThreads();
+        s_PreImportThread = new std::thread(preImport, config.preImport);
+    }
+}
+
+bool initialized()
+{
+    return s_Initialized;
+}
+
+StartupStats startupStats()
+{
+    std::lock_guard<std::mutex> lock(s_StartupMutex);
+    return s_StartupStats;
+}
+
+GilAcquire::GilAcquire()
+  : state_((ensureInitialized(), PyGILState_Ensure()))
+{
+    drainDeferredDecrefs();
+}
+
+void setDeferredDecref(bool enabled)
+{
+    s_DeferDecrefs = enabled;
+}
+
+void flushDeferredDecrefs()
+{
+    // Nothing can be deferred before the interpreter runs
+    if (!s_Initialized) {
+        return;
+    }
+    PyGILState_STATE state = PyGILState_Ensure();
+    drainDeferredDecrefs();
+    PyGILState_Release(state);
+}
+
+DeferredDecrefStats deferredDecrefStats()
+{
+    DeferredDecrefStats stats;
+    stats.depth = s_DeferredDepth;
+    stats.maxDepth = s_DeferredMaxDepth;
+    stats.deferred = s_DeferredTotal;
+    stats.drains = s_DeferredDrains;
+    return stats;
+}
+
+GilAcquire::~GilAcquire()
+{
+    PyGILState_Release(static_cast<PyGILState_STATE>(state_));
+}
+
+GilRelease::GilRelease()
+  : state_(PyEval_SaveThread())
+{ }
+
+GilRelease::~GilRelease()
+{
+    PyEval_RestoreThread(static_cast<PyThreadState*>(state_));
+}
+
+//
+// Container construction
+//
+
+namespace detail {
+
+namespace {
+
+PythonObject checkedNew(PyObject* obj, const char* type)
+{
+    WRAPPY_COUNT(s_Allocations, 1);
+    if (!obj) {
+        detail::throwPythonError(std::string("Wrappy: Couldn't create python ") + type + ".");
+    }
+    return PythonObject(PythonObject::owning {}, obj);
+}
+
+void checkItem(const PythonObject& item)
+{
+    if (!item) {
+        PyErr_Clear();
+        throw WrappyError("Wrappy: Couldn't convert container element.");
+    }
+}
+
+} // end unnamed namespace
+
+PythonObject newList(size_t size)
+{
+    return checkedNew(PyList_New(size), "list");
+}
+
+PythonObject newTuple(size_t size)
+{
+    return checkedNew(PyTuple_New(size), "tuple");
+}
+
+PythonObject newDict()
+{
+    return checkedNew(PyDict_New(), "dictionary");
+}
+
+PythonObject newSet()
+{
+    return checkedNew(PySet_New(nullptr), "set");
+}
+
+void setListItem(const PythonObject& list, size_t index, PythonObject item)
+{
+    checkItem(item);
+    PyList_SET_ITEM(list.get(), index, item.release());
+}
+
+void setTupleItem(const PythonObject& tuple, size_t index, PythonObject item)
+{
+    checkItem(item);
+    PyTuple_SET_ITEM(tuple.get(), index, item.release());
+}
+
+void setDictItem(const PythonObject& dict, const PythonObject& key, const PythonObject& value)
+{
+    checkItem(key);
+    checkItem(value);
+    if (PyDict_SetItem(dict.get(), key.get(), value.get()) < 0) {
+        PyErr_Clear();
+        throw WrappyError("Wrappy: Dictionary key is not hashable.");
+    }
+}
+
+void addSetItem(const PythonObject& set, const PythonObject& item)
+{
+    checkItem(item);
+    if (PySet_Add(set.get(), item.get()) < 0) {
+        PyErr_Clear();
+        throw WrappyError("Wrappy: Set element is not hashable.");
+    }
+}
+
+} // end namespace detail
+
+//
+// Debug counters
+//
+
+namespace debug {
+
+bool vectorcallEnabled()
+{
+#ifdef WRAPPY_VECTORCALL
+    return true;
+#else
+    return false;
+#endif
+}
+
+bool countersEnabled()
+{
+#ifdef WRAPPY_DEBUG_COUNTERS
+    return true;
+#else
+    return false;
+#endif
+}
+
+Counters counters()
+{
+    Counters res {0, 0, 0};
+#ifdef WRAPPY_DEBUG_COUNTERS
+    res.allocations = s_Allocations;
+    res.increfs = s_Increfs;
+    res.decrefs = s_Decrefs;
+#endif
+    return res;
+}
+
+void resetCounters()
+{
+#ifdef WRAPPY_DEBUG_COUNTERS
+    s_Allocations = 0;
+    s_Increfs = 0;
+    s_Decrefs = 0;
+#endif
+}
+
+} // end namespace debug
+
+//
+// Function<> support
+//
+
+namespace detail {
+
+void prepareArgumentTuple(PythonObject& tuple, size_t size)
+{
+    // A tuple can only be refilled while nobody else has seen it,
+    // e.g. a function that stored its *args keeps a reference.
+    if (tuple && Py_REFCNT(tuple.get()) == 1) {
+        return;
+    }
+
+    WRAPPY_COUNT(s_Allocations, 1);
+    tuple = PythonObject(PythonObject::owning {}, PyTuple_New(size));
+    if (!tuple) {
+        detail::throwPythonError("Wrappy: Couldn't create python tuple.");
+    }
+}
+
+void setArgument(PythonObject& tuple, size_t index, PythonObject value)
+{
+    // Steals the reference and drops the one held by a previous call
+    PyTuple_SetItem(tuple.get(), index, value.release());
+}
+
+void callWithArgumentTuple(
+    const PythonObject& function, PythonObject& tuple, unsigned long long convertStart,
+    ResultConverter convert, void* out)
+{
+    CallTimer timer(convertStart);
+    if (timer) {
+        timer.site = callSiteName(function.get());
+    }
+    PyObject* result = PyObject_Call(function.get(), tuple.get(), nullptr);
+    timer.end(metrics::Execute);
+    PythonObject res = checkedResult(result);
+    convert(res.get(), out);
+    timer.end(metrics::Unmarshal);
+    timer.done();
+
+    // Don't keep the arguments alive until the next call
+    if (Py_REFCNT(tuple.get()) == 1) {
+        for (Py_ssize_t i = 0; i < PyTuple_GET_SIZE(tuple.get()); ++i) {
+            PyTuple_SetItem(tuple.get(), i, nullptr);
+        }
+    }
+}
+
+PythonObject callWithArgumentTuple(
+    const PythonObject& function, PythonObject& tuple, unsigned long long convertStart)
+{
+    PythonObject res;
+    callWithArgumentTuple(function, tuple, convertStart, [](PyObject* result, void* out) {
+        *static_cast<PythonObject*>(out) = PythonObject(PythonObject::borrowed {}, result);
+    }, &res);
+    return res;
+}
+
+PythonObject map(const PythonObject& function, std::vector<PythonObject>& arguments, bool unpack)
+{
+    WRAPPY_COUNT(s_Allocations, 1);
+    PythonObject list(PythonObject::owning {}, PyList_New(arguments.size()));
+    if (!list) {
+        detail::throwPythonError("Wrappy: Couldn't create python list.");
+    }
+    for (size_t i = 0; i < arguments.size(); ++i) {
+        PyList_SET_ITEM(list.get(), i, arguments[i].release());
+    }
+    arguments.clear();
+
+    PythonObject tuple;
+    prepareArgumentTuple(tuple, 2);
+    setArgument(tuple, 0, function);
+    setArgument(tuple, 1, std::move(list));
+    PythonObject iterator = callWithArgumentTuple(
+        load(unpack ? "itertools.starmap" : "map"), tuple, 0);
+
+    PythonObject res(PythonObject::owning {}, PySequence_List(iterator.get()));
+    if (!res) {
+        detail::throwPythonError("Wrappy: Exception during call to python function");
+    }
+    return res;
+}
+
+long long toLongLong(PyObject* obj)
+{
+    // PyLong_AsLongLong() would silently truncate floats
+    if (PyFloat_Check(obj)) {
+        throw WrappyError("Wrappy: Python object is not an integer.");
+    }
+
+    long long res = PyLong_AsLongLong(obj);
+    if (res == -1 && PyErr_Occurred()) {
+        PyErr_Clear();
+        throw WrappyError("Wrappy: Python object is not an integer.");
+    }
+    return res;
+}
+
+unsigned long long toUnsignedLongLong(PyObject* obj)
+{
+    if (PyFloat_Check(obj)) {
+        throw WrappyError("Wrappy: Python object is not an integer.");
+    }
+
+    long long res = PyLong_AsLongLong(obj);
+    if (res == -1 && PyErr_Occurred()) {
+        // Beyond long long, which only a python 2 long or python 3 int can be
+        if (!PyErr_ExceptionMatches(PyExc_OverflowError) || !PyLong_Check(obj)) {
+            PyErr_Clear();
+            throw WrappyError("Wrappy: Python object is not an integer.");
+        }
+        PyErr_Clear();
+        unsigned long long value = PyLong_AsUnsignedLongLong(obj);
+        if (value == static_cast<unsigned long long>(-1) && PyErr_Occurred()) {
+            PyErr_Clear();
+            throw WrappyError("Wrappy: Integer out of range.");
+        }
+        return value;
+    }
+    if (res < 0) {
+        throw WrappyError("Wrappy: Integer out of range.");
+    }
+    return res;
+}
+
+double toDouble(PyObject* obj)
+{
+    double res = PyFloat_AsDouble(obj);
+    if (res == -1.0 && PyErr_Occurred()) {
+        PyErr_Clear();
+        throw WrappyError("Wrappy: Python object is not a number.");
+    }
+    return res;
+}
+
+bool toBool(PyObject* obj)
+{
+    int res = PyObject_IsTrue(obj);
+    if (res < 0) {
+        PyErr_Clear();
+        throw WrappyError("Wrappy: Python object has no truth value.");
+    }
+    return res != 0;
+}
+
+std::string toString(PyObject* obj)
+{
+    const char* buffer;
+    Py_ssize_t length;
+    if (compat::asStringAndSize(obj, &buffer, &length) < 0) {
+        PyErr_Clear();
+        throw WrappyError("Wrappy: Python object is not a string.");
+    }
+    return std::string(buffer, length);
+}
+
+PythonObject sequenceItems(PyObject* obj, PyObject**& items, size_t& size)
+{
+    PythonObject sequence(PythonObject::owning {},
+        PySequence_Fast(obj, "Wrappy: Python object is not a sequence."));
+    if (!sequence) {
+        PyErr_Clear();
+        throw WrappyError("Wrappy: Python object is not a sequence.");
+    }
+
+    items = PySequence_Fast_ITEMS(sequence.get());
+    size = PySequence_Fast_GET_SIZE(sequence.get());
+    return sequence;
+}
+
+PythonObject fixedSizeItems(PyObject* obj, size_t size, PyObject**& items)
+{
+    size_t actual;
+    PythonObject sequence = sequenceItems(obj, items, actual);
+    if (actual != size) {
+        throw WrappyError("Wrappy: Expected a sequence of " + std::to_string(size)
+            + " items, got " + std::to_string(actual) + ".");
+    }
+    return sequence;
+}
+
+PythonObject asDict(PyObject* obj)
+{
+    if (PyDict_Check(obj)) {
+        return PythonObject(PythonObject::borrowed {}, obj);
+    }
+
+    PythonObject dict(PythonObject::owning {},
+        PyObject_CallFunctionObjArgs(reinterpret_cast<PyObject*>(&PyDict_Type), obj, nullptr));
+    if (!dict) {
         PyErr_Clear();
-    } else if (PyErr_Occurred() || !obj_) {
-        PyErr_Print();
+        throw WrappyError("Wrappy: Python object can't be converted to a dict.");
+    }
+    return dict;
+}
+
+size_t dictSize(PyObject* dict)
+{
+    return PyDict_Size(dict);
+}
+
+bool dictNext(PyObject* dict, ptrdiff_t& pos, PyObject*& key, PyObject*& value)
+{
+    Py_ssize_t pypos = pos;
+    bool res = PyDict_Next(dict, &pypos, &key, &value);
+    pos = pypos;
+    return res;
+}
+
+} // end namespace detail
+
+//
+// PythonIterator implementation
+//
+
+namespace detail {
+
+ItemSource::ItemSource()
+  : indexed_(false)
+  , index_(0)
+  , current_(nullptr)
+{ }
+
+ItemSource::ItemSource(const PythonObject& iterable)
+  : indexed_(false)
+  , index_(0)
+  , current_(nullptr)
+{
+    AutoGil gil;
+    PyObject* obj = iterable.get();
+    if (obj && (PyList_CheckExact(obj) || PyTuple_CheckExact(obj))) {
+        source_ = iterable;
+        indexed_ = true;
+        return;
+    }
+
+    source_ = PythonObject(PythonObject::owning {}, obj ? PyObject_GetIter(obj) : nullptr);
+    if (!source_) {
         PyErr_Clear();
-        throw WrappyError("Unexcected exception during iteration");
+        throw WrappyError("Wrappy: Python object is not iterable.");
+    }
+}
+
+ItemSource::ItemSource(const ItemSource& other)
+  : source_(other.source_)
+  , indexed_(other.indexed_)
+  , index_(other.index_)
+  , current_(other.current_)
+{
+    if (current_) {
+        AutoGil gil;
+        incref(current_);
+    }
+}
+
+ItemSource& ItemSource::operator=(ItemSource other)
+{
+    std::swap(source_, other.source_);
+    std::swap(indexed_, other.indexed_);
+    std::swap(index_, other.index_);
+    std::swap(current_, other.current_);
+    return *this;
+}
+
+ItemSource::~ItemSource()
+{
+    if (current_) {
+        AutoGil gil;
+        decref(current_);
+    }
+}
+
+PyObject* ItemSource::next()
+{
+    PyObject* item = nullptr;
+    if (indexed_) {
+        // A list can change its size between two calls
+        PyObject* seq = source_.get();
+        Py_ssize_t size = PyList_CheckExact(seq) ? PyList_GET_SIZE(seq) : PyTuple_GET_SIZE(seq);
+        if (Py_ssize_t(index_) < size) {
+            item = PyList_CheckExact(seq) ? PyList_GET_ITEM(seq, index_) : PyTuple_GET_ITEM(seq, index_);
+            ++index_;
+            incref(item);
+        }
+    } else if (source_) {
+        TraceScope trace("iterate", Py_TYPE(source_.get())->tp_name);
+        item = PyIter_Next(source_.get()); // NULL without error at the end
+        if (!item && PyErr_Occurred()) {
+            detail::throwPythonError("Unexcected exception during iteration");
+        }
+    }
+
+    decref(current_);
+    current_ = item;
+    return item;
+}
+
+bool ItemSource::fill(std::vector<PythonObject>& items, size_t count)
+{
+    AutoGil gil;
+    items.clear();
+    while (items.size() < count) {
+        PyObject* item = next();
+        if (!item) {
+            break;
+        }
+        items.emplace_back(PythonObject::borrowed {}, item);
+    }
+    return !items.empty();
+}
+
+} // end namespace detail
+
+PythonIterator::PythonIterator(bool stopped, detail::ItemSource source):
+  stopped_(stopped),
+  source_(std::move(source))
+{}
+
+PythonIterator begin(PythonObject obj)
+{
+    PythonIterator iter(false, detail::ItemSource(obj));
+    // Move iterator to first position in list to
+    // initialize obj_
+    return ++iter;
+}
+
+PythonIterator end(PythonObject)
+{
+    return PythonIterator(true, detail::ItemSource());
+}
+
+PythonIterator& PythonIterator::operator++()
+{
+    detail::AutoGil gil;
+    PyObject* item = source_.next();
+    if (item) {
+        obj_ = PythonObject(PythonObject::borrowed {}, item);
+    } else {
+        stopped_ = true;
+        obj_ = PythonObject();
     }
 
     return *this;
@@ -421,6 +2155,148 @@ bool PythonIterator::operator!=(const PythonIterator& other) {
 
 namespace {
 
+// The callback is stored as the capsule pointer, its userdata as context
+const char* const s_LambdaCapsule = "wrappy.Lambda";
+const char* const s_LambdaWithDataCapsule = "wrappy.LambdaWithData";
+
+// Call sites of callbacks are named after the C++ function
+std::string callbackSiteName(const char* kind, const void* function)
+{
+    char buffer[64];
+    std::snprintf(buffer, sizeof(buffer), "<%s %p>", kind, function);
+    return buffer;
+}
+
+// Typed callbacks are named after the type of the callable rather than their
+// address, so all callbacks made from the same lambda expression share a site
+const std::string& callbackSiteName(detail::CallbackBase* callback)
+{
+    if (callback->site.empty()) {
+        const char* name = callback->type.name();
+#ifdef __GNUG__
+        int status = 0;
+        std::unique_ptr<char, void(*)(void*)> demangled(
+            abi::__cxa_demangle(name, nullptr, nullptr, &status), std::free);
+        if (status == 0) {
+            callback->site = std::string("<callback ") + demangled.get() + ">";
+            return callback->site;
+        }
+#endif
+        callback->site = std::string("<callback ") + name + ">";
+    }
+    return callback->site;
+}
+
+// Sets the python error for the C++ exception being handled, which must
+// not unwind through the interpreter. Only call from a catch block.
+void raiseCurrentException(const char* unknown)
+{
+    try {
+        throw;
+    } catch (const PythonError& e) {
+        // Let the original exception propagate
+        PythonObject type = e.type(), value = e.value(), traceback = e.traceback();
+        PyErr_Restore(type.release(), value.release(), traceback.release());
+    } catch (const std::exception& e) {
+        PyErr_SetString(PyExc_RuntimeError, e.what());
+    } catch (...) {
+        PyErr_SetString(PyExc_RuntimeError, unknown);
+    }
+}
+
+// Starts timing a Lambda callback
+void startLambda(CallTimer& timer, void* function)
+{
+    if (timer) {
+        timer.site = callbackSiteName("lambda", function);
+    }
+}
+
+// Ends timing a Lambda callback, which failed if the result is empty
+PyObject* finishLambda(PythonObject result, CallTimer& timer)
+{
+    timer.end(metrics::Execute);
+    if (result) {
+        timer.done();
+    }
+    return result.release();
+}
+
+void* capsulePointer(PyObject* data, const char* name)
+{
+    void* pointer = PyCapsule_GetPointer(data, name);
+    if (!pointer) {
+        throw WrappyError("Trampoline data corrupted");
+    }
+    return pointer;
+}
+
+#ifdef WRAPPY_FASTCALL
+// The arguments are borrowed from python's argument array, keyword
+// arguments follow the positional ones and are named by kwnames.
+std::vector<PythonObject> to_vector(PyObject* const* pyargs, Py_ssize_t nargs)
+{
+    std::vector<PythonObject> args;
+    args.reserve(nargs);
+    for (Py_ssize_t i = 0; i < nargs; ++i) {
+        args.emplace_back(PythonObject::borrowed{}, pyargs[i]);
+    }
+    return args;
+}
+
+std::map<const char*, PythonObject> to_map(
+    PyObject* const* pyargs, Py_ssize_t nargs, PyObject* kwnames)
+{
+    std::map<const char*, PythonObject> kwargs;
+    Py_ssize_t nkwargs = kwnames ? PyTuple_GET_SIZE(kwnames) : 0;
+    for (Py_ssize_t i = 0; i < nkwargs; ++i) {
+        const char* str = compat::asString(PyTuple_GET_ITEM(kwnames, i));
+        kwargs.emplace(str, PythonObject(PythonObject::borrowed{}, pyargs[nargs + i]));
+    }
+    return kwargs;
+}
+
+PyObject* trampolineWithData(PyObject* data, PyObject* const* pyargs,
+    Py_ssize_t nargs, PyObject* kwnames)
+{
+    // Exceptions must not unwind through the interpreter
+    try {
+        auto fun = reinterpret_cast<LambdaWithData>(capsulePointer(data, s_LambdaWithDataCapsule));
+        void* userdata = PyCapsule_GetContext(data);
+        CallTimer timer(0, "callback");
+        startLambda(timer, reinterpret_cast<void*>(fun));
+        auto args = to_vector(pyargs, nargs);
+        auto kwargs = to_map(pyargs, nargs, kwnames);
+        timer.end(metrics::Marshal);
+
+        return finishLambda(fun(args, kwargs, userdata), timer);
+    } catch (...) {
+        raiseCurrentException("Wrappy: Unknown exception in callback.");
+    }
+    return nullptr;
+}
+
+PyObject* trampolineNoData(PyObject* data, PyObject* const* pyargs,
+    Py_ssize_t nargs, PyObject* kwnames)
+{
+    // Exceptions must not unwind through the interpreter
+    try {
+        auto fun = reinterpret_cast<Lambda>(capsulePointer(data, s_LambdaCapsule));
+        CallTimer timer(0, "callback");
+        startLambda(timer, reinterpret_cast<void*>(fun));
+        auto args = to_vector(pyargs, nargs);
+        auto kwargs = to_map(pyargs, nargs, kwnames);
+        timer.end(metrics::Marshal);
+
+        return finishLambda(fun(args, kwargs), timer);
+    } catch (...) {
+        raiseCurrentException("Wrappy: Unknown exception in callback.");
+    }
+    return nullptr;
+}
+
+const int s_TrampolineFlags = METH_FASTCALL | METH_KEYWORDS;
+#else
 std::vector<PythonObject> to_vector(PyObject* pyargs)
 {
     if (!PyTuple_Check(pyargs)) {
@@ -444,7 +2320,7 @@ std::map<const char*, PythonObject> to_map(PyObject* pykwargs)
     PyObject *key, *value;
     Py_ssize_t pos = 0;
     while (PyDict_Next(pykwargs, &pos, &key, &value)) {
-        const char* str = PyString_AsString(key);
+        const char* str = compat::asString(key);
         PythonObject obj(PythonObject::borrowed{}, value);
         kwargs.emplace(str, obj);
     }
@@ -452,58 +2328,280 @@ std::map<const char*, PythonObject> to_map(PyObject* pykwargs)
     return kwargs;
 }
 
-PyObject* trampolineWithData(PyObject* data, PyObject* pyargs, PyObject* pykwargs) {
-    if (!PyCObject_Check(data)) {
-        throw WrappyError("Trampoline data corrupted");
+PyObject* trampolineWithData(PyObject* data, PyObject* pyargs, PyObject* pykwargs)
+{
+    // Exceptions must not unwind through the interpreter
+    try {
+        auto fun = reinterpret_cast<LambdaWithData>(capsulePointer(data, s_LambdaWithDataCapsule));
+        void* userdata = PyCapsule_GetContext(data);
+        CallTimer timer(0, "callback");
+        startLambda(timer, reinterpret_cast<void*>(fun));
+        auto args = to_vector(pyargs);
+        auto kwargs = pykwargs ? to_map(pykwargs) : std::map<const char*, PythonObject>();
+        timer.end(metrics::Marshal);
+
+        return finishLambda(fun(args, kwargs, userdata), timer);
+    } catch (...) {
+        raiseCurrentException("Wrappy: Unknown exception in callback.");
+    }
+    return nullptr;
+}
+
+PyObject* trampolineNoData(PyObject* data, PyObject* pyargs, PyObject* pykwargs)
+{
+    // Exceptions must not unwind through the interpreter
+    try {
+        auto fun = reinterpret_cast<Lambda>(capsulePointer(data, s_LambdaCapsule));
+        CallTimer timer(0, "callback");
+        startLambda(timer, reinterpret_cast<void*>(fun));
+        auto args = to_vector(pyargs);
+        auto kwargs = pykwargs ? to_map(pykwargs) : std::map<const char*, PythonObject>();
+        timer.end(metrics::Marshal);
+
+        return finishLambda(fun(args, kwargs), timer);
+    } catch (...) {
+        raiseCurrentException("Wrappy: Unknown exception in callback.");
+    }
+    return nullptr;
+}
+
+const int s_TrampolineFlags = METH_VARARGS | METH_KEYWORDS;
+#endif
+
+// The reinterpret_cast<>'s here are technically undefined behaviour, but it's
+// the only way that python's C API provides :(
+PyMethodDef trampolineNoDataMethod {"trampoline1", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)()>(trampolineNoData)), s_TrampolineFlags, nullptr};
+PyMethodDef trampolineWithDataMethod {"trampoline2", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)()>(trampolineWithData)), s_TrampolineFlags, nullptr};
+
+// Typed callbacks, see construct(F). The capsule owns the callback.
+const char* const s_CallbackCapsule = "wrappy.Callback";
+
+void destroyCallback(PyObject* capsule)
+{
+    delete static_cast<detail::CallbackBase*>(PyCapsule_GetPointer(capsule, s_CallbackCapsule));
+}
+
+PyObject* invokeCallback(PyObject* data, PyObject* const* args, Py_ssize_t nargs, bool keywords)
+{
+    auto callback = static_cast<detail::CallbackBase*>(PyCapsule_GetPointer(data, s_CallbackCapsule));
+    if (!callback) {
+        return nullptr;
+    }
+    if (keywords) {
+        PyErr_SetString(PyExc_TypeError, "Wrappy: Callback takes no keyword arguments.");
+        return nullptr;
+    }
+    if (size_t(nargs) != callback->arity) {
+        PyErr_Format(PyExc_TypeError, "Wrappy: Callback takes %zu arguments (%zd given).",
+            callback->arity, nargs);
+        return nullptr;
     }
 
-    LambdaWithData fun = reinterpret_cast<LambdaWithData>(PyCObject_AsVoidPtr(data));
-    void* userdata = PyCObject_GetDesc(data);
-    auto args = to_vector(pyargs);
-    auto kwargs = to_map(pykwargs);
+    // Arguments are converted inside the callback, so it's all execution
+    CallTimer timer(0, "callback");
+    if (timer) {
+        timer.site = callbackSiteName(callback);
+    }
 
-    return fun(args, kwargs, userdata).release();
+    // Exceptions must not unwind through the interpreter
+    try {
+        PyObject* result = callback->call(args);
+        timer.end(metrics::Execute);
+        if (result) {
+            timer.done();
+        }
+        return result;
+    } catch (...) {
+        raiseCurrentException("Wrappy: Unknown exception in callback.");
+    }
+    return nullptr;
 }
 
-PyObject* trampolineNoData(PyObject* data, PyObject* pyargs, PyObject* pykwargs)
+#ifdef WRAPPY_FASTCALL
+PyObject* callbackTrampoline(PyObject* data, PyObject* const* args,
+    Py_ssize_t nargs, PyObject* kwnames)
 {
-    if (!PyCObject_Check(data)) {
-        throw WrappyError("Trampoline data corrupted");
+    return invokeCallback(data, args, nargs, kwnames && PyTuple_GET_SIZE(kwnames));
+}
+#else
+PyObject* callbackTrampoline(PyObject* data, PyObject* args, PyObject* kwargs)
+{
+    // The items of a tuple are stored in an array
+    return invokeCallback(data, &PyTuple_GET_ITEM(args, 0), PyTuple_GET_SIZE(args),
+        kwargs && PyDict_Size(kwargs));
+}
+#endif
+
+PyMethodDef callbackMethod {"callback", reinterpret_cast<PyCFunction>(reinterpret_cast<void(*)()>(callbackTrampoline)), s_TrampolineFlags, nullptr};
+
+// Python iterators over C++ ranges, see constructIter(). The elements are
+// produced while python iterates, and the stream is destroyed as soon as
+// it is exhausted.
+struct StreamIterator {
+    PyObject_HEAD
+    detail::StreamBase* stream;
+    size_t chunk; // 0 to yield single elements instead of lists
+};
+
+void finishStream(StreamIterator* self)
+{
+    delete self->stream;
+    self->stream = nullptr;
+}
+
+PyObject* streamNext(PyObject* object)
+{
+    auto self = reinterpret_cast<StreamIterator*>(object);
+    if (!self->stream) {
+        return nullptr;
     }
 
-    Lambda fun = reinterpret_cast<Lambda>(PyCObject_AsVoidPtr(data));
-    auto args = to_vector(pyargs);
-    auto kwargs = to_map(pykwargs);
+    try {
+        if (!self->chunk) {
+            PyObject* item = self->stream->next();
+            if (!item) {
+                finishStream(self);
+            }
+            return item;
+        }
 
-    return fun(args, kwargs).release();
+        PythonObject list(PythonObject::owning {}, PyList_New(0));
+        if (!list) {
+            return nullptr;
+        }
+        while (size_t(PyList_GET_SIZE(list.get())) < self->chunk) {
+            PythonObject item(PythonObject::owning {}, self->stream->next());
+            if (!item) {
+                // A failed conversion drops the chunk
+                if (PyErr_Occurred()) {
+                    return nullptr;
+                }
+                finishStream(self);
+                break;
+            }
+            if (PyList_Append(list.get(), item.get()) < 0) {
+                return nullptr;
+            }
+        }
+        return PyList_GET_SIZE(list.get()) ? list.release() : nullptr;
+    } catch (...) {
+        raiseCurrentException("Wrappy: Unknown exception in iterator.");
+    }
+    return nullptr;
 }
 
-// The reinterpret_cast<>'s here are technically undefined behaviour, but it's
-// the only way that python's C API provides :(
-PyMethodDef trampolineNoDataMethod {"trampoline1", reinterpret_cast<PyCFunction>(trampolineNoData), METH_KEYWORDS, nullptr};
-PyMethodDef trampolineWithDataMethod {"trampoline2", reinterpret_cast<PyCFunction>(trampolineWithData), METH_KEYWORDS, nullptr};
+void streamDealloc(PyObject* object)
+{
+    finishStream(reinterpret_cast<StreamIterator*>(object));
+    PyTypeObject* type = Py_TYPE(object);
+    PyObject_Del(object);
+#ifdef WRAPPY_HEAP_TYPES
+    Py_DECREF(type); // instances of heap types own a reference
+#else
+    (void)type;
+#endif
+}
+
+#ifdef WRAPPY_HEAP_TYPES
+PyType_Slot s_StreamSlots[] = {
+    {Py_tp_dealloc, reinterpret_cast<void*>(streamDealloc)},
+    {Py_tp_iter, reinterpret_cast<void*>(PyObject_SelfIter)},
+    {Py_tp_iternext, reinterpret_cast<void*>(streamNext)},
+    {0, nullptr},
+};
+
+PyType_Spec s_StreamSpec = {"wrappy.Iterator", sizeof(StreamIterator), 0,
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_DISALLOW_INSTANTIATION, s_StreamSlots};
+
+PyTypeObject* streamType()
+{
+    return detail::interpreterType(&s_StreamSpec);
+}
+#else
+PyTypeObject s_StreamType = compat::staticType();
+
+PyTypeObject* streamType()
+{
+    if (!(s_StreamType.tp_flags & Py_TPFLAGS_READY)) {
+        s_StreamType.tp_name = "wrappy.Iterator";
+        s_StreamType.tp_basicsize = sizeof(StreamIterator);
+        s_StreamType.tp_dealloc = streamDealloc;
+        s_StreamType.tp_iter = PyObject_SelfIter;
+        s_StreamType.tp_iternext = streamNext;
+        s_StreamType.tp_flags = Py_TPFLAGS_DEFAULT;
+        if (PyType_Ready(&s_StreamType) < 0) {
+            detail::throwPythonError("Wrappy: Couldn't initialize iterator type.");
+        }
+    }
+    return &s_StreamType;
+}
+#endif
+
+PythonObject newTrampoline(PyMethodDef* method, void* function, const char* name, void* userdata)
+{
+    PythonObject data(PythonObject::owning{}, PyCapsule_New(function, name, nullptr));
+    if (!data || (userdata && PyCapsule_SetContext(data.get(), userdata) < 0)) {
+        detail::throwPythonError("Wrappy: Couldn't create callback.");
+    }
+    // The function object keeps its own reference to the capsule
+    return PythonObject(PythonObject::owning{}, PyCFunction_New(method, data.get()));
+}
 
 } // end namespace
 
 PythonObject construct(Lambda lambda)
 {
-    PyObject* pydata = PyCObject_FromVoidPtr(reinterpret_cast<void*>(lambda), nullptr);
-    return PythonObject(PythonObject::owning{}, PyCFunction_New(&trampolineNoDataMethod, pydata));
+    detail::AutoGil gil;
+    return newTrampoline(&trampolineNoDataMethod,
+        reinterpret_cast<void*>(lambda), s_LambdaCapsule, nullptr);
 }
 
 PythonObject construct(LambdaWithData lambda, void* userdata)
 {
-    PyObject* pydata;
-    if (!userdata) {
-        pydata = PyCObject_FromVoidPtr(reinterpret_cast<void*>(lambda), nullptr);
-    } else { // python returns an error if FromVoidPtrAndDesc is called with desc being null
-        pydata = PyCObject_FromVoidPtrAndDesc(reinterpret_cast<void*>(lambda), userdata, nullptr);
+    detail::AutoGil gil;
+    return newTrampoline(&trampolineWithDataMethod,
+        reinterpret_cast<void*>(lambda), s_LambdaWithDataCapsule, userdata);
+}
+
+namespace detail {
+
+void readyStreamType()
+{
+    streamType();
+}
+
+PythonObject newCallback(std::unique_ptr<CallbackBase> callback)
+{
+    AutoGil gil;
+    PythonObject data(PythonObject::owning{},
+        PyCapsule_New(callback.get(), s_CallbackCapsule, destroyCallback));
+    if (!data) {
+        detail::throwPythonError("Wrappy: Couldn't create callback.");
     }
-    return PythonObject(PythonObject::owning{}, PyCFunction_New(&trampolineWithDataMethod, pydata));
+    callback.release();
+
+    PythonObject function(PythonObject::owning{}, PyCFunction_New(&callbackMethod, data.get()));
+    if (!function) {
+        detail::throwPythonError("Wrappy: Couldn't create callback.");
+    }
+    return function;
 }
 
+PythonObject newStream(std::unique_ptr<StreamBase> stream, size_t chunk)
+{
+    AutoGil gil;
+    PythonObject iterator(PythonObject::owning {},
+        reinterpret_cast<PyObject*>(PyObject_New(StreamIterator, streamType())));
+    if (!iterator) {
+        detail::throwPythonError("Wrappy: Couldn't create iterator.");
+    }
+
+    auto raw = reinterpret_cast<StreamIterator*>(iterator.get());
+    raw->stream = stream.release();
+    raw->chunk = chunk;
+    return iterator;
+}
 
-typedef PythonObject (*Lambda)(const std::vector<PythonObject>& args, const std::map<const char*, PythonObject>& kwargs);
-typedef PythonObject (*LambdaWithData)(const std::vector<PythonObject>& args, const std::map<const char*, PythonObject>& kwargs, void* userdata);
+} // end namespace detail
 
 } // end namespace wrappy